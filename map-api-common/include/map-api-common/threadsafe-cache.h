@@ -22,7 +22,11 @@
 #ifndef MAP_API_COMMON_THREADSAFE_CACHE_H_
 #define MAP_API_COMMON_THREADSAFE_CACHE_H_
 
+#include <array>
+#include <functional>
 #include <iostream>  // NOLINT
+#include <list>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <utility>
@@ -45,9 +49,19 @@ namespace map_api_common {
 // it is assumed that the Raw data is available as a MappedContainerBase itself.
 // If this is not the case, you need to write a MappedContainerBase interface
 // to the raw resource.
+// Cache entries and available ids are striped over shards by id hash, each
+// with its own locks, so that accesses to different items can run in
+// parallel. Accesses to the raw container are serialized, since it is not
+// assumed to be threadsafe. Whether an entry is new to the raw container is
+// recorded when it is loaded or inserted, so flush() doesn't depend on the
+// raw container's has().
+// Optionally, clean entries are evicted once a memory budget is exceeded, see
+// setMemoryBudget().
 template <typename IdType, typename RawType, typename CachedType = RawType>
 class ThreadsafeCache : public MappedContainerBase<IdType, CachedType> {
  public:
+  static constexpr size_t kNumShards = 16u;
+
   explicit ThreadsafeCache(
       MappedContainerBase<IdType, RawType>* raw_container)
       : raw_container_(CHECK_NOTNULL(raw_container)) {
@@ -60,34 +74,52 @@ class ThreadsafeCache : public MappedContainerBase<IdType, CachedType> {
   // MAPPED CONTAINER BASE FUNCTIONS
   // ===============================
   virtual bool has(const IdType& id) const final override {
-    std::lock_guard<std::mutex> lock(m_available_ids_);
-    return available_ids_.count(id) > 0u;
+    const Shard& shard = shardOf(id);
+    std::lock_guard<std::mutex> lock(shard.m_available_ids);
+    return shard.available_ids.count(id) > 0u;
   }
 
   virtual void getAllAvailableIds(std::vector<IdType>* available_ids) const
       final override {
     CHECK_NOTNULL(available_ids)->clear();
-    std::lock_guard<std::mutex> lock(m_available_ids_);
-    available_ids->insert(available_ids->end(), available_ids_.begin(),
-                          available_ids_.end());
+    std::vector<std::unique_lock<std::mutex>> locks;
+    lockAllAvailableIds(&locks);
+    for (const Shard& shard : shards_) {
+      available_ids->insert(available_ids->end(), shard.available_ids.begin(),
+                            shard.available_ids.end());
+    }
   }
 
   virtual size_t size() const {
-    std::lock_guard<std::mutex> lock(m_available_ids_);
-    return available_ids_.size();
+    std::vector<std::unique_lock<std::mutex>> locks;
+    lockAllAvailableIds(&locks);
+    size_t result = 0u;
+    for (const Shard& shard : shards_) {
+      result += shard.available_ids.size();
+    }
+    return result;
   }
 
   virtual bool empty() const final override {
-    std::lock_guard<std::mutex> lock(m_available_ids_);
-    return available_ids_.empty();
+    std::vector<std::unique_lock<std::mutex>> locks;
+    lockAllAvailableIds(&locks);
+    for (const Shard& shard : shards_) {
+      if (!shard.available_ids.empty()) {
+        return false;
+      }
+    }
+    return true;
   }
 
   virtual CachedType& getMutable(const IdType& id) final override {
-    std::lock_guard<std::mutex> lock(m_cache_and_raw_);
-    CacheStruct* cached = getImplLocked(id);
+    Shard& shard = shardOf(id);
+    std::lock_guard<std::mutex> lock(shard.m_cache);
+    CacheStruct* cached = getImplLocked(id, &shard).get();
     CHECK_NOTNULL(cached);
     cached->dirty = true;
+    shard.changed_ids.emplace(id);
     if (FLAGS_cache_blame_dirty) {
+      std::lock_guard<std::mutex> backtrace_lock(m_backtraces_);
       static size_t i = 0u;
       if (i % FLAGS_cache_blame_dirty_sampling == 0u) {
         ++unique_dirty_backtraces_[backtrace()];
@@ -97,145 +129,281 @@ class ThreadsafeCache : public MappedContainerBase<IdType, CachedType> {
     return cached->value;
   }
 
+  // With a memory budget, the returned entry is not pinned, so that long
+  // read-only sweeps stay within the budget. The reference then only remains
+  // valid until the next access from any thread that loads an entry into the
+  // cache, as that may evict the referenced entry. Use getShared() to hold on
+  // to values.
   virtual const CachedType& get(const IdType& id) const final override {
-    std::lock_guard<std::mutex> lock(m_cache_and_raw_);
-    const CacheStruct* cached = getImplLocked(id);
+    const Shard& shard = shardOf(id);
+    std::lock_guard<std::mutex> lock(shard.m_cache);
+    const CacheStruct* cached = getImplLocked(id, &shard).get();
     CHECK_NOTNULL(cached);
     CHECK(!cached->to_remove);
     return cached->value;
   }
 
+  // The returned value remains valid even if the entry is evicted meanwhile.
+  std::shared_ptr<const CachedType> getShared(const IdType& id) const {
+    const Shard& shard = shardOf(id);
+    std::lock_guard<std::mutex> lock(shard.m_cache);
+    const std::shared_ptr<CacheStruct> cached = getImplLocked(id, &shard);
+    CHECK(cached);
+    CHECK(!cached->to_remove);
+    return std::shared_ptr<const CachedType>(cached, &cached->value);
+  }
+
   virtual bool insert(const IdType& id,
                       const CachedType& value) final override {
+    Shard& shard = shardOf(id);
     // Follows lock ordering.
-    std::lock_guard<std::mutex> id_lock(m_available_ids_);
-    std::lock_guard<std::mutex> lock(m_cache_and_raw_);
-    std::pair<typename Cache::iterator, bool> emplace_result =
-        cache_.emplace(id, std::unique_ptr<CacheStruct>(new CacheStruct));
-    if (!emplace_result.second) {
+    std::lock_guard<std::mutex> id_lock(shard.m_available_ids);
+    std::lock_guard<std::mutex> lock(shard.m_cache);
+    if (shard.cache.count(id) != 0u) {
       return false;
     }
-    emplace_result.first->second->value = value;
-    emplace_result.first->second->dirty = false;
-    emplace_result.first->second->to_remove = false;
-    available_ids_.emplace(id);
+    std::shared_ptr<CacheStruct> inserted(new CacheStruct);
+    inserted->value = value;
+    inserted->dirty = false;
+    inserted->to_remove = false;
+    inserted->in_raw = false;
+    addLocked(id, std::move(inserted), &shard);
+    shard.available_ids.emplace(id);
+    shard.changed_ids.emplace(id);
     if (FLAGS_cache_blame_insert) {
+      std::lock_guard<std::mutex> backtrace_lock(m_backtraces_);
       ++unique_insert_backtraces_[backtrace()];
     }
     return true;
   }
 
   virtual void erase(const IdType& id) final override {
+    Shard& shard = shardOf(id);
     // Pre-lock necessary for lock ordering.
-    std::lock_guard<std::mutex> id_lock(m_available_ids_);
-    std::lock_guard<std::mutex> lock(m_cache_and_raw_);
-    CacheStruct* cached = getImplLocked(id);
+    std::lock_guard<std::mutex> id_lock(shard.m_available_ids);
+    std::lock_guard<std::mutex> lock(shard.m_cache);
+    CacheStruct* cached = getImplLocked(id, &shard).get();
     CHECK_NOTNULL(cached);
     cached->to_remove = true;
-    available_ids_.erase(id);
+    shard.available_ids.erase(id);
+    shard.changed_ids.emplace(id);
   }
 
   // ===================================
   // THREADSAFE-CACHE-SPECIFIC FUNCTIONS
   // ===================================
-  // Apply cache state to raw state.
+  // Apply cache state to raw state. Only the items that have been inserted,
+  // modified or erased since the last flush are visited.
   void flush() {
-    std::lock_guard<std::mutex> lock(m_cache_and_raw_);
-
-    std::vector<IdType> raw_ids_vector;
-    raw_container_->getAllAvailableIds(&raw_ids_vector);
-    const IdSet raw_ids_set(raw_ids_vector.begin(), raw_ids_vector.end());
+    std::vector<std::unique_lock<std::mutex>> locks;
+    locks.reserve(kNumShards);
+    for (Shard& shard : shards_) {
+      locks.emplace_back(shard.m_cache);
+    }
+    std::lock_guard<std::mutex> raw_lock(m_raw_);
 
     size_t num_insertions = 0u;
     size_t num_updates = 0u;
     size_t num_removals = 0u;
-    for (const typename Cache::value_type& cache_pair : cache_) {
-      if (!cache_pair.second->to_remove) {
-        // An id not existing in the raw id set implies that the corresponding
-        // item doesn't exist in the raw container, thus we can assume that it's
-        // a new insertion.
-        if (raw_ids_set.count(cache_pair.first) == 0u) {
-          // Insertion.
-          RawType to_insert;
-          cacheToRawImpl(cache_pair.second->value, &to_insert);
-          raw_container_->insert(cache_pair.first, to_insert);
-          ++num_insertions;
-        } else {
-          if (cache_pair.second->dirty) {
-            // Update.
-            RawType to_update;
-            cacheToRawImpl(cache_pair.second->value, &to_update);
-            // Not using a virtual function for update filtering on purpose.
-            // Not only is this probably faster to execute, but it also doesn't
-            // require a derived class for each object type.
-            if (update_filter_ &&
-                !update_filter_(raw_container_->get(cache_pair.first),
-                                to_update)) {
-              continue;
+    size_t num_unchanged = 0u;
+    for (const Shard& shard : shards_) {
+      for (const IdType& id : shard.changed_ids) {
+        typename Cache::iterator found = shard.cache.find(id);
+        if (found == shard.cache.end()) {
+          // Discarded since.
+          continue;
+        }
+        CacheStruct& cached = *found->second;
+        if (!cached.to_remove) {
+          if (!cached.in_raw) {
+            // Insertion.
+            RawType to_insert;
+            cacheToRawImpl(cached.value, &to_insert);
+            raw_container_->insert(id, to_insert);
+            cached.in_raw = true;
+            ++num_insertions;
+          } else {
+            if (cached.dirty) {
+              // Update.
+              RawType to_update;
+              cacheToRawImpl(cached.value, &to_update);
+              if (!hasChangedImpl(to_update, &cached.value)) {
+                ++num_unchanged;
+                continue;
+              }
+              // Not using a virtual function for update filtering on purpose.
+              // Not only is this probably faster to execute, but it also
+              // doesn't require a derived class for each object type.
+              if (update_filter_ &&
+                  !update_filter_(raw_container_->get(id), to_update)) {
+                continue;
+              }
+              raw_container_->getMutable(id) = to_update;
+              ++num_updates;
             }
-            raw_container_->getMutable(cache_pair.first) = to_update;
-            ++num_updates;
           }
-        }
-      } else {  // To remove.
-        if (raw_ids_set.count(cache_pair.first) != 0u) {
-          // Removal.
-          raw_container_->erase(cache_pair.first);
-          ++num_removals;
+        } else {  // To remove.
+          // Items inserted since the last flush are not in the raw container.
+          if (cached.in_raw) {
+            // Removal.
+            raw_container_->erase(id);
+            ++num_removals;
+          }
         }
       }
     }
 
     VLOG(4) << "Flush: Insertions: " << num_insertions
-            << " updates: " << num_updates << " removals: " << num_removals;
-
-    if (FLAGS_cache_blame_dirty) {
-      std::cout << "This cache has been made dirty from "
-                << unique_dirty_backtraces_.size()
-                << " locations:" << std::endl;
-      for (const BacktraceMap::value_type& trace : unique_dirty_backtraces_) {
-        std::cout << std::endl << trace.second << " times from:" << std::endl;
-        std::cout << trace.first << std::endl;
+            << " updates: " << num_updates << " removals: " << num_removals
+            << " unchanged: " << num_unchanged;
+
+    if (FLAGS_cache_blame_dirty || FLAGS_cache_blame_insert) {
+      std::lock_guard<std::mutex> backtrace_lock(m_backtraces_);
+      if (FLAGS_cache_blame_dirty) {
+        std::cout << "This cache has been made dirty from "
+                  << unique_dirty_backtraces_.size()
+                  << " locations:" << std::endl;
+        for (const BacktraceMap::value_type& trace :
+             unique_dirty_backtraces_) {
+          std::cout << std::endl << trace.second << " times from:"
+                    << std::endl;
+          std::cout << trace.first << std::endl;
+        }
+        // Reset the counters to better understand what is happening when with
+        // multiple flushes.
+        unique_dirty_backtraces_.clear();
       }
-      // Reset the counters to better understand what is happening when with
-      // multiple flushes.
-      unique_dirty_backtraces_.clear();
-    }
-    if (FLAGS_cache_blame_insert) {
-      std::cout << "This cache has been inserted to from "
-                << unique_insert_backtraces_.size()
-                << " locations:" << std::endl;
-      for (const BacktraceMap::value_type& trace : unique_insert_backtraces_) {
-        std::cout << std::endl << trace.second << " times from:" << std::endl;
-        std::cout << trace.first << std::endl;
+      if (FLAGS_cache_blame_insert) {
+        std::cout << "This cache has been inserted to from "
+                  << unique_insert_backtraces_.size()
+                  << " locations:" << std::endl;
+        for (const BacktraceMap::value_type& trace :
+             unique_insert_backtraces_) {
+          std::cout << std::endl << trace.second << " times from:"
+                    << std::endl;
+          std::cout << trace.first << std::endl;
+        }
+        unique_insert_backtraces_.clear();
       }
-      unique_insert_backtraces_.clear();
     }
 
     // Refresh cache state: Nothing is dirty any more, removed items are
-    // removed.
-    for (typename Cache::iterator it = cache_.begin(); it != cache_.end();) {
-      if (it->second->to_remove) {
-        it = cache_.erase(it);
-      } else {
-        ++it;
+    // removed. Items that have been pinned by changes can be evicted again.
+    for (Shard& shard : shards_) {
+      for (const IdType& id : shard.changed_ids) {
+        typename Cache::iterator found = shard.cache.find(id);
+        if (found == shard.cache.end()) {
+          continue;
+        }
+        if (found->second->to_remove) {
+          eraseLocked(found, &shard);
+        } else {
+          found->second->dirty = false;
+          updateSizeLocked(found->second.get(), &shard);
+        }
       }
+      shard.changed_ids.clear();
+      evictLocked(nullptr, &shard);
     }
-    for (typename Cache::value_type& cache_pair : cache_) {
-      cache_pair.second->dirty = false;
+  }
+
+  // Runs function(i) for all i in [0, num_tasks), possibly in parallel, and
+  // returns once all calls have returned.
+  typedef std::function<void(size_t num_tasks,
+                             const std::function<void(size_t)>& function)>
+      ParallelFor;
+
+  // Loads the given available ids into the cache ahead of access. The raw
+  // items are fetched serially, but converted to the cached type using
+  // "parallel_for". Ids that are cached already are skipped.
+  void prefetch(const std::vector<IdType>& ids,
+                const ParallelFor& parallel_for) {
+    CHECK(parallel_for);
+    struct Prefetched {
+      const IdType* id;
+      std::unique_ptr<RawType> raw;
+      std::shared_ptr<CacheStruct> cached;
+    };
+    std::vector<Prefetched> prefetched;
+    {
+      IdSet requested;
+      for (const IdType& id : ids) {
+        if (!requested.emplace(id).second) {
+          continue;
+        }
+        const Shard& shard = shardOf(id);
+        std::lock_guard<std::mutex> lock(shard.m_cache);
+        if (shard.cache.count(id) == 0u) {
+          prefetched.push_back({&id, nullptr, nullptr});
+        }
+      }
     }
+    if (prefetched.empty()) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> raw_lock(m_raw_);
+      for (Prefetched& item : prefetched) {
+        item.raw.reset(new RawType(raw_container_->get(*item.id)));
+      }
+    }
+
+    parallel_for(prefetched.size(), [this, &prefetched](size_t i) {
+      Prefetched& item = prefetched[i];
+      item.cached.reset(new CacheStruct);
+      rawToCacheImpl(*item.raw, &item.cached->value);
+      item.cached->dirty = false;
+      item.cached->to_remove = false;
+      item.cached->in_raw = true;
+    });
+
+    // Items that have been loaded by concurrent accesses in the meantime are
+    // left untouched.
+    for (Prefetched& item : prefetched) {
+      Shard& shard = shardOf(*item.id);
+      std::lock_guard<std::mutex> lock(shard.m_cache);
+      if (shard.cache.count(*item.id) == 0u) {
+        addLocked(*item.id, std::move(item.cached), &shard);
+        evictLocked(nullptr, &shard);
+      }
+    }
+  }
+
+  void prefetchAll(const ParallelFor& parallel_for) {
+    std::vector<IdType> ids;
+    getAllAvailableIds(&ids);
+    prefetch(ids, parallel_for);
   }
 
-  void discardCached(IdType id) { CHECK_EQ(cache_.erase(id), 1u); }
+  // Dropping an item that is not cached is only allowed if eviction is on.
+  void discardCached(IdType id) {
+    Shard& shard = shardOf(id);
+    std::lock_guard<std::mutex> lock(shard.m_cache);
+    typename Cache::iterator found = shard.cache.find(id);
+    if (found == shard.cache.end()) {
+      CHECK(size_of_) << "Item to discard is not cached!";
+      return;
+    }
+    eraseLocked(found, &shard);
+    shard.changed_ids.erase(id);
+  }
 
   // If new ids are supposed to be available in the raw container.
   void refreshAvailableIds() {
-    std::lock_guard<std::mutex> id_lock(m_available_ids_);
-    available_ids_.clear();
+    std::vector<std::unique_lock<std::mutex>> locks;
+    lockAllAvailableIds(&locks);
     std::vector<IdType> raw_ids;
-    raw_container_->getAllAvailableIds(&raw_ids);
-    available_ids_.reserve(raw_ids.size());
-    available_ids_.insert(raw_ids.begin(), raw_ids.end());
+    {
+      std::lock_guard<std::mutex> raw_lock(m_raw_);
+      raw_container_->getAllAvailableIds(&raw_ids);
+    }
+    for (Shard& shard : shards_) {
+      shard.available_ids.clear();
+      shard.available_ids.reserve(raw_ids.size() / kNumShards);
+    }
+    for (const IdType& id : raw_ids) {
+      shardOf(id).available_ids.emplace(id);
+    }
   }
 
   // Add a function to determine whether updates should be applied back to the
@@ -247,57 +415,227 @@ class ThreadsafeCache : public MappedContainerBase<IdType, CachedType> {
     update_filter_ = update_filter;
   }
 
+  // Evicts the least recently used clean entries, approximated with the CLOCK
+  // algorithm, once the entries occupy more than "max_bytes" as measured by
+  // "size_of". Entries that have been inserted, made dirty or erased are
+  // pinned until the next flush. Reads don't pin entries, see get() for how
+  // long its references remain valid; values obtained from getShared() remain
+  // valid beyond the eviction of their entries. The budget is split evenly
+  // among the shards. Must be set before the cache is accessed concurrently.
+  void setMemoryBudget(
+      size_t max_bytes,
+      const std::function<size_t(const CachedType& cached)>& size_of) {
+    CHECK(size_of);
+    CHECK(!size_of_) << "Tried to overwrite memory budget!";
+    size_of_ = size_of;
+    max_bytes_per_shard_ = max_bytes / kNumShards;
+    for (Shard& shard : shards_) {
+      std::lock_guard<std::mutex> lock(shard.m_cache);
+      for (typename Cache::value_type& id_cached : shard.cache) {
+        CacheStruct* cached = id_cached.second.get();
+        cached->clock_position =
+            shard.clock_ring.insert(shard.clock_ring.end(), id_cached.first);
+        updateSizeLocked(cached, &shard);
+      }
+      evictLocked(nullptr, &shard);
+    }
+  }
+
+  size_t numCachedBytes() const {
+    size_t result = 0u;
+    for (const Shard& shard : shards_) {
+      std::lock_guard<std::mutex> lock(shard.m_cache);
+      result += shard.num_bytes;
+    }
+    return result;
+  }
+
+  size_t numCachedItems() const {
+    size_t result = 0u;
+    for (const Shard& shard : shards_) {
+      std::lock_guard<std::mutex> lock(shard.m_cache);
+      result += shard.cache.size();
+    }
+    return result;
+  }
+
  private:
+  // Order in which the CLOCK hand visits the cached ids.
+  typedef std::list<IdType> ClockRing;
+
   struct CacheStruct {
     CachedType value;
     bool dirty;
     bool to_remove;
+    // Whether the item exists in the raw container, i.e. has been loaded from
+    // it or has been inserted into it by a flush.
+    bool in_raw;
+    // Bookkeeping for eviction, only maintained once a budget is set.
+    bool referenced = true;
+    size_t num_bytes = 0u;
+    typename ClockRing::iterator clock_position;
   };
 
   // Storing items through pointers ensures that they can be passed as reference
-  // even if the map is volatile.
-  typedef std::unordered_map<IdType, std::unique_ptr<CacheStruct>> Cache;
+  // even if the map is volatile, and shared beyond their eviction.
+  typedef std::unordered_map<IdType, std::shared_ptr<CacheStruct>> Cache;
   typedef MappedContainerBase<IdType, RawType>* RawContainerPtr;
   typedef std::unordered_set<IdType> IdSet;
 
-  CacheStruct* getImplLocked(const IdType& id) const {
-    typename Cache::iterator found = cache_.find(id);
-    if (found == cache_.end()) {
-      // Not bothering with const_ref_type hacks right now.
-      const RawType& raw = raw_container_->get(id);
-      cache_[id].reset(new CacheStruct);
-      CacheStruct* result = cache_[id].get();
+  struct Shard {
+    mutable Cache cache;
+    IdSet available_ids;
+    // Ids of the cache entries that have been inserted, made dirty or marked
+    // for removal since the last flush. Guarded by m_cache.
+    IdSet changed_ids;
+    mutable ClockRing clock_ring;
+    mutable typename ClockRing::iterator clock_hand = clock_ring.end();
+    mutable size_t num_bytes = 0u;
+
+    // Lock ordering: The available ids locks of all shards, in shard order,
+    // precede the cache locks of all shards, in shard order, which precede
+    // m_raw_.
+    mutable std::mutex m_available_ids;
+    mutable std::mutex m_cache;
+  };
+
+  Shard& shardOf(const IdType& id) {
+    return shards_[std::hash<IdType>()(id) % kNumShards];
+  }
+  const Shard& shardOf(const IdType& id) const {
+    return shards_[std::hash<IdType>()(id) % kNumShards];
+  }
+
+  void lockAllAvailableIds(std::vector<std::unique_lock<std::mutex>>* locks)
+      const {
+    CHECK_NOTNULL(locks)->reserve(kNumShards);
+    for (const Shard& shard : shards_) {
+      locks->emplace_back(shard.m_available_ids);
+    }
+  }
+
+  // Requires the cache lock of the shard of "id".
+  std::shared_ptr<CacheStruct> getImplLocked(const IdType& id,
+                                            const Shard* shard) const {
+    typename Cache::iterator found = shard->cache.find(id);
+    if (found == shard->cache.end()) {
+      std::shared_ptr<CacheStruct> result(new CacheStruct);
+      std::unique_lock<std::mutex> raw_lock(m_raw_);
+      const typename MappedContainerBase<IdType, RawType>::ConstRefReturnType
+          raw = raw_container_->get(id);
+      raw_lock.unlock();
+      // The raw item can't change while the shard is locked, as it is only
+      // modified by flush(), so it can be converted without blocking the raw
+      // container for other shards.
       rawToCacheImpl(raw, &result->value);
       result->dirty = false;
       result->to_remove = false;
+      result->in_raw = true;
+      addLocked(id, result, shard);
+      evictLocked(result.get(), shard);
       return result;
     }
     CHECK(found->second);
     CHECK(!found->second->to_remove);
-    return found->second.get();
+    found->second->referenced = true;
+    return found->second;
+  }
+
+  // The following require the cache lock of "shard". They take const shards
+  // since entries are loaded lazily from const functions.
+  CacheStruct* addLocked(const IdType& id,
+                         const std::shared_ptr<CacheStruct>& cached,
+                         const Shard* shard) const {
+    CHECK(cached);
+    if (size_of_) {
+      // Added before the hand, so it is visited last.
+      cached->clock_position = shard->clock_ring.insert(shard->clock_hand, id);
+      cached->referenced = true;
+      updateSizeLocked(cached.get(), shard);
+    }
+    CHECK(shard->cache.emplace(id, cached).second);
+    return cached.get();
+  }
+
+  void eraseLocked(typename Cache::iterator found, const Shard* shard) const {
+    CacheStruct& cached = *found->second;
+    if (size_of_) {
+      if (shard->clock_hand == cached.clock_position) {
+        ++shard->clock_hand;
+      }
+      shard->clock_ring.erase(cached.clock_position);
+      shard->num_bytes -= cached.num_bytes;
+    }
+    shard->cache.erase(found);
   }
 
-  mutable Cache cache_;
+  void updateSizeLocked(CacheStruct* cached, const Shard* shard) const {
+    if (!size_of_) {
+      return;
+    }
+    shard->num_bytes -= cached->num_bytes;
+    cached->num_bytes = size_of_(cached->value);
+    shard->num_bytes += cached->num_bytes;
+  }
+
+  // Evicts clean entries other than "keep" until the shard is within budget.
+  // Referenced entries get a second chance, so at most two rounds are needed.
+  void evictLocked(const CacheStruct* keep, const Shard* shard) const {
+    if (!size_of_) {
+      return;
+    }
+    for (size_t visits = 2u * shard->clock_ring.size();
+         shard->num_bytes > max_bytes_per_shard_ && visits > 0u; --visits) {
+      if (shard->clock_hand == shard->clock_ring.end()) {
+        shard->clock_hand = shard->clock_ring.begin();
+      }
+      const IdType& id = *shard->clock_hand;
+      typename Cache::iterator found = shard->cache.find(id);
+      CHECK(found != shard->cache.end());
+      CacheStruct& cached = *found->second;
+      if (&cached == keep || cached.dirty || cached.to_remove ||
+          shard->changed_ids.count(id) != 0u) {
+        ++shard->clock_hand;
+      } else if (cached.referenced) {
+        cached.referenced = false;
+        ++shard->clock_hand;
+      } else {
+        eraseLocked(found, shard);
+      }
+    }
+  }
+
+  std::array<Shard, kNumShards> shards_;
   RawContainerPtr const raw_container_;
-  IdSet available_ids_;
+  mutable std::mutex m_raw_;
 
   typedef std::unordered_map<std::string, size_t> BacktraceMap;
   BacktraceMap unique_dirty_backtraces_;
   BacktraceMap unique_insert_backtraces_;
-
-  // Lock ordering in order of declaration:
-  mutable std::mutex m_available_ids_;
-  // Reader-writer lock could be considered for cache_and_raw_.
-  mutable std::mutex m_cache_and_raw_;
+  std::mutex m_backtraces_;
 
   virtual void rawToCacheImpl(const RawType& raw, CachedType* cached) const = 0;
   virtual void cacheToRawImpl(const CachedType& cached, RawType* raw) const = 0;
+  // Called on flush for dirty items that exist in the raw container, with
+  // "raw" converted from "cached". Returning false skips the update, so
+  // derived classes can detect items that are dirty but unchanged since they
+  // were loaded or last flushed, and update "cached" to that end.
+  virtual bool hasChangedImpl(const RawType& /*raw*/,
+                              CachedType* /*cached*/) const {
+    return true;
+  }
 
   std::function<
       bool(const RawType& original, const RawType& innovation)>  // NOLINT
       update_filter_;
+
+  std::function<size_t(const CachedType& cached)> size_of_;  // NOLINT
+  size_t max_bytes_per_shard_ = 0u;
 };
 
+template <typename IdType, typename RawType, typename CachedType>
+constexpr size_t ThreadsafeCache<IdType, RawType, CachedType>::kNumShards;
+
 }  // namespace map_api_common
 
 #endif  // MAP_API_COMMON_THREADSAFE_CACHE_H_
@@ -27,6 +27,7 @@
 #include <mutex>
 #include <set>
 #include <stddef.h>
+#include <thread>
 #include <unordered_set>
 #include <vector>
 
@@ -42,12 +43,14 @@ class TableDescriptor;
 
 namespace internal {
 class ChunkView;
+class CommitFuture;
 class DeltaView;
 }  // namespace internal
 
 class ChunkBase {
   friend class ChunkTransaction;
   friend class internal::ChunkView;
+  friend class internal::CommitFuture;
   friend class internal::DeltaView;
   friend class NetTable;
 
@@ -83,8 +86,38 @@ class ChunkBase {
 
   virtual bool isWriteLocked() const = 0;
 
+  // Makes the calling thread the holder of the write lock that this peer holds
+  // on the chunk, e.g. to let worker threads finish a commit. The previous
+  // holder may not use the lock concurrently. Returns the previous holder.
+  virtual std::thread::id adoptWriteLock() = 0;
+  // Counterpart to adoptWriteLock(): The calling thread, which must hold the
+  // write lock, passes it on to the given thread.
+  virtual void handOverWriteLock(const std::thread::id& thread) = 0;
+
+  // Lends the write lock to the calling thread for the lifetime of the guard,
+  // and hands it back to the previous holder unless it has been released in
+  // the meantime. Worker threads must not keep holding a write lock after
+  // their task, as they would pass the recursive locking shortcut in tasks
+  // that are unrelated to the lock.
+  class ScopedWriteLockAdoption {
+   public:
+    explicit ScopedWriteLockAdoption(ChunkBase* chunk);
+    ~ScopedWriteLockAdoption();
+
+   private:
+    ChunkBase* const chunk_;
+    const std::thread::id previous_holder_;
+  };
+
   virtual void unlock() const = 0;
 
+  // Is called with the ids of the items that are added to or patched into the
+  // local replica of the chunk, once per operation, see
+  // LegacyChunkDataContainerBase.
+  typedef std::function<void(const std::vector<map_api_common::Id>& item_ids)>
+      ItemListener;
+  virtual void setItemListener(const ItemListener& listener) = 0;
+
   class ConstDataAccess {
    public:
     explicit ConstDataAccess(const ChunkBase& chunk);
@@ -118,6 +151,10 @@ class ChunkBase {
 
   virtual LogicalTime getLatestCommitTime() const = 0;
 
+  // Drops revisions that are no longer visible at or after the watermark.
+  // Returns the amount of dropped revisions.
+  virtual size_t compactHistory(const LogicalTime& watermark) = 0;
+
  protected:
   // The following three MUST be called in the right places in order for
   // triggers to work:
@@ -129,7 +166,8 @@ class ChunkBase {
   void handleCommitEnd();
 
   map_api_common::Id id_;
-  std::unique_ptr<ChunkDataContainerBase> data_container_;
+  // Shared with commit futures, which may outlive the chunk.
+  std::shared_ptr<ChunkDataContainerBase> data_container_;
 
  private:
   // Insert and update for transactions.
@@ -33,7 +33,7 @@ namespace map_api {
 template <typename IdType>
 std::shared_ptr<const Revision> ChunkDataContainerBase::getById(
     const IdType& id, const LogicalTime& time) const {
-  std::lock_guard<std::mutex> lock(access_mutex_);
+  map_api_common::ScopedReadLock lock(&access_mutex_);
   CHECK(isInitialized()) << "Attempted to getById from non-initialized table";
   CHECK(id.isValid()) << "Supplied invalid ID";
   map_api_common::Id map_api_id;
@@ -82,7 +82,7 @@ std::shared_ptr<const Revision> ChunkDataContainerBase::findUnique(
 template <typename IdType>
 void ChunkDataContainerBase::getAvailableIds(const LogicalTime& time,
                                              std::vector<IdType>* ids) const {
-  std::lock_guard<std::mutex> lock(access_mutex_);
+  map_api_common::ScopedReadLock lock(&access_mutex_);
   CHECK(isInitialized()) << "Attempted to getById from non-initialized table";
   CHECK_NOTNULL(ids);
   ids->clear();
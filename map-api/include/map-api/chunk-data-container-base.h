@@ -22,6 +22,7 @@
 #ifndef MAP_API_CHUNK_DATA_CONTAINER_BASE_H_
 #define MAP_API_CHUNK_DATA_CONTAINER_BASE_H_
 
+#include <functional>
 #include <list>
 #include <memory>
 #include <string>
@@ -30,6 +31,7 @@
 #include <vector>
 
 #include <gflags/gflags.h>
+#include <map-api-common/reader-writer-lock.h>
 
 #include "map-api/table-descriptor.h"
 #include "./core.pb.h"
@@ -66,6 +68,11 @@ class ChunkDataContainerBase {
   template <typename IdType>
   std::shared_ptr<const Revision> getById(const IdType& id,
                                           const LogicalTime& time) const;
+  // Like getById() for many ids, locking the container only once. "results"
+  // are in the order of "ids".
+  void getByIds(const std::vector<map_api_common::Id>& ids,
+                const LogicalTime& time,
+                std::vector<std::shared_ptr<const Revision>>* results) const;
   // If "key" is -1, no filter will be applied
   template <typename ValueType>
   void find(int key, const ValueType& value, const LogicalTime& time,
@@ -76,6 +83,16 @@ class ChunkDataContainerBase {
                                              const LogicalTime& time) const;
   void findByRevision(int key, const Revision& valueHolder,
                       const LogicalTime& time, ConstRevisionMap* dest) const;
+  /**
+   * Calls "action" for each item that is present at "time", without
+   * collecting the items in a map first. Items are read in bounded batches,
+   * and the container is unlocked while "action" runs, so "action" may access
+   * it.
+   */
+  typedef std::function<void(const map_api_common::Id& id,
+                             const std::shared_ptr<const Revision>& item)>
+      ItemAction;
+  void forEachItem(const LogicalTime& time, const ItemAction& action) const;
 
   // ====
   // MISC
@@ -97,7 +114,9 @@ class ChunkDataContainerBase {
   };
 
  protected:
-  mutable std::mutex access_mutex_;
+  // Reads share the lock and may run concurrently; the *Impl() read functions
+  // must therefore not modify the container.
+  mutable map_api_common::ReaderWriterMutex access_mutex_;
   std::shared_ptr<TableDescriptor> descriptor_;
 
  private:
@@ -59,6 +59,8 @@ class ChunkTransaction {
   friend class NetTableFixture;
   FRIEND_TEST(ChunkTest, ChunkTransactions);
   FRIEND_TEST(ChunkTest, ChunkTransactionsConflictConditions);
+  FRIEND_TEST(ChunkTest, ChunkTransactionsVisibleConflicts);
+  FRIEND_TEST(ChunkTest, ChunkTransactionLookupsPerGet);
 
  private:
   ChunkTransaction(ChunkBase* chunk, NetTable* table);
@@ -71,10 +73,16 @@ class ChunkTransaction {
   // ====
   template <typename IdType>
   std::shared_ptr<const Revision> getById(const IdType& id) const;
+  // Batched getById(), see ViewBase::getMany().
+  void getByIds(const std::vector<map_api_common::Id>& ids,
+                std::vector<std::shared_ptr<const Revision>>* results) const;
   template <typename ValueType>
   std::shared_ptr<const Revision> findUnique(int key,
                                              const ValueType& value) const;
   void dumpChunk(ConstRevisionMap* result) const;
+  // Streaming alternative to dumpChunk(), see ViewBase::forEach().
+  typedef internal::ViewBase::ItemAction ItemAction;
+  void forEachItem(const ItemAction& action) const;
   template <typename IdType>
   void getAvailableIds(std::unordered_set<IdType>* ids) const;
 
@@ -97,6 +105,12 @@ class ChunkTransaction {
   // ======================
   bool commit();
   bool hasNoConflicts();
+  // Check against the local replica of the chunk that only takes the chunk's
+  // distributed read lock, for the latest commit time and for reading the
+  // changed items. It thus doesn't wait for, or block, other readers. A false
+  // result means that the commit is bound to fail, while true still needs to
+  // be confirmed by hasNoConflicts() under the write lock.
+  bool hasNoVisibleConflicts() const;
   void checkedCommit(const LogicalTime& time);
   /**
    * Merging and changeCount are not compatible with conflict conditions.
@@ -36,10 +36,13 @@ class CombinedView : public ViewBase {
   // ==================
   // VIEWBASE INTERFACE
   // ==================
-  virtual bool has(const map_api_common::Id& id) const override;
-  virtual std::shared_ptr<const Revision> get(const map_api_common::Id& id) const
-      override;
+  virtual bool tryGet(const map_api_common::Id& id,
+                      std::shared_ptr<const Revision>* result) const override;
+  virtual void getMany(
+      const std::vector<map_api_common::Id>& ids,
+      std::vector<std::shared_ptr<const Revision>>* results) const override;
   virtual void dump(ConstRevisionMap* result) const override;
+  virtual void forEach(const ItemAction& action) const override;
   virtual void getAvailableIds(std::unordered_set<map_api_common::Id>* result) const
       override;
   virtual void discardKnownUpdates(UpdateTimes* update_times) const override;
@@ -22,16 +22,23 @@
 #ifndef INTERNAL_COMMIT_FUTURE_H_
 #define INTERNAL_COMMIT_FUTURE_H_
 
+#include <memory>
+
 #include "map-api/internal/overriding-view-base.h"
+#include "map-api/logical-time.h"
 #include "map-api/revision-map.h"
 
 namespace map_api {
+class ChunkDataContainerBase;
 class ChunkTransaction;
 
 namespace internal {
+class DeltaView;
 
 // Can replace a ChunkView in a transaction to signify that that transaction
-// depends on another transaction that is committing in parallel.
+// depends on another transaction that is committing in parallel. Consists of
+// the chunk as it was before the commit and the changes of the committing
+// transaction, so creating and copying it is independent of the chunk size.
 class CommitFuture : public ViewBase {
  public:
   explicit CommitFuture(
@@ -42,16 +49,26 @@ class CommitFuture : public ViewBase {
   // ==================
   // VIEWBASE INTERFACE
   // ==================
-  virtual bool has(const map_api_common::Id& id) const override;
-  virtual std::shared_ptr<const Revision> get(const map_api_common::Id& id) const
-      override;
+  virtual bool tryGet(const map_api_common::Id& id,
+                      std::shared_ptr<const Revision>* result) const override;
   virtual void dump(ConstRevisionMap* result) const override;
+  virtual void forEach(const ItemAction& action) const override;
   virtual void getAvailableIds(std::unordered_set<map_api_common::Id>* result) const
       override;
   virtual void discardKnownUpdates(UpdateTimes* update_times) const override;
 
  private:
-  ConstRevisionMap chunk_state_;
+  // The chunk is read without its lock, which is held by the committing
+  // transaction. This is safe, since nothing is committed to the chunk between
+  // view_time_ and the commit, which only affects items overridden by delta_.
+  // The data container is shared, so that the future stays readable if the
+  // chunk is left in the meantime.
+  const std::shared_ptr<const ChunkDataContainerBase> chunk_data_;
+  // Registered as an active begin time for the lifetime of the future, so
+  // that history compaction keeps the revisions visible at view_time_.
+  LogicalTime view_time_;
+  // Shared among copies, the finalized delta doesn't change any more.
+  const std::shared_ptr<const DeltaView> delta_;
 };
 
 }  // namespace internal
@@ -42,10 +42,8 @@ class CommitHistoryView : public OverridingViewBase {
   // ==================
   // VIEWBASE INTERFACE
   // ==================
-  virtual bool has(const map_api_common::Id& id) const override;
-  virtual std::shared_ptr<const Revision> get(const map_api_common::Id& id) const
-      override;
   virtual void dump(ConstRevisionMap* result) const override;
+  virtual void forEach(const ItemAction& action) const override;
   virtual void getAvailableIds(std::unordered_set<map_api_common::Id>* result) const
       override;
   virtual void discardKnownUpdates(UpdateTimes* update_times) const override;
@@ -53,7 +51,11 @@ class CommitHistoryView : public OverridingViewBase {
   // ============================
   // OVERRIDINGVIEWBASE INTERFACE
   // ============================
-  virtual bool suppresses(const map_api_common::Id& id) const override;
+  virtual bool tryGetOverride(const map_api_common::Id& id,
+                              std::shared_ptr<const Revision>* result) const
+      override;
+  virtual void getSuppressedIds(
+      std::unordered_set<map_api_common::Id>* result) const override;
 
  private:
   const std::unordered_map<map_api_common::Id, LogicalTime>& commit_history_;
@@ -22,6 +22,9 @@
 #ifndef INTERNAL_DELTA_VIEW_H_
 #define INTERNAL_DELTA_VIEW_H_
 
+#include <unordered_map>
+#include <vector>
+
 #include "map-api/internal/overriding-view-base.h"
 #include "map-api/revision-map.h"
 
@@ -40,10 +43,8 @@ class DeltaView : public OverridingViewBase {
   // ==================
   // VIEWBASE INTERFACE
   // ==================
-  virtual bool has(const map_api_common::Id& id) const override;
-  virtual std::shared_ptr<const Revision> get(const map_api_common::Id& id) const
-      override;
   virtual void dump(ConstRevisionMap* result) const override;
+  virtual void forEach(const ItemAction& action) const override;
   virtual void getAvailableIds(std::unordered_set<map_api_common::Id>* result) const
       override;
   virtual void discardKnownUpdates(UpdateTimes* update_times) const override;
@@ -51,7 +52,11 @@ class DeltaView : public OverridingViewBase {
   // ============================
   // OVERRIDINGVIEWBASE INTERFACE
   // ============================
-  virtual bool suppresses(const map_api_common::Id& id) const override;
+  virtual bool tryGetOverride(const map_api_common::Id& id,
+                              std::shared_ptr<const Revision>* result) const
+      override;
+  virtual void getSuppressedIds(
+      std::unordered_set<map_api_common::Id>* result) const override;
 
   void insert(std::shared_ptr<Revision> revision);
   void update(std::shared_ptr<Revision> revision);
@@ -65,6 +70,12 @@ class DeltaView : public OverridingViewBase {
   bool hasConflictsAfterTryingToMerge(
       const std::unordered_map<map_api_common::Id, LogicalTime>& potential_conflicts,
       const ViewBase& original_view, const ViewBase& conflict_view);
+  // Like the above, but leaves the delta untouched: auto-merging is only tried
+  // on copies of the updated revisions.
+  bool hasUnmergeableConflicts(
+      const std::unordered_map<map_api_common::Id, LogicalTime>& potential_conflicts,
+      const ViewBase& original_view, const ViewBase& conflict_view) const;
+  void getChangedIds(std::vector<map_api_common::Id>* result) const;
 
   // Asserts that the chunk is locked.
   void checkedCommitLocked(
@@ -102,9 +113,13 @@ class DeltaView : public OverridingViewBase {
       const ViewBase& original_view, const ViewBase& conflict_view,
       DeltaView* conflict_free_part, Conflicts* conflicts);
 
-  bool tryAutoMerge(const ViewBase& original_view,
-                    const ViewBase& conflict_view,
-                    UpdateMap::value_type* item) const;
+  // Auto-merges the given items. The revisions to merge with are read on the
+  // calling thread, then the merge policies, which only depend on the item at
+  // hand, run in parallel on the worker pool. Returns false as soon as an
+  // item can't be merged; items that haven't been tried yet are skipped.
+  bool tryAutoMergeAll(const ViewBase& original_view,
+                       const ViewBase& conflict_view,
+                       const std::vector<UpdateMap::value_type*>& items) const;
 
   // What the delta consists of. This class guarantees that ids are unique
   // across all maps, e.g. an inserted id will never also be removed.
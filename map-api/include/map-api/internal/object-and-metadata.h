@@ -30,28 +30,66 @@ namespace map_api {
 // Splits a revision into object and metadata. Note that the revision stored
 // in this object contains no custom field values, as these would be redundant
 // with the Object; it only contains the metadata.
+// The object may be shared with other caches, see SharedObjectCache, and is
+// copied on the first mutable access.
 template <typename ObjectType>
 struct ObjectAndMetadata {
-  ObjectType object;
+  std::shared_ptr<const ObjectType> object;
+  // False while the object may be shared.
+  bool owns_object = false;
   std::shared_ptr<Revision> metadata;
+  // Revision::customFieldsHash() and Revision::customFieldsByteSize() of the
+  // revision the object was deserialized from, allow to detect whether the
+  // object has changed since.
+  size_t content_hash = 0u;
+  size_t content_size = 0u;
 
-  void deserialize(const Revision& source) {
-    objectFromRevision(source, &object);
-    source.copyForWrite(&metadata);
+  // Copies are allocated on arena, if given.
+  void deserialize(const Revision& source,
+                   const Revision::ArenaPtr& arena = Revision::ArenaPtr()) {
+    deserializeObject(source);
+    deserializeMetadata(source, arena);
+  }
+
+  void deserializeObject(const Revision& source) {
+    std::shared_ptr<ObjectType> new_object(new ObjectType);
+    objectFromRevision(source, new_object.get());
+    object = new_object;
+    owns_object = true;
+  }
+
+  void deserializeMetadata(const Revision& source,
+                           const Revision::ArenaPtr& arena) {
+    source.copyForWrite(arena, &metadata);
     metadata->clearCustomFieldValues();
+    content_hash = source.customFieldsHash();
+    content_size = source.customFieldsByteSize();
+  }
+
+  ObjectType& mutableObject() {
+    CHECK(object);
+    if (!owns_object) {
+      object.reset(new ObjectType(*object));
+      owns_object = true;
+    }
+    // Owned objects are always allocated as non-const.
+    return *std::const_pointer_cast<ObjectType>(object);
   }
 
-  void serialize(std::shared_ptr<const Revision>* destination) const {
+  void serialize(std::shared_ptr<const Revision>* destination,
+                 const Revision::ArenaPtr& arena = Revision::ArenaPtr()) const {
     CHECK_NOTNULL(destination);
+    CHECK(object);
     std::shared_ptr<Revision> result;
-    metadata->copyForWrite(&result);
-    objectToRevision(object, result.get());
+    metadata->copyForWrite(arena, &result);
+    objectToRevision(*object, result.get());
     *destination = result;
   }
 
   void createForInsert(const ObjectType& _object, NetTable* table) {
     CHECK_NOTNULL(table);
-    object = _object;
+    object.reset(new ObjectType(_object));
+    owns_object = true;
     metadata = table->getTemplate();
   }
 };
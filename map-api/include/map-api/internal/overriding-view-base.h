@@ -31,9 +31,22 @@ class OverridingViewBase : public ViewBase {
  public:
   virtual ~OverridingViewBase();
 
+  // Returns true if the view decides about the given id, i.e. if it either
+  // contains the item, which is then returned in "result", or suppresses it,
+  // in which case "result" is reset. Returns false if the overridden view
+  // should be consulted.
+  virtual bool tryGetOverride(const map_api_common::Id& id,
+                              std::shared_ptr<const Revision>* result) const = 0;
+
+  virtual bool tryGet(const map_api_common::Id& id,
+                      std::shared_ptr<const Revision>* result) const final
+      override;
   // Return true if the given id should be marked as inexistent even if the
   // overridden view contains it.
-  virtual bool suppresses(const map_api_common::Id& id) const = 0;
+  bool suppresses(const map_api_common::Id& id) const;
+  // All ids for which suppresses() returns true.
+  virtual void getSuppressedIds(
+      std::unordered_set<map_api_common::Id>* result) const = 0;
 };
 
 }  // namespace internal
@@ -0,0 +1,160 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef INTERNAL_SHARED_OBJECT_CACHE_H_
+#define INTERNAL_SHARED_OBJECT_CACHE_H_
+
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "map-api/logical-time.h"
+
+DECLARE_uint64(map_api_shared_object_cache_size);
+
+namespace map_api {
+namespace internal {
+
+// A process-wide cache of deserialized objects, shared by the object caches of
+// successive transactions. Objects are immutable once shared; a version is
+// identified by its table, id and modification time, and is only handed out
+// if the content hash of the requesting revision matches, so that uncommitted
+// changes, which keep the modification time of their original, can't be
+// confused with it. Only the latest known version of each item is kept, and
+// the least recently used items are evicted beyond
+// FLAGS_map_api_shared_object_cache_size items per object type.
+template <typename IdType, typename ObjectType>
+class SharedObjectCache {
+ public:
+  static SharedObjectCache& instance() {
+    static SharedObjectCache instance;
+    return instance;
+  }
+
+  // Returns nullptr if the requested version isn't cached.
+  std::shared_ptr<const ObjectType> get(const std::string& table_name,
+                                        const IdType& id,
+                                        const LogicalTime& modification_time,
+                                        size_t content_hash) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    typename EntryMap::iterator found = entries_.find(Key{table_name, id});
+    if (found == entries_.end() ||
+        found->second.modification_time != modification_time ||
+        found->second.content_hash != content_hash) {
+      return std::shared_ptr<const ObjectType>();
+    }
+    lru_.splice(lru_.begin(), lru_, found->second.lru_position);
+    return found->second.object;
+  }
+
+  // Replaces any older version of the same item. Returns false if the object
+  // isn't shared, e.g. because it is an uncommitted insertion, in which case
+  // the caller may keep modifying it.
+  bool put(const std::string& table_name, const IdType& id,
+           const LogicalTime& modification_time, size_t content_hash,
+           const std::shared_ptr<const ObjectType>& object) {
+    CHECK(object);
+    const size_t capacity = FLAGS_map_api_shared_object_cache_size;
+    if (capacity == 0u || !modification_time.isValid()) {
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    const Key key{table_name, id};
+    typename EntryMap::iterator found = entries_.find(key);
+    if (found == entries_.end()) {
+      lru_.push_front(key);
+      found = entries_.emplace(key, Entry()).first;
+      found->second.lru_position = lru_.begin();
+    } else {
+      // An uncommitted change keeps the modification time of its original,
+      // which is preferred.
+      if (modification_time <= found->second.modification_time) {
+        return false;
+      }
+      lru_.splice(lru_.begin(), lru_, found->second.lru_position);
+    }
+    found->second.modification_time = modification_time;
+    found->second.content_hash = content_hash;
+    found->second.object = object;
+
+    while (entries_.size() > capacity) {
+      entries_.erase(lru_.back());
+      lru_.pop_back();
+    }
+    return true;
+  }
+
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+    lru_.clear();
+  }
+
+ private:
+  SharedObjectCache() = default;
+
+  struct Key {
+    std::string table_name;
+    IdType id;
+
+    bool operator==(const Key& other) const {
+      return id == other.id && table_name == other.table_name;
+    }
+  };
+  struct KeyHash {
+    size_t operator()(const Key& key) const {
+      size_t hash = std::hash<IdType>()(key.id);
+      hash ^= std::hash<std::string>()(key.table_name) + 0x9e3779b9 +
+              (hash << 6) + (hash >> 2);
+      return hash;
+    }
+  };
+  typedef std::list<Key> LruList;
+  struct Entry {
+    LogicalTime modification_time;
+    size_t content_hash;
+    std::shared_ptr<const ObjectType> object;
+    typename LruList::iterator lru_position;
+  };
+  typedef std::unordered_map<Key, Entry, KeyHash> EntryMap;
+
+  mutable std::mutex mutex_;
+  EntryMap entries_;
+  // Most recently used first.
+  LruList lru_;
+};
+
+}  // namespace internal
+}  // namespace map_api
+
+#endif  // INTERNAL_SHARED_OBJECT_CACHE_H_
@@ -28,6 +28,7 @@
 
 #include "map-api/cache-base.h"
 #include "map-api/internal/object-and-metadata.h"
+#include "map-api/internal/shared-object-cache.h"
 #include "map-api/net-table-transaction-interface.h"
 
 namespace map_api {
@@ -43,19 +44,44 @@ class ThreadsafeObjectAndMetadataCache
   virtual ~ThreadsafeObjectAndMetadataCache() {}
 
  private:
+  typedef internal::SharedObjectCache<IdType, ObjectType> SharedObjects;
+
   // Takes ownership of the interface.
-  explicit ThreadsafeObjectAndMetadataCache(
-      NetTableTransactionInterface<IdType>* interface)
-      : BaseType(CHECK_NOTNULL(interface)) {}
+  ThreadsafeObjectAndMetadataCache(
+      NetTableTransactionInterface<IdType>* interface,
+      const std::string& table_name)
+      : BaseType(CHECK_NOTNULL(interface)),
+        interface_(interface),
+        table_name_(table_name),
+        share_objects_(true) {}
   friend class ThreadsafeCache<IdType, ObjectType>;
 
+  // Deserialized objects are no longer published to the shared object cache,
+  // which would keep them alive beyond their eviction from this cache.
+  void disableObjectSharing() { share_objects_ = false; }
+
+  // Objects are taken from, or published to, the shared object cache, so
+  // that successive transactions don't deserialize the same version again.
   virtual void rawToCacheImpl(const std::shared_ptr<const Revision>& raw,
                               ObjectAndMetadata<ObjectType>* cached) const
       final override {
     CHECK(raw);
     CHECK_NOTNULL(cached);
-    cached->deserialize(*raw);
+    cached->deserializeMetadata(*raw, Revision::ArenaPtr());
     CHECK(cached->metadata);
+    const IdType id = raw->getId<IdType>();
+    const LogicalTime modification_time = raw->getModificationTime();
+    cached->object = SharedObjects::instance().get(
+        table_name_, id, modification_time, cached->content_hash);
+    if (cached->object) {
+      cached->owns_object = false;
+      return;
+    }
+    cached->deserializeObject(*raw);
+    cached->owns_object =
+        !share_objects_ || !SharedObjects::instance().put(
+        table_name_, id, modification_time, cached->content_hash,
+        cached->object);
   }
 
   virtual void cacheToRawImpl(const ObjectAndMetadata<ObjectType>& cached,
@@ -65,13 +91,34 @@ class ThreadsafeObjectAndMetadataCache
     cached.serialize(raw);
   }
 
-  virtual bool shouldUpdateImpl(const std::shared_ptr<const Revision>& original,
-                                const std::shared_ptr<const Revision>& updated)
-      const {
-    CHECK(original);
-    CHECK(updated);
-    return !original->areAllCustomFieldsEqual(*updated);
+  // The original revision isn't kept, so the serialized size and the hash of
+  // the custom fields are compared first, which tells most changed objects
+  // apart. Only if both match, the revision is compared field by field to the
+  // one the transaction holds, which is the one the object was loaded from or
+  // last flushed to. Objects that are serialized differently than what they
+  // have been loaded from are considered changed. An unchanged object
+  // therefore still costs its serialization, a hash and a full comparison.
+  virtual bool hasChangedImpl(const std::shared_ptr<const Revision>& raw,
+                              ObjectAndMetadata<ObjectType>* cached) const
+      final override {
+    CHECK(raw);
+    CHECK_NOTNULL(cached);
+    const size_t content_size = raw->customFieldsByteSize();
+    const size_t content_hash = raw->customFieldsHash();
+    if (content_size == cached->content_size &&
+        content_hash == cached->content_hash) {
+      return !interface_->get(raw->getId<IdType>())->areAllCustomFieldsEqual(
+          *raw);
+    }
+    cached->content_size = content_size;
+    cached->content_hash = content_hash;
+    return true;
   }
+
+  // Owned by the base class.
+  NetTableTransactionInterface<IdType>* const interface_;
+  const std::string table_name_;
+  bool share_objects_;
 };
 
 }  // namespace map_api
@@ -22,9 +22,11 @@
 #ifndef INTERNAL_VIEW_BASE_H_
 #define INTERNAL_VIEW_BASE_H_
 
+#include <functional>
 #include <memory>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 namespace map_api_common {
 class Id;
@@ -41,9 +43,27 @@ class ViewBase {
  public:
   virtual ~ViewBase();
 
-  virtual bool has(const map_api_common::Id& id) const = 0;
-  virtual std::shared_ptr<const Revision> get(const map_api_common::Id& id) const = 0;
+  // Looks the item up once, returning whether it exists in the view and, if
+  // so, the item itself. has() and get() are shorthands for this, so views
+  // that are stacked on each other should call tryGet() on each other
+  // rather than has() followed by get().
+  virtual bool tryGet(const map_api_common::Id& id,
+                      std::shared_ptr<const Revision>* result) const = 0;
+  bool has(const map_api_common::Id& id) const;
+  std::shared_ptr<const Revision> get(const map_api_common::Id& id) const;
+  // Like get() for many ids, with "results" in the order of "ids". Views
+  // should override this if they can resolve batches at a lower cost.
+  virtual void getMany(
+      const std::vector<map_api_common::Id>& ids,
+      std::vector<std::shared_ptr<const Revision>>* results) const;
   virtual void dump(ConstRevisionMap* result) const = 0;
+  // Streams all items of the view to "action" without materializing them.
+  // Each id is visited at most once. "action" must not read from the chunk
+  // the view is based on, as the chunk data may be locked during iteration.
+  typedef std::function<void(const map_api_common::Id& id,
+                             const std::shared_ptr<const Revision>& item)>
+      ItemAction;
+  virtual void forEach(const ItemAction& action) const = 0;
   virtual void getAvailableIds(std::unordered_set<map_api_common::Id>* result)
       const = 0;
 
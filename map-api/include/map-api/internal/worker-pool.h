@@ -0,0 +1,71 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef INTERNAL_WORKER_POOL_H_
+#define INTERNAL_WORKER_POOL_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace map_api {
+namespace internal {
+
+// A process-wide pool of worker threads for independent work items, e.g. the
+// per-chunk steps of a commit.
+class WorkerPool {
+ public:
+  ~WorkerPool();
+
+  static WorkerPool& instance();
+
+  // Calls function(i) for all i in [0, num_tasks) and returns once all calls
+  // have returned. The calling thread works on the tasks as well, so nested
+  // calls from within a task can't deadlock.
+  void parallelFor(size_t num_tasks,
+                   const std::function<void(size_t)>& function);  // NOLINT
+
+  size_t numThreads() const { return threads_.size(); }
+
+ private:
+  explicit WorkerPool(size_t num_threads);
+
+  struct Batch;
+  static void work(Batch* batch);
+  void workerThread();
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  // A batch is queued once per worker that should join it.
+  std::deque<std::shared_ptr<Batch> > queue_;
+  bool stop_ = false;
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace internal
+}  // namespace map_api
+
+#endif  // INTERNAL_WORKER_POOL_H_
@@ -22,6 +22,11 @@
 #ifndef MAP_API_LEGACY_CHUNK_DATA_CONTAINER_BASE_INL_H_
 #define MAP_API_LEGACY_CHUNK_DATA_CONTAINER_BASE_INL_H_
 
+#include <iterator>
+#include <vector>
+
+#include <glog/logging.h>
+
 namespace map_api {
 
 LegacyChunkDataContainerBase::History::const_iterator
@@ -63,11 +68,51 @@ void LegacyChunkDataContainerBase::findHistory(int key, const ValueType& value,
 template <typename IdType>
 void LegacyChunkDataContainerBase::remove(const LogicalTime& time,
                                           const IdType& id) {
-  std::shared_ptr<Revision> latest =
-      std::make_shared<Revision>(*getById(id, time));
+  std::shared_ptr<Revision> latest;
+  getById(id, time)->copyForWrite(&latest);
   remove(time, latest);
 }
 
+template <typename HistoryMapType, typename UpdateTimeGetter,
+          typename IsRemovedGetter>
+size_t LegacyChunkDataContainerBase::trimHistories(
+    const LogicalTime& watermark, const UpdateTimeGetter& update_time,
+    const IsRemovedGetter& is_removed, HistoryMapType* histories,
+    std::vector<typename HistoryMapType::mapped_type::value_type>* dropped) {
+  CHECK_NOTNULL(histories);
+  typedef typename HistoryMapType::mapped_type HistoryType;
+  size_t num_dropped = 0u;
+  for (typename HistoryMapType::iterator it = histories->begin();
+       it != histories->end();) {
+    HistoryType& history = it->second;
+    typename HistoryType::iterator valid_at_watermark = history.begin();
+    while (valid_at_watermark != history.end() &&
+           update_time(*valid_at_watermark) > watermark) {
+      ++valid_at_watermark;
+    }
+    if (valid_at_watermark == history.end()) {
+      ++it;
+      continue;
+    }
+    // Items removed at or before the watermark are dropped entirely.
+    const bool drop_item = valid_at_watermark == history.begin() &&
+                           is_removed(*valid_at_watermark);
+    typename HistoryType::iterator first_dropped =
+        drop_item ? history.begin() : std::next(valid_at_watermark);
+    num_dropped += std::distance(first_dropped, history.end());
+    if (dropped != nullptr) {
+      dropped->insert(dropped->end(), first_dropped, history.end());
+    }
+    if (drop_item) {
+      it = histories->erase(it);
+    } else {
+      history.erase(first_dropped, history.end());
+      ++it;
+    }
+  }
+  return num_dropped;
+}
+
 }  // namespace map_api
 
 #endif  // MAP_API_LEGACY_CHUNK_DATA_CONTAINER_BASE_INL_H_
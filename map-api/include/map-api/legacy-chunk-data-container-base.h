@@ -22,6 +22,7 @@
 #ifndef MAP_API_LEGACY_CHUNK_DATA_CONTAINER_BASE_H_
 #define MAP_API_LEGACY_CHUNK_DATA_CONTAINER_BASE_H_
 
+#include <functional>
 #include <list>
 #include <vector>
 
@@ -59,6 +60,14 @@ class LegacyChunkDataContainerBase : public ChunkDataContainerBase {
    * default values are set correctly.
    */
   virtual bool patch(const std::shared_ptr<const Revision>& revision) final;
+  /**
+   * Patches many revisions at once, e.g. the contents of a chunk that is
+   * being joined. The access lock is taken only once, and revisions are
+   * patched in order of ascending update time, so that each one is placed in
+   * front of its history without scanning it. Sorts revisions in place.
+   */
+  virtual bool bulkPatch(std::vector<std::shared_ptr<const Revision> >* revisions)
+      final;
 
   class History : public std::list<std::shared_ptr<const Revision> > {
    public:
@@ -99,7 +108,52 @@ class LegacyChunkDataContainerBase : public ChunkDataContainerBase {
   void remove(const LogicalTime& time, const IdType& id);
   void clear();
 
+  // ==========
+  // COMPACTION
+  // ==========
+  /**
+   * Drops revisions that can no longer be seen by readers at or after the
+   * given watermark: For every item, the revision valid at the watermark and
+   * all newer revisions are kept. Items that have been removed at or before
+   * the watermark are dropped entirely. Returns the amount of dropped
+   * revisions.
+   */
+  size_t compact(const LogicalTime& watermark);
+
+  // ========
+  // LISTENER
+  // ========
+  /**
+   * Is called with the ids of the revisions that are inserted or patched into
+   * the container, once per operation, while the container is locked. Items
+   * can thus be tracked no matter whether they are added by local commits, by
+   * peers or while joining a chunk.
+   */
+  typedef std::function<void(const std::vector<map_api_common::Id>& item_ids)>
+      ItemListener;
+  void setItemListener(const ItemListener& listener);
+
+ protected:
+  /**
+   * Trims histories, which are ordered from newest to oldest, as described for
+   * compact(). update_time and is_removed read the respective property of a
+   * history entry. The dropped entries are appended to dropped unless it is
+   * null. Returns the amount of dropped entries.
+   */
+  template <typename HistoryMapType, typename UpdateTimeGetter,
+            typename IsRemovedGetter>
+  static size_t trimHistories(
+      const LogicalTime& watermark, const UpdateTimeGetter& update_time,
+      const IsRemovedGetter& is_removed, HistoryMapType* histories,
+      std::vector<typename HistoryMapType::mapped_type::value_type>* dropped);
+  // Whether the dead part of an append-only store is large enough for a
+  // rewrite of the store to pay off, see
+  // --map_api_history_compaction_min_dead_fraction.
+  static bool isWorthRewriting(size_t dead_amount, size_t total_amount);
+
  private:
+  ItemListener item_listener_;
+
   // =====================================
   // READ OPERATIONS INHERITED FROM PARENT
   // =====================================
@@ -125,6 +179,9 @@ class LegacyChunkDataContainerBase : public ChunkDataContainerBase {
   // revision map is mutable on the caller side.
   virtual bool bulkInsertImpl(const MutableRevisionMap& query) = 0;
   virtual bool patchImpl(const std::shared_ptr<const Revision>& query) = 0;
+  // Revisions are sorted by ascending update time.
+  virtual bool bulkPatchImpl(
+      const std::vector<std::shared_ptr<const Revision> >& revisions) = 0;
   // If key is -1, this should return all the data in the table.
   virtual void findHistoryByRevisionImpl(int key, const Revision& valueHolder,
                                          const LogicalTime& time,
@@ -135,6 +192,7 @@ class LegacyChunkDataContainerBase : public ChunkDataContainerBase {
                                History* dest) const = 0;
   virtual bool insertUpdatedImpl(const std::shared_ptr<Revision>& query) = 0;
   virtual void clearImpl() = 0;
+  virtual size_t compactImpl(const LogicalTime& watermark) = 0;
 };
 
 }  // namespace map_api
@@ -0,0 +1,168 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MAP_API_LEGACY_CHUNK_DATA_MMAP_CONTAINER_H_
+#define MAP_API_LEGACY_CHUNK_DATA_MMAP_CONTAINER_H_
+
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "map-api/legacy-chunk-data-container-base.h"
+
+namespace map_api {
+
+/**
+ * Keeps all revisions in an append-only segment file which is memory-mapped,
+ * such that reads are served from the page cache and residency is left to the
+ * OS. Only an index of offsets is kept in memory. If the segment file already
+ * exists at initialization, the index is rebuilt from it, which allows a
+ * restarted peer to recover its chunks without fetching them from other peers.
+ * Every mutation is flushed to disk before it returns. Compaction only
+ * rewrites the segment once enough of it is dead; until then, revisions it
+ * dropped reappear when the index is rebuilt.
+ *
+ * Segment layout: kSegmentMagic, followed by records consisting of a uint32_t
+ * payload size and the serialized proto::Revision. The file is grown in
+ * zero-filled increments, so a record size of 0 marks the end of the data.
+ */
+class LegacyChunkDataMmapContainer : public LegacyChunkDataContainerBase {
+ public:
+  explicit LegacyChunkDataMmapContainer(const std::string& segment_file);
+  virtual ~LegacyChunkDataMmapContainer();
+
+  const std::string& segmentFile() const { return segment_file_; }
+  // Latest modification time of all revisions in the segment, including those
+  // restored at initialization.
+  LogicalTime latestModificationTime() const;
+  // Unmaps and deletes the segment file. The container is empty afterwards.
+  void removeSegment();
+
+  // Segment files are named after table and chunk only, so that a peer finds
+  // its segments again when it restarts with a different address. Peers
+  // therefore need a segment directory of their own.
+  static std::string segmentFileName(const std::string& directory,
+                                     const std::string& table_name,
+                                     const map_api_common::Id& chunk_id);
+  // Returns false if file_name is not a segment file of the given table.
+  static bool parseSegmentFileName(const std::string& file_name,
+                                   const std::string& table_name,
+                                   map_api_common::Id* chunk_id);
+
+  static const char kSegmentMagic[];
+  static const char kSegmentFileExtension[];
+
+ private:
+  virtual bool initImpl() final override;
+  virtual bool insertImpl(const std::shared_ptr<const Revision>& query)
+      final override;
+  virtual bool bulkInsertImpl(const MutableRevisionMap& query) final override;
+  virtual bool patchImpl(const std::shared_ptr<const Revision>& query)
+      final override;
+  virtual bool bulkPatchImpl(
+      const std::vector<std::shared_ptr<const Revision> >& revisions)
+      final override;
+  virtual std::shared_ptr<const Revision> getByIdImpl(
+      const map_api_common::Id& id, const LogicalTime& time) const final override;
+  virtual void findByRevisionImpl(int key, const Revision& valueHolder,
+                                  const LogicalTime& time,
+                                  ConstRevisionMap* dest) const final override;
+  virtual int countByRevisionImpl(int key, const Revision& valueHolder,
+                                  const LogicalTime& time) const final override;
+  virtual void getAvailableIdsImpl(const LogicalTime& time,
+                                   std::vector<map_api_common::Id>* ids) const
+      final override;
+  virtual bool insertUpdatedImpl(const std::shared_ptr<Revision>& query)
+      final override;
+  virtual void findHistoryByRevisionImpl(int key, const Revision& valueHolder,
+                                         const LogicalTime& time,
+                                         HistoryMap* dest) const final override;
+  virtual void chunkHistory(const map_api_common::Id& chunk_id, const LogicalTime& time,
+                            HistoryMap* dest) const final override;
+  virtual void itemHistoryImpl(const map_api_common::Id& id, const LogicalTime& time,
+                               History* dest) const final override;
+  virtual void clearImpl() final override;
+  virtual size_t compactImpl(const LogicalTime& watermark) final override;
+
+  struct SegmentRevisionInformation {
+    // Offset of the payload in the segment file.
+    size_t offset;
+    uint32_t size;
+    LogicalTime update_time;
+    bool is_removed;
+    map_api_common::Id chunk_id;
+  };
+  class SegmentHistory : public std::list<SegmentRevisionInformation> {
+   public:
+    inline const_iterator latestAt(const LogicalTime& time) const {
+      for (const_iterator it = cbegin(); it != cend(); ++it) {
+        if (it->update_time <= time) {
+          return it;
+        }
+      }
+      return cend();
+    }
+  };
+  typedef std::unordered_map<map_api_common::Id, SegmentHistory>
+      SegmentHistoryMap;
+
+  // Opens or creates the segment file and maps it to memory.
+  void openSegment();
+  void closeSegment();
+  // Rebuilds data_ from the records found in the mapped segment.
+  void restoreIndex();
+  void append(const Revision& revision, SegmentRevisionInformation* info);
+  // Returns false if the revision was already in the segment.
+  bool appendPatch(const std::shared_ptr<const Revision>& query);
+  // Writes the mapped range [begin, end) to disk and waits for completion.
+  void sync(size_t begin, size_t end);
+  // Grows the segment file and its mapping such that at least required_size
+  // bytes fit.
+  void reserve(size_t required_size);
+  Revision::ConstPtr read(const SegmentRevisionInformation& info) const;
+  static std::string segmentFilePrefix(const std::string& table_name);
+  void insertIntoHistory(const SegmentRevisionInformation& info,
+                         SegmentHistory* history);
+  void readHistory(const SegmentHistory& history, const LogicalTime& time,
+                   History* dest) const;
+  inline void forEachItemFoundAtTime(
+      int key, const Revision& value_holder, const LogicalTime& time,
+      const std::function<void(const map_api_common::Id& id,
+                               const Revision::ConstPtr& item)>& action) const;
+
+  const std::string segment_file_;
+  int file_descriptor_;
+  char* mapped_;
+  size_t mapped_size_;
+  // End of the written data, where the next record is appended.
+  size_t end_;
+  // Bytes of the records in [kSegmentMagicSize, end_) that compaction dropped.
+  size_t dead_bytes_;
+  LogicalTime latest_modification_time_;
+
+  SegmentHistoryMap data_;
+};
+
+}  // namespace map_api
+
+#endif  // MAP_API_LEGACY_CHUNK_DATA_MMAP_CONTAINER_H_
@@ -39,6 +39,9 @@ class LegacyChunkDataRamContainer : public LegacyChunkDataContainerBase {
   virtual bool bulkInsertImpl(const MutableRevisionMap& query) final override;
   virtual bool patchImpl(const std::shared_ptr<const Revision>& query)
       final override;
+  virtual bool bulkPatchImpl(
+      const std::vector<std::shared_ptr<const Revision> >& revisions)
+      final override;
   virtual std::shared_ptr<const Revision> getByIdImpl(
       const map_api_common::Id& id, const LogicalTime& time) const final override;
   virtual void findByRevisionImpl(int key, const Revision& valueHolder,
@@ -60,6 +63,7 @@ class LegacyChunkDataRamContainer : public LegacyChunkDataContainerBase {
   virtual void itemHistoryImpl(const map_api_common::Id& id, const LogicalTime& time,
                                History* dest) const final override;
   virtual void clearImpl() final override;
+  virtual size_t compactImpl(const LogicalTime& watermark) final override;
 
   inline void forEachItemFoundAtTime(
       int key, const Revision& value_holder, const LogicalTime& time,
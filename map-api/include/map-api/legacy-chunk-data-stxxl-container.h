@@ -42,6 +42,9 @@ class LegacyChunkDataStxxlContainer : public LegacyChunkDataContainerBase {
   virtual bool bulkInsertImpl(const MutableRevisionMap& query) final override;
   virtual bool patchImpl(const std::shared_ptr<const Revision>& query)
       final override;
+  virtual bool bulkPatchImpl(
+      const std::vector<std::shared_ptr<const Revision> >& revisions)
+      final override;
   virtual std::shared_ptr<const Revision> getByIdImpl(
       const map_api_common::Id& id, const LogicalTime& time) const final override;
   virtual void findByRevisionImpl(int key, const Revision& valueHolder,
@@ -62,6 +65,7 @@ class LegacyChunkDataStxxlContainer : public LegacyChunkDataContainerBase {
   virtual void itemHistoryImpl(const map_api_common::Id& id, const LogicalTime& time,
                                History* dest) const final override;
   virtual void clearImpl() final override;
+  virtual size_t compactImpl(const LogicalTime& watermark) final override;
 
   inline void forEachItemFoundAtTime(
       int key, const Revision& value_holder, const LogicalTime& time,
@@ -71,7 +75,6 @@ class LegacyChunkDataStxxlContainer : public LegacyChunkDataContainerBase {
       const map_api_common::Id& chunk_id, const LogicalTime& time,
       const std::function<void(const map_api_common::Id& id,
                                const Revision::ConstPtr& item)>& action) const;
-  inline void trimToTime(const LogicalTime& time, HistoryMap* subject) const;
 
   class STXXLHistory : public std::list<CRURevisionInformation> {
    public:
@@ -87,8 +90,25 @@ class LegacyChunkDataStxxlContainer : public LegacyChunkDataContainerBase {
   typedef std::unordered_map<map_api_common::Id, STXXLHistory> STXXLHistoryMap;
   STXXLHistoryMap data_;
 
+  // Retrieves the histories of the given items up to time in a single batch.
+  // Items without revisions up to time are still added to dest.
+  inline void retrieveHistories(
+      const std::vector<const STXXLHistoryMap::value_type*>& items,
+      const LogicalTime& time, HistoryMap* dest) const;
+
   static constexpr int kBlockSize = kSTXXLDefaultBlockSize;
-  std::unique_ptr<STXXLRevisionStore<kBlockSize>> revision_store_;
+  // Configured by the --map_api_stxxl_* flags.
+  static std::unique_ptr<STXXLRevisionStoreBase> newRevisionStore(
+      size_t num_shards);
+  std::unique_ptr<STXXLRevisionStoreBase> revision_store_;
+
+  void storeRevision(const Revision& revision,
+                     CRURevisionInformation* revision_information);
+  // Revisions in revision_store_, and how many of them have been dropped by
+  // compaction. Revisions are counted rather than their bytes, since the
+  // store doesn't report the size of its blocks.
+  size_t num_stored_revisions_;
+  size_t num_dead_revisions_;
 };
 
 }  // namespace map_api
@@ -34,7 +34,10 @@ void LegacyChunk::fillMetadata(RequestType* destination) const {
 }
 
 inline void LegacyChunk::syncLatestCommitTime(const Revision& item) {
-  LogicalTime commit_time = item.getModificationTime();
+  syncLatestCommitTime(item.getModificationTime());
+}
+
+inline void LegacyChunk::syncLatestCommitTime(const LogicalTime& commit_time) {
   if (commit_time > latest_commit_time_) {
     latest_commit_time_ = commit_time;
   }
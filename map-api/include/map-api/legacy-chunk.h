@@ -87,6 +87,11 @@ class LegacyChunk : public ChunkBase {
       const std::shared_ptr<TableDescriptor>& descriptor) override;
   bool init(const map_api_common::Id& id, const proto::InitRequest& request,
             const PeerId& sender, std::shared_ptr<TableDescriptor> descriptor);
+  // Opens the segment file of the chunk without joining any swarm yet, such
+  // that a following init request only needs to contain newer revisions.
+  // Returns the latest commit time of the restored revisions.
+  LogicalTime restore(const map_api_common::Id& id,
+                      std::shared_ptr<TableDescriptor> descriptor);
 
   virtual void dumpItems(const LogicalTime& time, ConstRevisionMap* items) const
       override;
@@ -111,8 +116,14 @@ class LegacyChunk : public ChunkBase {
 
   virtual bool isWriteLocked() const override;
 
+  virtual std::thread::id adoptWriteLock() override;
+
+  virtual void handOverWriteLock(const std::thread::id& thread) override;
+
   virtual void unlock() const override;
 
+  virtual void setItemListener(const ItemListener& listener) override;
+
   /**
    * Requests all peers in MapApiHub to participate in a given chunk.
    * At the moment, this is not disputable by the other peers.
@@ -128,6 +139,9 @@ class LegacyChunk : public ChunkBase {
 
   virtual LogicalTime getLatestCommitTime() const override;
 
+  virtual size_t compactHistory(const LogicalTime& watermark) override;
+
+  static const char kBulkInsertRequest[];
   static const char kConnectRequest[];
   static const char kInitRequest[];
   static const char kInsertRequest[];
@@ -136,6 +150,8 @@ class LegacyChunk : public ChunkBase {
   static const char kNewPeerRequest[];
   static const char kUnlockRequest[];
   static const char kUpdateRequest[];
+  // Response to a field delta update whose base the receiver doesn't hold.
+  static const char kNeedFullRevisionResponse[];
 
  private:
   /**
@@ -162,8 +178,9 @@ class LegacyChunk : public ChunkBase {
    * function should check for that themselves if it is OK by them.
    * The function returns false iff the peer is not in the swarm but refuses
    * to join it by responding with Message::kDecline.
+   * Revisions up to known_until, if valid, are not sent to the peer.
    */
-  bool addPeer(const PeerId& peer);
+  bool addPeer(const PeerId& peer, const LogicalTime& known_until);
   size_t addAllPeers();
   /**
    * Distributed RW lock structure. Because it is distributed, unlocking from
@@ -204,6 +221,19 @@ class LegacyChunk : public ChunkBase {
 
   template <typename RequestType>
   void fillMetadata(RequestType* destination) const;
+  // Returns the version of the item that an update at "time" is based on, if
+  // field delta updates are enabled.
+  std::shared_ptr<const Revision> getUpdateBase(const Revision& item,
+                                                const LogicalTime& time) const;
+  // Serializes the item as a field delta relative to base if that omits at
+  // least one custom field, otherwise as a whole.
+  static void fillUpdateRequest(const std::shared_ptr<const Revision>& base,
+                                const Revision& item,
+                                proto::PatchRequest* request);
+  // Broadcasts an update request filled by fillUpdateRequest(). Peers that
+  // can't apply a field delta are sent the whole item instead.
+  void broadcastUpdateRequest(const proto::PatchRequest& update_request,
+                              const Revision& item);
 
   /**
    * Returns true iff lock status is WRITE_LOCKED and lock holder is self.
@@ -214,11 +244,14 @@ class LegacyChunk : public ChunkBase {
    */
   bool isWriter(const PeerId& peer) const;
 
-  void initRequestSetData(proto::InitRequest* request);
+  // Only revisions updated after known_until are added.
+  void initRequestSetData(const LogicalTime& known_until,
+                          proto::InitRequest* request);
   void initRequestSetPeers(proto::InitRequest* request);
-  void prepareInitRequest(Message* request);
+  void prepareInitRequest(const LogicalTime& known_until, Message* request);
 
   inline void syncLatestCommitTime(const Revision& item);
+  inline void syncLatestCommitTime(const LogicalTime& commit_time);
 
   /**
    * ====================================================================
@@ -229,8 +262,13 @@ class LegacyChunk : public ChunkBase {
   /**
    * Handles insert requests
    */
-  void handleConnectRequest(const PeerId& peer, Message* response);
-  static void handleConnectRequestThread(LegacyChunk* self, const PeerId& peer);
+  // Items are sorted by update time in the process.
+  void handleBulkInsertRequest(
+      std::vector<std::shared_ptr<const Revision> >* items, Message* response);
+  void handleConnectRequest(const PeerId& peer, const LogicalTime& known_until,
+                            Message* response);
+  static void handleConnectRequestThread(LegacyChunk* self, const PeerId& peer,
+                                         const LogicalTime& known_until);
   void handleInsertRequest(const std::shared_ptr<Revision>& item,
                            Message* response);
   void handleLeaveRequest(const PeerId& leaver, Message* response);
@@ -240,6 +278,11 @@ class LegacyChunk : public ChunkBase {
   void handleUnlockRequest(const PeerId& locker, Message* response);
   void handleUpdateRequest(const std::shared_ptr<Revision>& item,
                            const PeerId& sender, Message* response);
+  // Reconstructs the updated item from the version in the container, or
+  // responds with kNeedFullRevisionResponse if that version isn't the base of
+  // the delta.
+  void handleFieldDeltaUpdateRequest(const proto::PatchRequest& request,
+                                     const PeerId& sender, Message* response);
 
   void awaitInitialized() const;
 
@@ -101,6 +101,8 @@ class NetTableManager {
   /**
    * Chunk requests
    */
+  static void handleBulkInsertRequest(const Message& request,
+                                      Message* response);
   static void handleConnectRequest(const Message& request, Message* response);
   static void handleFindRequest(const Message& request, Message* response);
   static void handleInitRequest(const Message& request, Message* response);
@@ -119,6 +121,8 @@ class NetTableManager {
                                                Message* response);
   static void handleSpatialTriggerNotification(const Message& request,
                                                Message* response);
+  static void handleOldestActiveBeginTimeRequest(const Message& request,
+                                                 Message* response);
   /**
    * Chord requests
    */
@@ -47,6 +47,18 @@ std::shared_ptr<const Revision> NetTableTransaction::getById(
   return transactionOf(chunk)->getById(id);
 }
 
+template <typename IdType>
+void NetTableTransaction::getByIds(
+    const std::vector<IdType>& ids,
+    std::vector<std::shared_ptr<const Revision>>* results) {
+  std::vector<map_api_common::Id> common_ids;
+  common_ids.reserve(ids.size());
+  for (const IdType& id : ids) {
+    common_ids.push_back(id.template toIdType<map_api_common::Id>());
+  }
+  getByCommonIds(common_ids, results);
+}
+
 template <typename ValueType>
 void NetTableTransaction::find(int key, const ValueType& value,
                                ConstRevisionMap* result) {
@@ -63,10 +75,11 @@ void NetTableTransaction::find(int key, const ValueType& value,
 template <typename IdType>
 void NetTableTransaction::getAvailableIds(std::vector<IdType>* ids) {
   CHECK_NOTNULL(ids)->clear();
-  ids->reserve(item_id_to_chunk_id_map_.size());
-  for (const ItemIdToChunkIdMap::value_type& item_chunk_ids :
-       item_id_to_chunk_id_map_) {
-    ids->push_back(item_chunk_ids.first.toIdType<IdType>());
+  std::vector<map_api_common::Id> common_ids;
+  getAvailableCommonIds(&common_ids);
+  ids->reserve(common_ids.size());
+  for (const map_api_common::Id& id : common_ids) {
+    ids->push_back(id.toIdType<IdType>());
   }
 }
 
@@ -99,7 +112,7 @@ ChunkBase* NetTableTransaction::chunkOf(const IdType& id) const {
   ItemIdToChunkIdMap::const_iterator found =
       item_id_to_chunk_id_map_.find(common_id);
   if (found == item_id_to_chunk_id_map_.end()) {
-    return nullptr;
+    return table_->getActiveChunkOfItem(common_id);
   } else {
     return table_->getChunk(found->second);
   }
@@ -91,11 +91,14 @@ class NetTableTransactionInterface
     // * Do the data-metadata split at a lower level than ThreadsafeCache.
     transaction_->insert(chunk_manager_,
                          std::const_pointer_cast<Revision>(value));
+    // Keeps has() up to date without a refresh.
+    available_ids_.emplace(id);
     return true;
   }
 
   virtual void erase(const IdType& id) final override {
     transaction_->remove(id, table_);
+    available_ids_.erase(id);
   }
 
   void refresh() const {
@@ -22,6 +22,7 @@
 #ifndef MAP_API_NET_TABLE_TRANSACTION_H_
 #define MAP_API_NET_TABLE_TRANSACTION_H_
 
+#include <functional>
 #include <map>
 #include <memory>
 #include <vector>
@@ -64,12 +65,21 @@ class NetTableTransaction {
   template <typename IdType>
   std::shared_ptr<const Revision> getById(const IdType& id,
                                           ChunkBase* chunk) const;
+  template <typename IdType>
+  void getByIds(const std::vector<IdType>& ids,
+                std::vector<std::shared_ptr<const Revision>>* results);
+  void getByCommonIds(const std::vector<map_api_common::Id>& ids,
+                      std::vector<std::shared_ptr<const Revision>>* results);
   void dumpChunk(const ChunkBase* chunk, ConstRevisionMap* result);
   void dumpActiveChunks(ConstRevisionMap* result);
+  void forEachItemInChunk(const ChunkBase* chunk,
+                          const ChunkTransaction::ItemAction& action);
+  void forEachItemInActiveChunks(const ChunkTransaction::ItemAction& action);
   template <typename ValueType>
   void find(int key, const ValueType& value, ConstRevisionMap* result);
   template <typename IdType>
   void getAvailableIds(std::vector<IdType>* ids);
+  void getAvailableCommonIds(std::vector<map_api_common::Id>* ids);
 
   // =========================
   // WRITE (see transaction.h)
@@ -104,6 +114,8 @@ class NetTableTransaction {
   void unlock();
 
   bool hasNoConflicts();
+  // Doesn't require the locks, see ChunkTransaction::hasNoVisibleConflicts().
+  bool hasNoVisibleConflicts() const;
   void merge(const std::shared_ptr<NetTableTransaction>& merge_transaction,
              Conflicts* conflicts);
   size_t numChangedItems() const;
@@ -117,11 +129,9 @@ class NetTableTransaction {
   // ========
   ChunkTransaction* transactionOf(const ChunkBase* chunk) const;
   template <typename IdType>
+  // Looks up items inserted by this transaction first, then the id-to-chunk
+  // index of the table.
   ChunkBase* chunkOf(const IdType& id) const;
-  // The following must be called if chunks are fetched after the transaction
-  // has been initialized, otherwise the new items can't be fetched by the
-  // transaction.
-  void refreshIdToChunkIdMap();
 
   typedef std::unordered_map<map_api_common::Id, ChunkTransaction::TableToIdMultiMap>
       TrackedChunkToTrackersMap;
@@ -147,10 +157,18 @@ class NetTableTransaction {
       TransactionMap;
   typedef TransactionMap::value_type TransactionPair;
   mutable TransactionMap chunk_transactions_;
+  // Once all chunks are locked, the per-chunk work of a commit is independent
+  // and is done concurrently with this. The chunk write locks are handed to
+  // the worker threads for the duration of their task, and back unless the
+  // function releases them.
+  void forEachChunkTransactionInParallel(
+      const std::function<void(const TransactionPair&)>& function) const;
   LogicalTime begin_time_;
   NetTable* table_;
   Workspace::TableInterface workspace_;
 
+  // Only for items inserted by this transaction, all others are looked up in
+  // NetTable::getActiveChunkOfItem().
   typedef std::unordered_map<map_api_common::Id, map_api_common::Id> ItemIdToChunkIdMap;
   ItemIdToChunkIdMap item_id_to_chunk_id_map_;
 
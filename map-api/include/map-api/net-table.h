@@ -22,8 +22,10 @@
 #ifndef MAP_API_NET_TABLE_H_
 #define MAP_API_NET_TABLE_H_
 
+#include <condition_variable>
 #include <set>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -40,6 +42,7 @@
 
 namespace map_api {
 class ConstRevisionMap;
+class LegacyChunk;
 class MutableRevisionMap;
 
 inline std::string humanReadableBytes(double size) {
@@ -69,6 +72,8 @@ class NetTable {
  public:
   static const std::string kChunkIdField;
 
+  ~NetTable();
+
   // ======
   // BASICS
   // ======
@@ -87,12 +92,23 @@ class NetTable {
   void getActiveChunkIds(std::set<map_api_common::Id>* chunk_ids) const;
   ChunkBase* getChunk(const map_api_common::Id& chunk_id);
   void getActiveChunks(std::set<ChunkBase*>* chunks) const;
+  // Returns the active chunk that contains or contained the given item, or
+  // nullptr if there is none. Is backed by an index that is updated as items
+  // are added to active chunks, so it doesn't depend on the amount of chunks.
+  ChunkBase* getActiveChunkOfItem(const map_api_common::Id& item_id) const;
   bool ensureHasChunks(const map_api_common::IdSet& chunks_to_ensure);
   ChunkBase* connectTo(const map_api_common::Id& chunk_id, const PeerId& peer);
   void shareAllChunks();
   void shareAllChunks(const PeerId& peer);
+  // Leaves the given active chunk, such that its items are no longer found.
+  void leaveChunk(const map_api_common::Id& chunk_id);
   void leaveAllChunks();
   void leaveAllChunksOnceShared();
+  // Activates all chunks of this table that this peer has persisted to
+  // --map_api_chunk_segment_dir. Chunks that are still held by other peers are
+  // rejoined, and only the revisions committed after the latest one in the
+  // segment are fetched from them. Returns the amount of restored chunks.
+  size_t restorePersistedChunks();
 
   // =====
   // STATS
@@ -103,6 +119,22 @@ class NetTable {
   size_t activeChunksItemsSizeBytes();
   std::string getStatistics();
 
+  // ==================
+  // HISTORY COMPACTION
+  // ==================
+  // Drops all revisions of active chunks that have been superseded before the
+  // begin time of the oldest transaction alive on any peer of the hub.
+  // Compacted histories are sent to peers that join a chunk later on, so the
+  // watermark is the minimum of Transaction::oldestActiveBeginTime() over all
+  // peers, see historyCompactionWatermark(). Transactions started at an
+  // explicit begin time older than a past compaction may see an incomplete
+  // history, so this is opt-in per table. Returns the amount of dropped
+  // revisions.
+  size_t compactHistory();
+  // Runs compactHistory() every FLAGS_map_api_history_compaction_interval_ms
+  // in a background thread until the table is killed.
+  void enableHistoryCompaction();
+
   // ==============
   // CHUNK TRACKING
   // ==============
@@ -209,8 +241,11 @@ class NetTable {
   // REQUEST HANDLERS
   // ================
   // TODO(tcies) somehow unify all routing to chunks? (yes, like chord)
+  void handleBulkInsertRequest(
+      const map_api_common::Id& chunk_id,
+      std::vector<std::shared_ptr<const Revision> >* items, Message* response);
   void handleConnectRequest(const map_api_common::Id& chunk_id, const PeerId& peer,
-                            Message* response);
+                            const LogicalTime& known_until, Message* response);
   void handleInitRequest(const proto::InitRequest& request,
                          const PeerId& sender, Message* response);
   void handleInsertRequest(const map_api_common::Id& chunk_id,
@@ -227,6 +262,9 @@ class NetTable {
   void handleUpdateRequest(const map_api_common::Id& chunk_id,
                            const std::shared_ptr<Revision>& item,
                            const PeerId& sender, Message* response);
+  void handleFieldDeltaUpdateRequest(const map_api_common::Id& chunk_id,
+                                     const proto::PatchRequest& request,
+                                     const PeerId& sender, Message* response);
 
   void handleRoutedNetTableChordRequests(const Message& request,
                                          Message* response);
@@ -236,6 +274,9 @@ class NetTable {
   void handleAnnounceToListeners(const PeerId& announcer, Message* response);
   static const char kAnnounceToListeners[];
 
+  static const char kOldestActiveBeginTimeRequest[];
+  static const char kOldestActiveBeginTimeResponse[];
+
   void handleSpatialIndexTrigger(const proto::SpatialIndexTrigger& trigger);
 
  private:
@@ -300,21 +341,51 @@ class NetTable {
 
   void leaveIndices();
 
+  void stopHistoryCompaction();
+
+  // Revisions up to known_until, if valid, are held by a chunk in
+  // restored_chunks_ and not sent again.
+  ChunkBase* connectTo(const map_api_common::Id& chunk_id, const PeerId& peer,
+                       const LogicalTime& known_until);
+  // Asks all peers of the hub for their oldest active begin time, after
+  // sampling the local one. Peers synchronize their logical clock to the
+  // request, so any transaction they begin after responding begins after the
+  // resulting watermark. Returns false if a peer doesn't respond as expected.
+  static bool historyCompactionWatermark(LogicalTime* watermark);
+
   void getChunkHolders(const map_api_common::Id& chunk_id,
                        std::unordered_set<PeerId>* peers);
   void joinChunkHolders(const map_api_common::Id& chunk_id);
   void leaveChunkHolders(const map_api_common::Id& chunk_id);
 
+  void indexItems(const std::vector<map_api_common::Id>& item_ids,
+                  const map_api_common::Id& chunk_id);
+  void unindexChunk(const map_api_common::Id& chunk_id);
+
   std::shared_ptr<TableDescriptor> descriptor_;
   ChunkMap active_chunks_;
   // See issue #2391 for why we need a reader-first RW mutex here.
   mutable map_api_common::ReaderFirstReaderWriterMutex active_chunks_lock_;
 
+  // Chunks restored by restorePersistedChunks() that await the init request
+  // of the swarm they rejoin, see handleInitRequest().
+  typedef std::unordered_map<map_api_common::Id, std::unique_ptr<LegacyChunk>>
+      RestoredChunkMap;
+  RestoredChunkMap restored_chunks_;
+  std::mutex m_restored_chunks_;
+
   // DO NOT USE FROM HANDLER THREAD (else TODO(tcies) mutex)
   std::unique_ptr<NetTableIndex> index_;
   std::unique_ptr<SpatialIndex> spatial_index_;
   map_api_common::ReaderWriterMutex index_lock_;
 
+  // Item id to chunk id, for all items of the active chunks. Items never move
+  // between chunks, so entries only become invalid when chunks are left.
+  typedef std::unordered_map<map_api_common::Id, map_api_common::Id>
+      ItemChunkIndex;
+  ItemChunkIndex item_chunk_index_;
+  mutable map_api_common::ReaderWriterMutex item_chunk_index_lock_;
+
   std::vector<TriggerCallbackWithChunkPointer>
       triggers_to_attach_to_future_chunks_;
   std::mutex m_triggers_to_attach_;
@@ -328,6 +399,11 @@ class NetTable {
   NewChunkTrackerMap new_chunk_trackers_;
 
   std::vector<Revision::AutoMergePolicy> auto_merge_policies_;
+
+  std::thread history_compactor_;
+  bool terminate_history_compaction_ = false;
+  std::mutex m_history_compaction_;
+  std::condition_variable cv_history_compaction_;
 };
 
 }  // namespace map_api
@@ -23,8 +23,10 @@
 #define MAP_API_PROTO_STL_STREAM_H_
 
 #include <memory>
+#include <string>
 
 #include <glog/logging.h>
+#include <google/protobuf/io/coded_stream.h>
 #include <google/protobuf/io/zero_copy_stream.h>
 #include <google/protobuf/io/zero_copy_stream_impl.h>
 #include <google/protobuf/message.h>
@@ -163,29 +165,25 @@ class STLContainerInputStream
   // Uses length-prefix framing for protocol buffers.
   bool ReadMessage(google::protobuf::Message* message) {
     CHECK_NOTNULL(message);
-
-    // Get the memory where the message size was written to.
-    const unsigned char* data = nullptr;
-    int size = 0;
-    bool status = Next(reinterpret_cast<const void**>(&data), &size);
-    if (status == false) {
-      return status;
-    }
-    CHECK_NOTNULL(data);
-    // Read the message size.
     google::int32 message_size = 0;
-    const int kNumBytesForMessageSizeHeader = sizeof(message_size);
-    CHECK(size >= kNumBytesForMessageSizeHeader);
-    memcpy(&message_size, data, kNumBytesForMessageSizeHeader);
-    CHECK_NE(message_size, 0);
-
-    // Give back excess memory to the pool.
-    BackUp(size - kNumBytesForMessageSizeHeader);
-
+    if (!ReadMessageSize(&message_size)) {
+      return false;
+    }
     // Now read the message.
     return message->ParseFromBoundedZeroCopyStream(this, message_size);
   }
 
+  // Reads a message written with the framing above without parsing it.
+  bool ReadSerializedMessage(std::string* serialized_message) {
+    CHECK_NOTNULL(serialized_message);
+    google::int32 message_size = 0;
+    if (!ReadMessageSize(&message_size)) {
+      return false;
+    }
+    google::protobuf::io::CodedInputStream coded_stream(this);
+    return coded_stream.ReadString(serialized_message, message_size);
+  }
+
   // This method is called by protobuf to get the next memory block to read
   // from.
   virtual bool Next(const void** data, int* size) {
@@ -233,6 +231,27 @@ class STLContainerInputStream
   virtual google::int64 ByteCount() const { return bytes_read_; }
 
  private:
+  bool ReadMessageSize(google::int32* message_size) {
+    CHECK_NOTNULL(message_size);
+    // Get the memory where the message size was written to.
+    const unsigned char* data = nullptr;
+    int size = 0;
+    bool status = Next(reinterpret_cast<const void**>(&data), &size);
+    if (status == false) {
+      return status;
+    }
+    CHECK_NOTNULL(data);
+    // Read the message size.
+    const int kNumBytesForMessageSizeHeader = sizeof(*message_size);
+    CHECK(size >= kNumBytesForMessageSizeHeader);
+    memcpy(message_size, data, kNumBytesForMessageSizeHeader);
+    CHECK_NE(*message_size, 0);
+
+    // Give back excess memory to the pool.
+    BackUp(size - kNumBytesForMessageSizeHeader);
+    return true;
+  }
+
   int block_index_;
   int byte_offset_;
   google::int64 bytes_read_;
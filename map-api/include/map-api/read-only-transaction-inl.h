@@ -0,0 +1,80 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef MAP_API_READ_ONLY_TRANSACTION_INL_H_
+#define MAP_API_READ_ONLY_TRANSACTION_INL_H_
+
+#include <vector>
+
+#include "map-api/chunk-base.h"
+#include "map-api/net-table.h"
+
+namespace map_api {
+
+template <typename IdType>
+std::shared_ptr<const Revision> ReadOnlyTransaction::getById(
+    const IdType& id, NetTable* table) const {
+  CHECK_NOTNULL(table);
+  map_api_common::Id common_id;
+  id.toHashId(&common_id);
+  return getByIdImpl(common_id, table);
+}
+
+template <typename IdType>
+std::shared_ptr<const Revision> ReadOnlyTransaction::getById(
+    const IdType& id, NetTable* table, ChunkBase* chunk) const {
+  CHECK_NOTNULL(table);
+  CHECK_NOTNULL(chunk);
+  map_api_common::Id common_id;
+  id.toHashId(&common_id);
+  return getByIdImpl(common_id, table, *chunk);
+}
+
+template <typename IdType>
+void ReadOnlyTransaction::getAvailableIds(NetTable* table,
+                                          std::vector<IdType>* ids) const {
+  CHECK_NOTNULL(table);
+  CHECK_NOTNULL(ids)->clear();
+  std::vector<map_api_common::Id> common_ids;
+  getAvailableIdsImpl(table, &common_ids);
+  ids->reserve(common_ids.size());
+  for (const map_api_common::Id& id : common_ids) {
+    ids->push_back(id.toIdType<IdType>());
+  }
+}
+
+template <typename ValueType>
+void ReadOnlyTransaction::find(int key, const ValueType& value, NetTable* table,
+                               ConstRevisionMap* result) const {
+  CHECK_NOTNULL(table);
+  CHECK_NOTNULL(result)->clear();
+  Workspace::TableInterface(*workspace_, table)
+      .forEachChunk([&, this](const ChunkBase& chunk) {
+        ConstRevisionMap chunk_result;
+        chunk.constData()->find(key, value, begin_time_, &chunk_result);
+        result->insert(chunk_result.begin(), chunk_result.end());
+      });
+}
+
+}  // namespace map_api
+
+#endif  // MAP_API_READ_ONLY_TRANSACTION_INL_H_
@@ -0,0 +1,98 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef MAP_API_READ_ONLY_TRANSACTION_H_
+#define MAP_API_READ_ONLY_TRANSACTION_H_
+
+#include <memory>
+#include <vector>
+
+#include "map-api/internal/view-base.h"
+#include "map-api/logical-time.h"
+#include "map-api/revision-map.h"
+#include "map-api/workspace.h"
+
+namespace map_api {
+class ChunkBase;
+class NetTable;
+class Revision;
+
+/**
+ * Reads the local chunk replicas as they were at the begin time. Since no
+ * changes can be made, no per-table or per-chunk transaction state is needed:
+ * all reads go straight to chunk snapshots, which makes this class very cheap
+ * to create. Prefer it over Transaction for queries.
+ */
+class ReadOnlyTransaction {
+ public:
+  ReadOnlyTransaction(const std::shared_ptr<Workspace>& workspace,
+                      const LogicalTime& begin_time);
+  // Defaults: Full workspace, current time.
+  ReadOnlyTransaction();
+  explicit ReadOnlyTransaction(const std::shared_ptr<Workspace>& workspace);
+  explicit ReadOnlyTransaction(const LogicalTime& begin_time);
+  ReadOnlyTransaction(const ReadOnlyTransaction&) = delete;
+  ReadOnlyTransaction& operator=(const ReadOnlyTransaction&) = delete;
+
+  ~ReadOnlyTransaction();
+
+  inline LogicalTime getBeginTime() const { return begin_time_; }
+
+  // See transaction.h.
+  template <typename IdType>
+  std::shared_ptr<const Revision> getById(const IdType& id,
+                                          NetTable* table) const;
+  template <typename IdType>
+  std::shared_ptr<const Revision> getById(const IdType& id, NetTable* table,
+                                          ChunkBase* chunk) const;
+  void dumpChunk(NetTable* table, ChunkBase* chunk,
+                 ConstRevisionMap* result) const;
+  void dumpActiveChunks(NetTable* table, ConstRevisionMap* result) const;
+  typedef internal::ViewBase::ItemAction ItemAction;
+  void forEachItemInChunk(NetTable* table, ChunkBase* chunk,
+                          const ItemAction& action) const;
+  void forEachItemInActiveChunks(NetTable* table,
+                                 const ItemAction& action) const;
+  template <typename IdType>
+  void getAvailableIds(NetTable* table, std::vector<IdType>* ids) const;
+  template <typename ValueType>
+  void find(int key, const ValueType& value, NetTable* table,
+            ConstRevisionMap* result) const;
+
+ private:
+  std::shared_ptr<const Revision> getByIdImpl(const map_api_common::Id& id,
+                                              NetTable* table) const;
+  std::shared_ptr<const Revision> getByIdImpl(const map_api_common::Id& id,
+                                              NetTable* table,
+                                              const ChunkBase& chunk) const;
+  void getAvailableIdsImpl(NetTable* table,
+                           std::vector<map_api_common::Id>* ids) const;
+
+  const std::shared_ptr<Workspace> workspace_;
+  LogicalTime begin_time_;
+};
+
+}  // namespace map_api
+
+#include "./read-only-transaction-inl.h"
+
+#endif  // MAP_API_READ_ONLY_TRANSACTION_H_
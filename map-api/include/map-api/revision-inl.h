@@ -37,11 +37,9 @@ template <typename FieldType>
 bool Revision::set(int index, const FieldType& value) {
   CHECK_LT(index, underlying_revision_->custom_field_values_size())
       << "Index out of custom field bounds";
-  proto::TableField* field =
-      underlying_revision_->mutable_custom_field_values(index);
-  CHECK_EQ(field->type(), getProtobufTypeEnum<FieldType>())
+  CHECK_EQ(customField(index).type(), getProtobufTypeEnum<FieldType>())
       << "Type mismatch when trying to set field " << index;
-  return set(field, value);
+  return set(mutableCustomField(index), value);
 }
 
 template <typename FieldType>
@@ -49,8 +47,7 @@ bool Revision::get(int index, FieldType* value) const {
   CHECK_NOTNULL(value);
   CHECK_LT(index, underlying_revision_->custom_field_values_size())
       << "Index out of custom field bounds";
-  const proto::TableField& field =
-      underlying_revision_->custom_field_values(index);
+  const proto::TableField& field = customField(index);
   CHECK_EQ(field.type(), getProtobufTypeEnum<FieldType>())
       << "Type mismatch when trying to get field " << index
       << ". May it be that you are using outdated save files?";
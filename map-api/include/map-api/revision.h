@@ -22,6 +22,7 @@
 #ifndef MAP_API_REVISION_H_
 #define MAP_API_REVISION_H_
 
+#include <atomic>
 #include <memory>
 #include <set>
 #include <string>
@@ -30,6 +31,7 @@
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <google/protobuf/arena.h>
 
 #include "./core.pb.h"
 #include "map-api/logical-time.h"
@@ -48,8 +50,10 @@ class Revision {
   friend class LegacyChunk;
   friend class ChunkDataContainerBase;
   friend class LegacyChunkDataContainerBase;
-  template <int BlockSize>
+  template <int BlockSize, unsigned CachePages, int Pager>
   friend class STXXLRevisionStore;
+  template <typename... FieldTypes>
+  friend class TableSchema;
   friend class TrackeeMultimap;
   friend class Transaction;
 
@@ -62,11 +66,27 @@ class Revision {
   typedef std::vector<char> Blob;
   typedef std::shared_ptr<Revision> Ptr;
   typedef std::shared_ptr<const Revision> ConstPtr;
+  // Revisions can be allocated on a shared protobuf arena, so that they are
+  // allocated and freed in bulk. Each such revision keeps the whole arena
+  // alive, so arenas are only suited for revisions that die together, e.g.
+  // within the scope of one operation, and not for revisions that are stored
+  // in a chunk or cache.
+  typedef std::shared_ptr<google::protobuf::Arena> ArenaPtr;
+  static ArenaPtr createArena();
 
   Revision& operator=(const Revision& other) = delete;
 
+  // Copies the metadata, while the custom field values are shared with other
+  // until they are set in either revision. Unlike copyForWrite(), the set of
+  // changed custom fields is copied as well.
+  Revision(const Revision& other);
+
   // Constructor and assignment replacements.
+  // Copies share the custom field values with the original until they are
+  // set, so only modified fields are ever copied.
   void copyForWrite(std::shared_ptr<Revision>* result) const;
+  void copyForWrite(const ArenaPtr& arena,
+                    std::shared_ptr<Revision>* result) const;
   // You need to use std::move() for the unique_ptr of the following.
   static void fromProto(const std::shared_ptr<proto::Revision>& revision_proto,
                         std::shared_ptr<Revision>* result);
@@ -74,6 +94,14 @@ class Revision {
                         std::shared_ptr<const Revision>* result);
   static std::shared_ptr<Revision> fromProtoString(
       const std::string& revision_proto_string);
+  static std::shared_ptr<Revision> fromProtoString(
+      const std::string& revision_proto_string, const ArenaPtr& arena);
+  // Returns a new proto that is allocated on the given arena, or on the heap
+  // if arena is null.
+  static std::shared_ptr<proto::Revision> newProto(const ArenaPtr& arena);
+  // Wraps a proto that is owned by the given arena.
+  static std::shared_ptr<proto::Revision> aliasArenaProto(
+      const ArenaPtr& arena, proto::Revision* revision_proto);
 
   // Defaults to blob in order to be easy to use for arbitrary protobufs.
   template <typename FieldType>
@@ -102,6 +130,11 @@ class Revision {
 
   void clearCustomFieldValues();
 
+  // Custom fields that have been set since this revision was created with
+  // copyForWrite(). Revisions created otherwise report all custom fields.
+  bool isCustomFieldChanged(int index) const;
+  void getChangedCustomFields(std::vector<int>* indices) const;
+
   inline LogicalTime getInsertTime() const {
     return LogicalTime(underlying_revision_->insert_time());
   }
@@ -153,20 +186,39 @@ class Revision {
    */
   bool fieldMatch(const Revision& other, int index) const;
   bool areAllCustomFieldsEqual(const Revision& other) const;
+  // Hash of the serialized custom field values, for change detection.
+  // Lazily parsed fields are hashed as received, without decoding them. As
+  // hashes may collide, equal hashes don't imply equal fields.
+  size_t customFieldsHash() const;
+  // Size of the serialized custom field values, without serializing them.
+  size_t customFieldsByteSize() const;
 
   std::string dumpToString() const;
 
-  inline std::string serializeUnderlying() const {
-    return underlying_revision_->SerializeAsString();
-  }
-
-  inline bool SerializeToCodedStream(
-      google::protobuf::io::CodedOutputStream* output) const {
-    CHECK_NOTNULL(output);
-    return underlying_revision_->SerializeToCodedStream(output);
-  }
-
-  inline int byteSize() const { return underlying_revision_->ByteSize(); }
+  std::string serializeUnderlying() const;
+  bool SerializeToCodedStream(
+      google::protobuf::io::CodedOutputStream* output) const;
+  int byteSize() const;
+  // Writes the complete proto, including custom field values shared with
+  // other revisions, to destination.
+  void copyUnderlyingTo(proto::Revision* destination) const;
+
+  // Field deltas only carry the custom fields in which a revision differs
+  // from a base version of the same item. Fields that have not been set since
+  // copyForWrite() are only compared to base if they are not shared with it.
+  void getCustomFieldsChangedFrom(const Revision& base,
+                                  std::vector<int>* indices) const;
+  // Serializes the metadata and the given custom fields, in that order.
+  std::string serializeFieldDelta(const std::vector<int>& indices) const;
+  // Returns a revision with the metadata of delta, the listed custom fields of
+  // delta and the remaining custom fields of this revision, which are shared.
+  std::shared_ptr<Revision> applyFieldDelta(
+      const std::shared_ptr<const Revision>& delta,
+      const std::vector<int>& indices) const;
+  // Whether applyFieldDelta() accepts delta, e.g. if it was received from a
+  // peer whose schema differs.
+  bool isFieldDeltaApplicable(const Revision& delta,
+                              const std::vector<int>& indices) const;
 
   inline int customFieldCount() const {
     return underlying_revision_->custom_field_values_size();
@@ -216,7 +268,62 @@ class Revision {
   template <typename FieldType>
   bool get(const proto::TableField& field, FieldType* value) const;
 
+  // Custom field access that resolves shared and lazily parsed values.
+  // mutableCustomField() stops sharing the field and marks it as changed.
+  inline const proto::TableField& customField(int index) const {
+    if (!shared_fields_.empty() && shared_fields_[index]) {
+      return *shared_fields_[index];
+    }
+    if (lazy_fields_) {
+      return lazyCustomField(index);
+    }
+    return underlying_revision_->custom_field_values(index);
+  }
+  proto::TableField* mutableCustomField(int index);
+  // True if any custom field value is not held in underlying_revision_.
+  bool hasSharedFields() const;
+  // Returns a pointer to the value of the given field that may be shared with
+  // another revision.
+  std::shared_ptr<const proto::TableField> shareCustomField(int index) const;
+  // Must be called before custom fields of underlying_revision_ are modified.
+  void stopLendingCustomFields();
+  // Adds placeholders for the custom fields of source, which then hold the
+  // values shared with source. Expects no custom fields.
+  void shareCustomFieldsOf(const Revision& source);
+
+  class LazyCustomFields;
+  const proto::TableField& lazyCustomField(int index) const;
+  inline bool isLazyCustomField(int index) const {
+    return lazy_fields_ && (shared_fields_.empty() || !shared_fields_[index]);
+  }
+  // Decodes all remaining lazy fields and turns them into shared fields. Must
+  // be called before custom fields of underlying_revision_ are modified.
+  void resolveLazyCustomFields();
+
+  // HASH128 values are stored as two fixed64. Values in the hex string form
+  // of earlier versions can still be read.
+  static void setHash128(const map_api_common::HashId& value,
+                         proto::TableField* field);
+  static bool getHash128(const proto::TableField& field,
+                         map_api_common::HashId* value);
+
   std::shared_ptr<proto::Revision> underlying_revision_;
+  // If entry i is set, it holds the value of custom field i, which is shared
+  // with other revisions. The custom field in underlying_revision_ is then a
+  // placeholder that only holds the type. Empty if nothing is shared.
+  std::vector<std::shared_ptr<const proto::TableField> > shared_fields_;
+  // Only used if is_copy_.
+  std::vector<bool> changed_fields_;
+  bool is_copy_ = false;
+  // Whether custom fields of underlying_revision_ are shared with other
+  // revisions, in which case they may not be modified in place.
+  mutable std::atomic<bool> lends_custom_fields_{false};
+  // Revisions parsed from a string only decode the metadata up front. Their
+  // custom fields stay serialized here until first accessed, and are then
+  // decoded in place, releasing the serialized form. The custom fields of
+  // underlying_revision_ are placeholders, and every custom field that is not
+  // shared is lazy. Copies share the same lazy fields.
+  std::shared_ptr<LazyCustomFields> lazy_fields_;
 };
 
 /**
@@ -246,15 +353,22 @@ class Revision {
   MAP_API_REVISION_SET(TypeName);              \
   MAP_API_REVISION_GET(TypeName)
 
-#define MAP_API_REVISION_UNIQUE_ID(TypeName)                             \
-  MAP_API_TYPE_ENUM(TypeName, ::map_api::proto::Type::HASH128);             \
-  MAP_API_REVISION_SET(TypeName) {                                       \
-    CHECK_NOTNULL(field)->set_string_value(value.hexString());        \
-    return true;                                                      \
-  }                                                                   \
-  MAP_API_REVISION_GET(TypeName) {                                       \
-    return CHECK_NOTNULL(value)->fromHexString(field.string_value()); \
-  }                                                                   \
+#define MAP_API_REVISION_UNIQUE_ID(TypeName)                   \
+  MAP_API_TYPE_ENUM(TypeName, ::map_api::proto::Type::HASH128); \
+  MAP_API_REVISION_SET(TypeName) {                             \
+    map_api_common::HashId hash_id;                             \
+    value.toHashId(&hash_id);                                   \
+    setHash128(hash_id, CHECK_NOTNULL(field));                  \
+    return true;                                                \
+  }                                                             \
+  MAP_API_REVISION_GET(TypeName) {                             \
+    map_api_common::HashId hash_id;                             \
+    if (!getHash128(field, &hash_id)) {                         \
+      return false;                                             \
+    }                                                           \
+    CHECK_NOTNULL(value)->fromHashId(hash_id);                  \
+    return true;                                                \
+  }                                                             \
   extern void __FILE__##__LINE__(void)
 
 /**
@@ -22,12 +22,16 @@
 #ifndef MAP_API_STXXL_REVISION_STORE_H_
 #define MAP_API_STXXL_REVISION_STORE_H_
 
+#include <algorithm>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <vector>
 
+#include <glog/logging.h>
 #include <stxxl.h>
 
+#include "map-api/internal/worker-pool.h"
 #include "map-api/proto-stl-stream.h"
 #include "map-api/revision.h"
 
@@ -41,6 +45,16 @@ struct CRRevisionInformation {
   }
   LogicalTime insert_time_;
   map_api_common::Id chunk_id_;
+  // Shard of the revision store that holds the memory block.
+  size_t shard_ = 0u;
+
+  // Order of the underlying memory, for sequential access.
+  bool isStoredBefore(const CRRevisionInformation& other) const {
+    if (shard_ != other.shard_) {
+      return shard_ < other.shard_;
+    }
+    return memory_block_ < other.memory_block_;
+  }
 };
 struct CRURevisionInformation : public CRRevisionInformation {
   // Cache information which is frequently accessed.
@@ -54,54 +68,135 @@ struct CRURevisionInformation : public CRRevisionInformation {
 };
 
 static constexpr int kSTXXLDefaultBlockSize = 128;
+static constexpr unsigned kSTXXLDefaultCachePages = 4u;
 
-template <int BlockSize>
-class STXXLRevisionStore {
+// Allows to choose the STXXL cache configuration, which STXXL takes as
+// template parameters, at runtime, see createSTXXLRevisionStore().
+class STXXLRevisionStoreBase {
  public:
-  inline bool storeRevision(const Revision& revision,
-                            CRRevisionInformation* revision_info) {
-    CHECK_NOTNULL(revision_info);
+  virtual ~STXXLRevisionStoreBase() {}
+
+  virtual bool storeRevision(const Revision& revision,
+                             CRRevisionInformation* revision_info) = 0;
+  virtual bool retrieveRevision(
+      const CRRevisionInformation& revision_info,
+      std::shared_ptr<const Revision>* revision) const = 0;
+  // Retrieves many revisions at once, e.g. for range scans. The result is in
+  // the order of revision_infos. The revisions are allocated individually,
+  // since callers may keep any of them.
+  virtual bool retrieveRevisions(
+      const std::vector<const CRRevisionInformation*>& revision_infos,
+      std::vector<std::shared_ptr<const Revision>>* revisions) const = 0;
+  virtual size_t numShards() const = 0;
+};
+
+// Revisions are distributed over independent shards by item id, each with its
+// own STXXL vector, pager cache and lock, while all revisions of one item
+// share a shard. A batch retrieval reads the shards in parallel. CachePages
+// and Pager configure the cache of each shard, so the total amount of cached
+// pages is num_shards * CachePages.
+template <int BlockSize, unsigned CachePages = kSTXXLDefaultCachePages,
+          int Pager = stxxl::lru>
+class STXXLRevisionStore : public STXXLRevisionStoreBase {
+ public:
+  explicit STXXLRevisionStore(size_t num_shards = 1u) {
+    CHECK_GT(num_shards, 0u);
+    shards_.reserve(num_shards);
+    for (size_t i = 0u; i < num_shards; ++i) {
+      shards_.emplace_back(new Shard);
+    }
+  }
 
-    std::unique_lock<std::mutex> lock(mutex_);
+  virtual bool storeRevision(const Revision& revision,
+                             CRRevisionInformation* revision_info) override {
+    CHECK_NOTNULL(revision_info);
     revision_info->SetFromRevision(revision);
+    revision_info->shard_ =
+        revision.getId<map_api_common::Id>().hashToSizeT() % shards_.size();
+    Shard& shard = *shards_[revision_info->shard_];
+
+    std::unique_lock<std::mutex> lock(shard.mutex);
     STLContainerOutputStream<BlockSize, ContainerType> output_stream(
-        &proto_revision_pool_);
+        &shard.proto_revision_pool);
 
     MemoryBlockInformation& block_information = revision_info->memory_block_;
-    bool status = output_stream.WriteMessage(*revision.underlying_revision_,
-                                             &block_information);
-    return status;
+    if (revision.hasSharedFields()) {
+      proto::Revision complete_revision;
+      revision.copyUnderlyingTo(&complete_revision);
+      return output_stream.WriteMessage(complete_revision, &block_information);
+    }
+    return output_stream.WriteMessage(*revision.underlying_revision_,
+                                      &block_information);
   }
 
-  inline bool retrieveRevision(const CRRevisionInformation& revision_info,
-                               std::shared_ptr<const Revision>* revision)
-      const {
+  virtual bool retrieveRevision(const CRRevisionInformation& revision_info,
+                                std::shared_ptr<const Revision>* revision)
+      const override {
     CHECK_NOTNULL(revision);
-    std::unique_lock<std::mutex> lock(mutex_);
-    const MemoryBlockInformation& block_information =
-        revision_info.memory_block_;
+    CHECK_LT(revision_info.shard_, shards_.size());
+    const Shard& shard = *shards_[revision_info.shard_];
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    return retrieveRevisionLocked(shard, revision_info, revision);
+  }
 
-    STLContainerInputStream<BlockSize, ContainerType> input_stream(
-        block_information.block_index, block_information.byte_offset,
-        &proto_revision_pool_);
+  // Each shard is locked only once and read in ascending block order, so that
+  // the pager sees sequential access. Shards are read in parallel on the
+  // worker pool.
+  virtual bool retrieveRevisions(
+      const std::vector<const CRRevisionInformation*>& revision_infos,
+      std::vector<std::shared_ptr<const Revision>>* revisions) const override {
+    CHECK_NOTNULL(revisions)->clear();
+    revisions->resize(revision_infos.size());
+    std::vector<std::vector<size_t>> shard_requests(shards_.size());
+    for (size_t i = 0u; i < revision_infos.size(); ++i) {
+      const size_t shard = CHECK_NOTNULL(revision_infos[i])->shard_;
+      CHECK_LT(shard, shards_.size());
+      shard_requests[shard].push_back(i);
+    }
 
-    std::unique_ptr<proto::Revision> proto_in(new proto::Revision);
-    bool status = input_stream.ReadMessage(proto_in.get());
-    Revision::fromProto(std::move(proto_in), revision);
+    std::vector<char> shard_status(shards_.size(), true);
+    auto retrieve_shard = [&](size_t shard_index) {
+      std::vector<size_t>& requests = shard_requests[shard_index];
+      std::sort(requests.begin(), requests.end(), [&](size_t lhs, size_t rhs) {
+        return revision_infos[lhs]->memory_block_ <
+               revision_infos[rhs]->memory_block_;
+      });
+      const Shard& shard = *shards_[shard_index];
+      std::unique_lock<std::mutex> lock(shard.mutex);
+      for (size_t request : requests) {
+        if (!retrieveRevisionLocked(shard, *revision_infos[request],
+                                    &(*revisions)[request])) {
+          shard_status[shard_index] = false;
+        }
+      }
+    };
 
-    CHECK_EQ(revision_info.insert_time_, (*revision)->getInsertTime());
-    return status;
+    std::vector<size_t> involved_shards;
+    for (size_t i = 0u; i < shards_.size(); ++i) {
+      if (!shard_requests[i].empty()) {
+        involved_shards.push_back(i);
+      }
+    }
+    internal::WorkerPool::instance().parallelFor(
+        involved_shards.size(),
+        [&](size_t i) { retrieve_shard(involved_shards[i]); });
+    return std::all_of(shard_status.begin(), shard_status.end(),
+                       [](char status) { return status; });
   }
 
+  virtual size_t numShards() const override { return shards_.size(); }
+
  private:
-  template <typename ValueType, unsigned PageSize = 2, unsigned CachePages = 4,
+  template <typename ValueType, unsigned PageSize = 2,
+            unsigned CachePagesStxxl = CachePages,
             unsigned BlockSizeStxxl = 1024 * 1024,
             typename AllocStr = STXXL_DEFAULT_ALLOC_STRATEGY,
-            stxxl::pager_type Pager = stxxl::lru>
+            stxxl::pager_type PagerStxxl =
+                static_cast<stxxl::pager_type>(Pager)>
   struct VectorGenerator {
     typedef typename stxxl::IF<
-        Pager == stxxl::lru, stxxl::lru_pager<CachePages>,
-        stxxl::random_pager<CachePages> >::result PagerType;
+        PagerStxxl == stxxl::lru, stxxl::lru_pager<CachePagesStxxl>,
+        stxxl::random_pager<CachePagesStxxl> >::result PagerType;
 
     typedef stxxl::vector<ValueType, PageSize, PagerType, BlockSizeStxxl,
                           AllocStr> result;
@@ -109,8 +204,71 @@ class STXXLRevisionStore {
 
   template <class T, class A>
   using ContainerType = typename VectorGenerator<T>::result;
-  mutable MemoryBlockPool<BlockSize, ContainerType> proto_revision_pool_;
-  mutable std::mutex mutex_;
+
+  struct Shard {
+    // Even reads modify the pager state of the STXXL vector.
+    mutable MemoryBlockPool<BlockSize, ContainerType> proto_revision_pool;
+    mutable std::mutex mutex;
+  };
+
+  static inline bool retrieveRevisionLocked(
+      const Shard& shard, const CRRevisionInformation& revision_info,
+      std::shared_ptr<const Revision>* revision) {
+    const MemoryBlockInformation& block_information =
+        revision_info.memory_block_;
+
+    STLContainerInputStream<BlockSize, ContainerType> input_stream(
+        block_information.block_index, block_information.byte_offset,
+        &shard.proto_revision_pool);
+
+    // Parsing from the serialized form allows the custom fields to be decoded
+    // lazily.
+    std::string serialized_revision;
+    if (!input_stream.ReadSerializedMessage(&serialized_revision)) {
+      return false;
+    }
+    *revision = Revision::fromProtoString(serialized_revision);
+
+    CHECK_EQ(revision_info.insert_time_, (*revision)->getInsertTime());
+    return true;
+  }
+
+  std::vector<std::unique_ptr<Shard>> shards_;
 };
+
+// Instantiates the store for the given amount of cache pages per shard, which
+// must be a power of two up to 64, and pager, "lru" or "random".
+template <int BlockSize>
+std::unique_ptr<STXXLRevisionStoreBase> createSTXXLRevisionStore(
+    size_t num_shards, unsigned cache_pages, const std::string& pager) {
+  CHECK(pager == "lru" || pager == "random") << "Unknown STXXL pager "
+                                             << pager;
+  const bool lru = pager == "lru";
+  STXXLRevisionStoreBase* result = nullptr;
+  switch (cache_pages) {
+#define MAP_API_STXXL_STORE_CASE(pages)                                   \
+  case pages:                                                             \
+    if (lru) {                                                            \
+      result = new STXXLRevisionStore<BlockSize, pages, stxxl::lru>(      \
+          num_shards);                                                    \
+    } else {                                                              \
+      result = new STXXLRevisionStore<BlockSize, pages, stxxl::random>(   \
+          num_shards);                                                    \
+    }                                                                     \
+    break;
+    MAP_API_STXXL_STORE_CASE(1u)
+    MAP_API_STXXL_STORE_CASE(2u)
+    MAP_API_STXXL_STORE_CASE(4u)
+    MAP_API_STXXL_STORE_CASE(8u)
+    MAP_API_STXXL_STORE_CASE(16u)
+    MAP_API_STXXL_STORE_CASE(32u)
+    MAP_API_STXXL_STORE_CASE(64u)
+#undef MAP_API_STXXL_STORE_CASE
+    default:
+      LOG(FATAL) << "Unsupported amount of STXXL cache pages: " << cache_pages;
+  }
+  return std::unique_ptr<STXXLRevisionStoreBase>(result);
+}
+
 }  // namespace map_api
 #endif  // MAP_API_STXXL_REVISION_STORE_H_
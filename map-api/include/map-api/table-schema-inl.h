@@ -0,0 +1,113 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MAP_API_TABLE_SCHEMA_INL_H_
+#define MAP_API_TABLE_SCHEMA_INL_H_
+
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <glog/logging.h>
+#include <google/protobuf/message_lite.h>
+
+namespace map_api {
+
+template <typename... FieldTypes>
+constexpr int TableSchema<FieldTypes...>::kNumFields;
+
+template <typename... FieldTypes>
+void TableSchema<FieldTypes...>::addFields(TableDescriptor* descriptor) {
+  CHECK_NOTNULL(descriptor);
+  for (int i = 0; i < kNumFields; ++i) {
+    descriptor->addField(i, fieldTypes()[i]);
+  }
+}
+
+template <typename... FieldTypes>
+bool TableSchema<FieldTypes...>::matches(const Revision& revision) {
+  if (revision.customFieldCount() != kNumFields) {
+    return false;
+  }
+  for (int i = 0; i < kNumFields; ++i) {
+    if (revision.getFieldType(i) != fieldTypes()[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename... FieldTypes>
+template <int Index>
+bool TableSchema<FieldTypes...>::get(const Revision& revision,
+                                     FieldType<Index>* value) {
+  static_assert(Index >= 0 && Index < kNumFields, "Field index out of range");
+  CHECK_NOTNULL(value);
+  DCHECK(fieldMatches<Index>(revision));
+  return revision.get(revision.customField(Index), value);
+}
+
+template <typename... FieldTypes>
+template <int Index>
+bool TableSchema<FieldTypes...>::set(const FieldType<Index>& value,
+                                     Revision* revision) {
+  static_assert(Index >= 0 && Index < kNumFields, "Field index out of range");
+  CHECK_NOTNULL(revision);
+  DCHECK(fieldMatches<Index>(*revision));
+  return revision->set(revision->mutableCustomField(Index), value);
+}
+
+template <typename... FieldTypes>
+template <int Index>
+const std::string& TableSchema<FieldTypes...>::getBytes(
+    const Revision& revision) {
+  typedef FieldType<Index> Type;
+  static_assert(Index >= 0 && Index < kNumFields, "Field index out of range");
+  static_assert(std::is_same<Type, std::string>::value ||
+                    std::is_same<Type, Revision::Blob>::value ||
+                    std::is_base_of<google::protobuf::MessageLite, Type>::value,
+                "Only string, blob and protobuf fields are stored as bytes");
+  DCHECK(fieldMatches<Index>(revision));
+  const proto::TableField& field = revision.customField(Index);
+  if (std::is_same<FieldType<Index>, std::string>::value) {
+    return field.string_value();
+  }
+  DCHECK_EQ(field.type(), proto::Type::BLOB);
+  return field.blob_value();
+}
+
+template <typename... FieldTypes>
+const std::vector<proto::Type>& TableSchema<FieldTypes...>::fieldTypes() {
+  static const std::vector<proto::Type> kFieldTypes = {
+      Revision::getProtobufTypeEnum<FieldTypes>()...};
+  return kFieldTypes;
+}
+
+template <typename... FieldTypes>
+template <int Index>
+bool TableSchema<FieldTypes...>::fieldMatches(const Revision& revision) {
+  return Index < revision.customFieldCount() &&
+         revision.getFieldType(Index) == fieldTypes()[Index];
+}
+
+}  // namespace map_api
+
+#endif  // MAP_API_TABLE_SCHEMA_INL_H_
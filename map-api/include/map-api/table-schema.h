@@ -0,0 +1,87 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MAP_API_TABLE_SCHEMA_H_
+#define MAP_API_TABLE_SCHEMA_H_
+
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "map-api/revision.h"
+#include "map-api/table-descriptor.h"
+
+namespace map_api {
+
+/**
+ * Declares the custom fields of a table once, as a list of field types in
+ * field order, e.g.:
+ *
+ *   enum KeyframeFields { kName, kImage, kStatus };
+ *   typedef TableSchema<std::string, Revision::Blob, int32_t> KeyframeSchema;
+ *
+ *   KeyframeSchema::addFields(descriptor.get());
+ *   KeyframeSchema::set<kStatus>(1, revision.get());
+ *   const std::string& image = KeyframeSchema::getBytes<kImage>(*revision);
+ *
+ * Field types are resolved at compile time, so accesses skip the type checks
+ * of Revision::get() and Revision::set(). Instead, the structure of a revision
+ * is verified once with matches(), e.g. where it enters the application.
+ *
+ * The objectFromRevision() conversions of app-templates.h and ThreadsafeCache
+ * don't use this: they read a single protobuf field, which Revision::get()
+ * already parses from the stored bytes, so a schema would only save the type
+ * comparison.
+ */
+template <typename... FieldTypes>
+class TableSchema {
+ public:
+  static constexpr int kNumFields = sizeof...(FieldTypes);
+  template <int Index>
+  using FieldType =
+      typename std::tuple_element<Index, std::tuple<FieldTypes...> >::type;
+
+  static void addFields(TableDescriptor* descriptor);
+  // Returns true if the revision has exactly the fields of this schema.
+  static bool matches(const Revision& revision);
+
+  template <int Index>
+  static bool get(const Revision& revision, FieldType<Index>* value);
+  template <int Index>
+  static bool set(const FieldType<Index>& value, Revision* revision);
+
+  // Returns the stored bytes of a string or blob field, without copying. For
+  // protobuf-typed fields, this is the serialized message.
+  template <int Index>
+  static const std::string& getBytes(const Revision& revision);
+
+ private:
+  static const std::vector<proto::Type>& fieldTypes();
+  // Cheaper than matches(), for debug checks of single accesses.
+  template <int Index>
+  static bool fieldMatches(const Revision& revision);
+};
+
+}  // namespace map_api
+
+#include "./table-schema-inl.h"
+
+#endif  // MAP_API_TABLE_SCHEMA_H_
@@ -22,18 +22,23 @@
 #ifndef MAP_API_THREADSAFE_CACHE_H_
 #define MAP_API_THREADSAFE_CACHE_H_
 
+#include <memory>
 #include <string>
 #include <vector>
 
+#include <gflags/gflags.h>
 #include <gtest/gtest_prod.h>
 #include <map-api-common/mapped-container-base.h>
 #include <map-api-common/monitor.h>
 
 #include "map-api/cache-base.h"
 #include "map-api/internal/threadsafe-object-and-metadata-cache.h"
+#include "map-api/internal/worker-pool.h"
 #include "map-api/net-table.h"
 #include "map-api/transaction.h"
 
+DECLARE_bool(map_api_prefetch_cache);
+
 namespace map_api {
 
 // This is a threadsafe MappedContainerBase implementation intended for use by
@@ -56,13 +61,16 @@ class ThreadsafeCache : public map_api_common::MappedContainerBase<IdType, Objec
   virtual bool empty() const { return cache_.empty(); }
 
   virtual ObjectType& getMutable(const IdType& id) {
-    return cache_.getMutable(id).object;
+    return cache_.getMutable(id).mutableObject();
   }
 
+  // With a memory budget, the returned reference only remains valid until
+  // the next access that loads an object into the cache, see
+  // setMemoryBudget().
   virtual typename Base::ConstRefReturnType get(const IdType& id) const {
     const ObjectAndMetadata<ObjectType>& cached = cache_.get(id);
     CHECK(cached.metadata);
-    return cached.object;
+    return *cached.object;
   }
 
   virtual bool insert(const IdType& id, const ObjectType& value) {
@@ -106,16 +114,35 @@ class ThreadsafeCache : public map_api_common::MappedContainerBase<IdType, Objec
   // =============
   // OWN FUNCTIONS
   // =============
+  // Deserializes the objects of the given ids ahead of access, in parallel on
+  // the worker pool. Use this before touching many items, e.g. all vertices
+  // at optimizer startup.
+  void prefetch(const std::vector<IdType>& ids) {
+    cache_.prefetch(ids, &ThreadsafeCache::parallelFor);
+  }
+  void prefetchAll() { cache_.prefetchAll(&ThreadsafeCache::parallelFor); }
+
+  // Unlike the reference returned by get(), the returned object remains valid
+  // if it is evicted from a cache with memory budget.
+  std::shared_ptr<const ObjectType> getShared(const IdType& id) const {
+    const std::shared_ptr<const ObjectAndMetadata<ObjectType>> cached =
+        cache_.getShared(id);
+    CHECK(cached->metadata);
+    return std::shared_ptr<const ObjectType>(cached, cached->object.get());
+  }
+
   void getTrackedChunks(const IdType& id, TrackeeMultimap* result) const {
-    const ObjectAndMetadata<ObjectType>& object_metadata = cache_.get(id);
-    CHECK(object_metadata.metadata);
-    object_metadata.metadata->getTrackedChunks(CHECK_NOTNULL(result));
+    const std::shared_ptr<const ObjectAndMetadata<ObjectType>> object_metadata =
+        cache_.getShared(id);
+    CHECK(object_metadata->metadata);
+    object_metadata->metadata->getTrackedChunks(CHECK_NOTNULL(result));
   }
 
   // Add a function to determine whether updates should be applied back to the
   // cache (true = will be applied).
-  // Attention, this will be very expensive, since it will add two conversions
-  // per item! Prefer to use const correctness if possible.
+  // Attention, this will add two conversions per item that has changed since
+  // it was loaded! Items that are dirty but unchanged are skipped before this
+  // is called. Prefer to use const correctness if possible.
   void setUpdateFilter(
       const std::function<bool(const ObjectType& original,  // NOLINT
                                const ObjectType& innovation)>& update_filter) {
@@ -132,14 +159,45 @@ class ThreadsafeCache : public map_api_common::MappedContainerBase<IdType, Objec
     });
   }
 
+  // Evicts the least recently used unmodified objects once the cache exceeds
+  // "max_bytes", as measured by "object_size" plus the metadata size. Use this
+  // for transactions that visit more objects than fit into memory. Reads don't
+  // keep objects in the cache, so references returned by get() may be
+  // invalidated by any access that loads another object; hold on to objects
+  // with getShared() instead. Objects deserialized by such a cache are not
+  // published to the shared object cache, so that evicting them releases
+  // their memory.
+  void setMemoryBudget(
+      size_t max_bytes,
+      const std::function<size_t(const ObjectType& object)>& object_size) {
+    CHECK(object_size);
+    cache_.disableObjectSharing();
+    cache_.setMemoryBudget(max_bytes, [object_size](
+        const ObjectAndMetadata<ObjectType>& cached) {
+      CHECK(cached.object);
+      CHECK(cached.metadata);
+      return object_size(*cached.object) +
+             static_cast<size_t>(cached.metadata->byteSize());
+    });
+  }
+
  private:
   ThreadsafeCache(Transaction* const transaction, NetTable* const table)
       : table_(CHECK_NOTNULL(table)),
         chunk_manager_(kDefaultChunkSizeBytes, table),
         transaction_interface_(CHECK_NOTNULL(transaction), table,
                                &chunk_manager_),
-        cache_(&transaction_interface_),
-        insertions_(std::unordered_set<IdType>()) {}
+        cache_(&transaction_interface_, table->name()),
+        insertions_(std::unordered_set<IdType>()) {
+    if (FLAGS_map_api_prefetch_cache) {
+      prefetchAll();
+    }
+  }
+
+  static void parallelFor(size_t num_tasks,
+                          const std::function<void(size_t)>& function) {
+    internal::WorkerPool::instance().parallelFor(num_tasks, function);
+  }
 
   template <typename T>
   friend class CacheAndTransactionTest;
@@ -59,6 +59,15 @@ std::shared_ptr<const Revision> Transaction::getById(const IdType& id,
   return transactionOf(table)->getById(id, chunk);
 }
 
+template <typename IdType>
+void Transaction::getByIds(
+    const std::vector<IdType>& ids, NetTable* table,
+    std::vector<std::shared_ptr<const Revision>>* results) {
+  CHECK_NOTNULL(table);
+  CHECK_NOTNULL(results);
+  transactionOf(table)->getByIds(ids, results);
+}
+
 template <typename IdType>
 void Transaction::getAvailableIds(NetTable* table, std::vector<IdType>* ids) {
   return transactionOf(CHECK_NOTNULL(table))
@@ -77,9 +86,6 @@ void Transaction::fetchAllChunksTrackedBy(const IdType& id,
 
   CHECK(tracker->fetchTrackedChunks());
 
-  refreshIdToChunkIdMaps();
-  // Id to chunk id maps must be refreshed first, otherwise getAvailableIds will
-  // nor work.
   refreshAvailableIdsInCaches();
 }
 
@@ -25,6 +25,7 @@
 #include <future>
 #include <map>
 #include <memory>
+#include <set>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -44,10 +45,15 @@ class ConflictMap;
 class NetTable;
 template <typename IdType>
 class NetTableTransactionInterface;
+class ReadOnlyTransaction;
 class Revision;
 template <typename IdType, typename ObjectType>
 class ThreadsafeCache;
 
+namespace internal {
+class CommitFuture;
+}  // namespace internal
+
 namespace proto {
 class Revision;
 }  // namespace proto
@@ -80,6 +86,11 @@ class Transaction {
   // READ
   // ====
   inline LogicalTime getBeginTime() const { return begin_time_; }
+  // Begin time of the oldest transaction alive in this process, including
+  // read-only transactions, or the current time if there is none. Revisions
+  // superseded before that time can't be read by any transaction that is alive
+  // or begins at the current time.
+  static LogicalTime oldestActiveBeginTime();
   /**
    * By Id or chunk:
    * Use the overload with chunk specification to increase performance. Use
@@ -91,8 +102,27 @@ class Transaction {
   template <typename IdType>
   std::shared_ptr<const Revision> getById(const IdType& id, NetTable* table,
                                           ChunkBase* chunk) const;
+  /**
+   * Batched getById(): Ids are grouped by chunk, each chunk is read from only
+   * once, and different chunks are read in parallel. Use this to load many
+   * items at once. "results" are in the order of "ids", with null pointers
+   * for items that aren't available.
+   */
+  template <typename IdType>
+  void getByIds(const std::vector<IdType>& ids, NetTable* table,
+                std::vector<std::shared_ptr<const Revision>>* results);
   void dumpChunk(NetTable* table, ChunkBase* chunk, ConstRevisionMap* result);
   void dumpActiveChunks(NetTable* table, ConstRevisionMap* result);
+  /**
+   * Streaming alternatives to the above: "action" is called once per item
+   * visible to the transaction, without collecting the items in a map. Use
+   * these to read out large tables. "action" must not read from the table
+   * that is being iterated.
+   */
+  typedef ChunkTransaction::ItemAction ItemAction;
+  void forEachItemInChunk(NetTable* table, ChunkBase* chunk,
+                          const ItemAction& action);
+  void forEachItemInActiveChunks(NetTable* table, const ItemAction& action);
   template <typename IdType>
   void getAvailableIds(NetTable* table, std::vector<IdType>* ids);
   /**
@@ -177,11 +207,11 @@ class Transaction {
       NetTable* trackee_table, NetTable* tracker_table,
       const std::function<TrackerIdType(const Revision&)>&
           how_to_determine_tracker);
-  // The following must be called if chunks are fetched after the transaction
-  // has been initialized, otherwise the new items can't be fetched by the
-  // transaction.
-  void refreshIdToChunkIdMaps();
-  // Same, for the caches.
+  // Items of chunks that are fetched after the transaction has been initialized
+  // are found by the transaction right away, so this does nothing.
+  void refreshIdToChunkIdMaps() __attribute__((deprecated(
+      "Transactions find items of newly fetched chunks without refreshing.")));
+  // The following must however be called for caches to know about such items.
   void refreshAvailableIdsInCaches();
 
  private:
@@ -259,6 +289,16 @@ class Transaction {
   std::condition_variable cv_is_parallel_commit_running_;
 
   bool finalized_;
+
+  // Samples begin_time if it is invalid. Sampling and registration happen
+  // atomically, so no transaction can begin before a concurrently determined
+  // oldestActiveBeginTime().
+  static void registerActiveBeginTime(LogicalTime* begin_time);
+  static void unregisterActiveBeginTime(const LogicalTime& begin_time);
+  friend class ReadOnlyTransaction;
+  friend class internal::CommitFuture;
+  static std::multiset<LogicalTime> active_begin_times_;
+  static std::mutex active_begin_times_mutex_;
 };
 
 }  // namespace map_api
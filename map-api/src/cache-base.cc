@@ -27,6 +27,10 @@ DEFINE_bool(map_api_prefetch_cache, false,
             "Will prefetch the entire cache at construction.");
 DEFINE_bool(map_api_insert_into_existing_chunk, false,
             "Will insert into an existing chunk instead of creating one.");
+DEFINE_uint64(map_api_shared_object_cache_size, 1000u,
+              "Amount of deserialized objects per object type that are kept "
+              "for sharing between the caches of successive transactions. "
+              "0 disables sharing.");
 
 namespace map_api {
 
@@ -63,6 +63,17 @@ const ChunkDataContainerBase* ChunkBase::ConstDataAccess::operator->() const {
   return CHECK_NOTNULL(chunk_.data_container_.get());
 }
 
+ChunkBase::ScopedWriteLockAdoption::ScopedWriteLockAdoption(ChunkBase* chunk)
+    : chunk_(CHECK_NOTNULL(chunk)), previous_holder_(chunk->adoptWriteLock()) {}
+
+ChunkBase::ScopedWriteLockAdoption::~ScopedWriteLockAdoption() {
+  // The lock may have been released by the adopting thread, e.g. by an unlock
+  // task.
+  if (chunk_->isWriteLocked()) {
+    chunk_->handOverWriteLock(previous_holder_);
+  }
+}
+
 size_t ChunkBase::attachTrigger(const TriggerCallback& callback) {
   std::lock_guard<std::mutex> lock(trigger_mutex_);
   CHECK(callback);
@@ -19,8 +19,10 @@
 // You should have received a copy of the GNU General Public License
 // along with Map API. If not, see <http://www.gnu.org/licenses/>.
 
+#include <algorithm>
 #include <cstdio>
 #include <map>
+#include <vector>
 
 #include <glog/logging.h>
 #include <gflags/gflags.h>
@@ -31,6 +33,11 @@
 
 namespace map_api {
 
+namespace {
+// Bounds the revisions that forEachItem() holds at a time.
+constexpr size_t kForEachItemBatchSize = 1024u;
+}  // namespace
+
 ChunkDataContainerBase::ChunkDataContainerBase() : initialized_(false) {}
 
 ChunkDataContainerBase::~ChunkDataContainerBase() {}
@@ -59,7 +66,7 @@ void ChunkDataContainerBase::findByRevision(int key,
                                             const Revision& valueHolder,
                                             const LogicalTime& time,
                                             ConstRevisionMap* dest) const {
-  std::lock_guard<std::mutex> lock(access_mutex_);
+  map_api_common::ScopedReadLock lock(&access_mutex_);
   CHECK(isInitialized()) << "Attempted to find in non-initialized table";
   // whether valueHolder contains key is implicitly checked whenever using
   // Revision::insertPlaceHolder - for now it's a pretty safe bet that the
@@ -71,6 +78,51 @@ void ChunkDataContainerBase::findByRevision(int key,
   findByRevisionImpl(key, valueHolder, time, dest);
 }
 
+void ChunkDataContainerBase::forEachItem(const LogicalTime& time,
+                                         const ItemAction& action) const {
+  CHECK(action);
+  CHECK(time < LogicalTime::sample())
+      << "Seeing the future is yet to be implemented ;)";
+  std::vector<map_api_common::Id> ids;
+  {
+    map_api_common::ScopedReadLock lock(&access_mutex_);
+    CHECK(isInitialized()) << "Attempted to iterate non-initialized table";
+    getAvailableIdsImpl(time, &ids);
+  }
+  std::vector<std::shared_ptr<const Revision>> batch;
+  batch.reserve(std::min(kForEachItemBatchSize, ids.size()));
+  for (size_t begin = 0u; begin < ids.size();
+       begin += kForEachItemBatchSize) {
+    const size_t end = std::min(begin + kForEachItemBatchSize, ids.size());
+    batch.clear();
+    {
+      map_api_common::ScopedReadLock lock(&access_mutex_);
+      for (size_t i = begin; i < end; ++i) {
+        batch.emplace_back(getByIdImpl(ids[i], time));
+      }
+    }
+    for (size_t i = begin; i < end; ++i) {
+      // The history at "time" may have been compacted in the meantime.
+      if (batch[i - begin]) {
+        action(ids[i], batch[i - begin]);
+      }
+    }
+  }
+}
+
+void ChunkDataContainerBase::getByIds(
+    const std::vector<map_api_common::Id>& ids, const LogicalTime& time,
+    std::vector<std::shared_ptr<const Revision>>* results) const {
+  CHECK_NOTNULL(results)->clear();
+  results->reserve(ids.size());
+  map_api_common::ScopedReadLock lock(&access_mutex_);
+  CHECK(isInitialized()) << "Attempted to getByIds from non-initialized table";
+  for (const map_api_common::Id& id : ids) {
+    CHECK(id.isValid()) << "Supplied invalid ID";
+    results->push_back(getByIdImpl(id, time));
+  }
+}
+
 int ChunkDataContainerBase::numAvailableIds(const LogicalTime& time) const {
   return count(-1, 0, time);
 }
@@ -78,7 +130,7 @@ int ChunkDataContainerBase::numAvailableIds(const LogicalTime& time) const {
 int ChunkDataContainerBase::countByRevision(int key,
                                             const Revision& valueHolder,
                                             const LogicalTime& time) const {
-  std::lock_guard<std::mutex> lock(access_mutex_);
+  map_api_common::ScopedReadLock lock(&access_mutex_);
   CHECK(isInitialized()) << "Attempted to count items in non-initialized table";
   // Whether valueHolder contains key is implicitly checked whenever using
   // Revision::insertPlaceHolder - for now it's a pretty safe bet that the
@@ -29,6 +29,10 @@
 #include "map-api/internal/commit-future.h"
 #include "map-api/net-table.h"
 
+DEFINE_bool(map_api_optimistic_commit_check, true,
+            "Check for conflicts visible in the local chunk replicas before "
+            "acquiring the distributed write locks of a commit.");
+
 namespace map_api {
 
 ChunkTransaction::ChunkTransaction(ChunkBase* chunk, NetTable* table)
@@ -55,11 +59,21 @@ ChunkTransaction::ChunkTransaction(const LogicalTime& begin_time,
   CHECK(begin_time < LogicalTime::sample());
 }
 
+void ChunkTransaction::getByIds(
+    const std::vector<map_api_common::Id>& ids,
+    std::vector<std::shared_ptr<const Revision>>* results) const {
+  combined_view_.getMany(ids, CHECK_NOTNULL(results));
+}
+
 void ChunkTransaction::dumpChunk(ConstRevisionMap* result) const {
   CHECK_NOTNULL(result);
   combined_view_.dump(result);
 }
 
+void ChunkTransaction::forEachItem(const ItemAction& action) const {
+  combined_view_.forEach(action);
+}
+
 void ChunkTransaction::insert(std::shared_ptr<Revision> revision) {
   CHECK(!finalized_);
   CHECK_NOTNULL(revision.get());
@@ -82,6 +96,9 @@ void ChunkTransaction::remove(std::shared_ptr<Revision> revision) {
 }
 
 bool ChunkTransaction::commit() {
+  if (FLAGS_map_api_optimistic_commit_check && !hasNoVisibleConflicts()) {
+    return false;
+  }
   chunk_->writeLock();
   if (!hasNoConflicts()) {
     chunk_->unlock();
@@ -118,6 +135,40 @@ bool ChunkTransaction::hasNoConflicts() {
   return true;
 }
 
+bool ChunkTransaction::hasNoVisibleConflicts() const {
+  if (chunk_->getLatestCommitTime() <= begin_time_) {
+    return true;
+  }
+  // Only the items changed by this transaction can conflict, so there is no
+  // need to gather the update times of the entire chunk.
+  std::vector<map_api_common::Id> changed_ids;
+  delta_.getChangedIds(&changed_ids);
+  std::unordered_map<map_api_common::Id, LogicalTime> update_times;
+  {
+    const ChunkBase::ConstDataAccess data(*chunk_);
+    const LogicalTime now = LogicalTime::sample();
+    for (const map_api_common::Id& id : changed_ids) {
+      std::shared_ptr<const Revision> current = data->getById(id, now);
+      if (current) {
+        update_times.emplace(id, current->getUpdateTime());
+      }
+    }
+  }
+  view_before_delta_->discardKnownUpdates(&update_times);
+  if (update_times.empty()) {
+    return true;
+  }
+
+  internal::ChunkView current_view(*chunk_, LogicalTime::sample());
+  if (delta_.hasUnmergeableConflicts(update_times, *view_before_delta_,
+                                     current_view)) {
+    VLOG(4) << "Conflict visible before locking chunk " << chunk_->id()
+            << " of table " << table_->name();
+    return false;
+  }
+  return true;
+}
+
 void ChunkTransaction::checkedCommit(const LogicalTime& time) {
   delta_.checkedCommitLocked(time, chunk_, &commit_history_);
 }
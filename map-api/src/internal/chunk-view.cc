@@ -31,18 +31,26 @@ ChunkView::ChunkView(const ChunkBase& chunk, const LogicalTime& view_time)
 
 ChunkView::~ChunkView() {}
 
-bool ChunkView::has(const map_api_common::Id& id) const {
-  return static_cast<bool>(chunk_.constData()->getById(id, view_time_));
+bool ChunkView::tryGet(const map_api_common::Id& id,
+                       std::shared_ptr<const Revision>* result) const {
+  *CHECK_NOTNULL(result) = chunk_.constData()->getById(id, view_time_);
+  return static_cast<bool>(*result);
 }
 
-std::shared_ptr<const Revision> ChunkView::get(const map_api_common::Id& id) const {
-  return chunk_.constData()->getById(id, view_time_);
+void ChunkView::getMany(
+    const std::vector<map_api_common::Id>& ids,
+    std::vector<std::shared_ptr<const Revision>>* results) const {
+  chunk_.constData()->getByIds(ids, view_time_, results);
 }
 
 void ChunkView::dump(ConstRevisionMap* result) const {
   chunk_.constData()->dump(view_time_, result);
 }
 
+void ChunkView::forEach(const ItemAction& action) const {
+  chunk_.constData()->forEachItem(view_time_, action);
+}
+
 void ChunkView::getAvailableIds(std::unordered_set<map_api_common::Id>* result) const {
   CHECK_NOTNULL(result)->clear();
   std::vector<map_api_common::Id> id_vector;
@@ -21,6 +21,9 @@
 
 #include "map-api/internal/combined-view.h"
 
+#include <unordered_set>
+#include <vector>
+
 #include <glog/logging.h>
 
 #include "map-api/revision-map.h"
@@ -34,41 +37,68 @@ CombinedView::CombinedView(const std::unique_ptr<ViewBase>& complete_view,
 
 CombinedView::~CombinedView() {}
 
-bool CombinedView::has(const map_api_common::Id& id) const {
-  return override_view_.has(id) ||
-         (complete_view_->has(id) && !override_view_.suppresses(id));
+bool CombinedView::tryGet(const map_api_common::Id& id,
+                          std::shared_ptr<const Revision>* result) const {
+  CHECK_NOTNULL(result);
+  if (override_view_.tryGetOverride(id, result)) {
+    return static_cast<bool>(*result);
+  }
+  return complete_view_->tryGet(id, result);
 }
 
-std::shared_ptr<const Revision> CombinedView::get(const map_api_common::Id& id) const {
-  if (override_view_.has(id)) {
-    return override_view_.get(id);
-  } else {
-    if (complete_view_->has(id)) {
-      if (!override_view_.suppresses(id)) {
-        return complete_view_->get(id);
-      }
+void CombinedView::getMany(
+    const std::vector<map_api_common::Id>& ids,
+    std::vector<std::shared_ptr<const Revision>>* results) const {
+  CHECK_NOTNULL(results)->clear();
+  results->resize(ids.size());
+  // Ids that aren't decided by the override view are resolved by the complete
+  // view in one batch.
+  std::vector<map_api_common::Id> remaining_ids;
+  std::vector<size_t> remaining_indices;
+  for (size_t i = 0u; i < ids.size(); ++i) {
+    if (!override_view_.tryGetOverride(ids[i], &(*results)[i])) {
+      remaining_ids.push_back(ids[i]);
+      remaining_indices.push_back(i);
     }
   }
-
-  return std::shared_ptr<const Revision>();
+  if (remaining_ids.empty()) {
+    return;
+  }
+  std::vector<std::shared_ptr<const Revision>> remaining_results;
+  complete_view_->getMany(remaining_ids, &remaining_results);
+  CHECK_EQ(remaining_ids.size(), remaining_results.size());
+  for (size_t i = 0u; i < remaining_indices.size(); ++i) {
+    (*results)[remaining_indices[i]] = remaining_results[i];
+  }
 }
 
 void CombinedView::dump(ConstRevisionMap* result) const {
   CHECK_NOTNULL(result)->clear();
+  forEach([result](const map_api_common::Id& id,
+                   const std::shared_ptr<const Revision>& item) {
+    CHECK(result->emplace(id, item).second);
+  });
+}
 
-  ConstRevisionMap override_dump;
-  override_view_.dump(&override_dump);
-
-  complete_view_->dump(result);
-  for (ConstRevisionMap::iterator it = result->begin(); it != result->end();) {
-    if (override_view_.suppresses(it->first)) {
-      it = result->erase(it);
-    } else {
-      ++it;
+void CombinedView::forEach(const ItemAction& action) const {
+  CHECK(action);
+  // The override view is typically small, so its items and suppressed ids are
+  // collected up front. This way, the complete view can be streamed without
+  // consulting the override view (and thus possibly the same chunk) per item.
+  ConstRevisionMap override_items;
+  override_view_.dump(&override_items);
+  std::unordered_set<map_api_common::Id> suppressed_ids;
+  override_view_.getSuppressedIds(&suppressed_ids);
+
+  complete_view_->forEach([&](const map_api_common::Id& id,
+                              const std::shared_ptr<const Revision>& item) {
+    if (override_items.count(id) == 0u && suppressed_ids.count(id) == 0u) {
+      action(id, item);
     }
+  });
+  for (const ConstRevisionMap::value_type& item : override_items) {
+    action(item.first, item.second);
   }
-
-  result->insert(override_dump.begin(), override_dump.end());
 }
 
 void CombinedView::getAvailableIds(std::unordered_set<map_api_common::Id>* result)
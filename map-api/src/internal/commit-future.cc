@@ -21,50 +21,92 @@
 
 #include "map-api/internal/commit-future.h"
 
+#include <vector>
+
+#include "map-api/chunk-base.h"
+#include "map-api/chunk-data-container-base.h"
 #include "map-api/chunk-transaction.h"
+#include "map-api/internal/delta-view.h"
+#include "map-api/transaction.h"
 
 namespace map_api {
 namespace internal {
 
 CommitFuture::CommitFuture(
-    const ChunkTransaction& finalized_committing_transaction) {
+    const ChunkTransaction& finalized_committing_transaction)
+    : chunk_data_(finalized_committing_transaction.chunk_->data_container_),
+      delta_(new DeltaView(finalized_committing_transaction.delta_)) {
   CHECK(finalized_committing_transaction.finalized_)
       << "Base transaction of commit future must be finalized.";
-  const DeltaView& finalized_delta = finalized_committing_transaction.delta_;
-  std::unique_ptr<ViewBase> current_view(new ChunkView(
-      *finalized_committing_transaction.chunk_, LogicalTime::sample()));
-  CombinedView future_view(current_view, finalized_delta);
-  future_view.dump(&chunk_state_);
+  CHECK(finalized_committing_transaction.chunk_->isWriteLocked())
+      << "Commit futures must be created while the chunk is locked.";
+  CHECK(chunk_data_);
+  // An invalid view time is sampled in registerActiveBeginTime().
+  Transaction::registerActiveBeginTime(&view_time_);
 }
 
 CommitFuture::CommitFuture(const CommitFuture& other)
-    : chunk_state_(other.chunk_state_) {}
-
-CommitFuture::~CommitFuture() {}
+    : chunk_data_(other.chunk_data_),
+      view_time_(other.view_time_),
+      delta_(other.delta_) {
+  Transaction::registerActiveBeginTime(&view_time_);
+}
 
-bool CommitFuture::has(const map_api_common::Id& id) const {
-  return static_cast<bool>(get(id));
+CommitFuture::~CommitFuture() {
+  Transaction::unregisterActiveBeginTime(view_time_);
 }
 
-std::shared_ptr<const Revision> CommitFuture::get(const map_api_common::Id& id) const {
-  ConstRevisionMap::const_iterator found = chunk_state_.find(id);
-  if (found != chunk_state_.end()) {
-    return found->second;
-  } else {
-    return std::shared_ptr<const Revision>();
+bool CommitFuture::tryGet(const map_api_common::Id& id,
+                          std::shared_ptr<const Revision>* result) const {
+  CHECK_NOTNULL(result);
+  if (!delta_->tryGetOverride(id, result)) {
+    *result = chunk_data_->getById(id, view_time_);
   }
+  return static_cast<bool>(*result);
 }
 
 void CommitFuture::dump(ConstRevisionMap* result) const {
-  CHECK_NOTNULL(result)->insert(chunk_state_.begin(), chunk_state_.end());
+  CHECK_NOTNULL(result);
+  ConstRevisionMap chunk_state;
+  chunk_data_->dump(view_time_, &chunk_state);
+  for (const ConstRevisionMap::value_type& id_revision : chunk_state) {
+    if (!delta_->suppresses(id_revision.first)) {
+      result->insert(id_revision);
+    }
+  }
+  ConstRevisionMap delta_state;
+  delta_->dump(&delta_state);
+  for (const ConstRevisionMap::value_type& id_revision : delta_state) {
+    (*result)[id_revision.first] = id_revision.second;
+  }
+}
+
+void CommitFuture::forEach(const ItemAction& action) const {
+  CHECK(action);
+  chunk_data_->forEachItem(
+      view_time_, [this, &action](const map_api_common::Id& id,
+                                  const std::shared_ptr<const Revision>& item) {
+        std::shared_ptr<const Revision> override_item;
+        if (!delta_->tryGetOverride(id, &override_item)) {
+          action(id, item);
+        }
+      });
+  delta_->forEach(action);
 }
 
 void CommitFuture::getAvailableIds(std::unordered_set<map_api_common::Id>* result)
     const {
   CHECK_NOTNULL(result)->clear();
-  for (const ConstRevisionMap::value_type& id_revision : chunk_state_) {
-    result->emplace(id_revision.first);
+  std::vector<map_api_common::Id> chunk_ids;
+  chunk_data_->getAvailableIds(view_time_, &chunk_ids);
+  for (const map_api_common::Id& id : chunk_ids) {
+    if (!delta_->suppresses(id)) {
+      result->emplace(id);
+    }
   }
+  std::unordered_set<map_api_common::Id> delta_ids;
+  delta_->getAvailableIds(&delta_ids);
+  result->insert(delta_ids.begin(), delta_ids.end());
 }
 
 void CommitFuture::discardKnownUpdates(UpdateTimes* update_times) const {
@@ -33,21 +33,6 @@ CommitHistoryView::CommitHistoryView(const History& commit_history,
 
 CommitHistoryView::~CommitHistoryView() {}
 
-bool CommitHistoryView::has(const map_api_common::Id& id) const {
-  return static_cast<bool>(get(id));
-}
-
-std::shared_ptr<const Revision> CommitHistoryView::get(const map_api_common::Id& id)
-    const {
-  // Item could be deleted, so we need to attempt to get it.
-  History::const_iterator found = commit_history_.find(id);
-  if (found != commit_history_.end()) {
-    return chunk_.constData()->getById(id, found->second);
-  } else {
-    return std::shared_ptr<const Revision>();
-  }
-}
-
 void CommitHistoryView::dump(ConstRevisionMap* result) const {
   CHECK_NOTNULL(result)->clear();
   for (const History::value_type& history_item : commit_history_) {
@@ -58,6 +43,16 @@ void CommitHistoryView::dump(ConstRevisionMap* result) const {
   }
 }
 
+void CommitHistoryView::forEach(const ItemAction& action) const {
+  CHECK(action);
+  for (const History::value_type& history_item : commit_history_) {
+    std::shared_ptr<const Revision> item = get(history_item.first);
+    if (item) {
+      action(history_item.first, item);
+    }
+  }
+}
+
 void CommitHistoryView::getAvailableIds(std::unordered_set<map_api_common::Id>* result)
     const {
   CHECK_NOTNULL(result)->clear();
@@ -80,14 +75,27 @@ void CommitHistoryView::discardKnownUpdates(UpdateTimes* update_times) const {
   }
 }
 
-bool CommitHistoryView::suppresses(const map_api_common::Id& id) const {
+bool CommitHistoryView::tryGetOverride(
+    const map_api_common::Id& id,
+    std::shared_ptr<const Revision>* result) const {
+  CHECK_NOTNULL(result);
   History::const_iterator found = commit_history_.find(id);
-  if (found != commit_history_.end()) {
-    if (!chunk_.constData()->getById(id, found->second)) {
-      return true;
+  if (found == commit_history_.end()) {
+    return false;
+  }
+  // Item could be deleted, in which case it is suppressed.
+  *result = chunk_.constData()->getById(id, found->second);
+  return true;
+}
+
+void CommitHistoryView::getSuppressedIds(
+    std::unordered_set<map_api_common::Id>* result) const {
+  CHECK_NOTNULL(result)->clear();
+  for (const History::value_type& history_item : commit_history_) {
+    if (!chunk_.constData()->getById(history_item.first, history_item.second)) {
+      result->emplace(history_item.first);
     }
   }
-  return false;
 }
 
 }  // namespace internal
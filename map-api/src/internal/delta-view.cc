@@ -21,10 +21,14 @@
 
 #include "map-api/internal/delta-view.h"
 
+#include <atomic>
+#include <vector>
+
 #include <map-api-common/unique-id.h>
 
 #include "map-api/chunk-base.h"
 #include "map-api/conflicts.h"
+#include "map-api/internal/worker-pool.h"
 #include "map-api/net-table.h"
 
 DECLARE_bool(map_api_blame_updates);
@@ -36,23 +40,6 @@ DeltaView::DeltaView(const NetTable& table) : table_(table) {}
 
 DeltaView::~DeltaView() {}
 
-bool DeltaView::has(const map_api_common::Id& id) const {
-  return (updates_.count(id) != 0u || insertions_.count(id) != 0u) &&
-         removes_.count(id) == 0u;
-}
-
-std::shared_ptr<const Revision> DeltaView::get(const map_api_common::Id& id) const {
-  CHECK_EQ(removes_.count(id), 0u);
-  UpdateMap::const_iterator found = updates_.find(id);
-  if (found != updates_.end()) {
-    return std::const_pointer_cast<const Revision>(found->second);
-  } else {
-    InsertMap::const_iterator found = insertions_.find(id);
-    CHECK(found != insertions_.end());
-    return std::const_pointer_cast<const Revision>(found->second);
-  }
-}
-
 void DeltaView::dump(ConstRevisionMap* result) const {
   CHECK_NOTNULL(result)->clear();
   for (const InsertMap::value_type& item : insertions_) {
@@ -63,6 +50,16 @@ void DeltaView::dump(ConstRevisionMap* result) const {
   }
 }
 
+void DeltaView::forEach(const ItemAction& action) const {
+  CHECK(action);
+  for (const InsertMap::value_type& item : insertions_) {
+    action(item.first, item.second);
+  }
+  for (const UpdateMap::value_type& item : updates_) {
+    action(item.first, item.second);
+  }
+}
+
 void DeltaView::getAvailableIds(std::unordered_set<map_api_common::Id>* result) const {
   CHECK_NOTNULL(result)->clear();
   for (const InsertMap::value_type& item : insertions_) {
@@ -77,8 +74,33 @@ void DeltaView::discardKnownUpdates(UpdateTimes* update_times) const {
   LOG(FATAL) << "This function should never be called on a delta view!";
 }
 
-bool DeltaView::suppresses(const map_api_common::Id& id) const {
-  return removes_.count(id) != 0u;
+bool DeltaView::tryGetOverride(const map_api_common::Id& id,
+                               std::shared_ptr<const Revision>* result) const {
+  CHECK_NOTNULL(result);
+  // Ids are unique across the operation maps.
+  UpdateMap::const_iterator found_update = updates_.find(id);
+  if (found_update != updates_.end()) {
+    *result = found_update->second;
+    return true;
+  }
+  InsertMap::const_iterator found_insertion = insertions_.find(id);
+  if (found_insertion != insertions_.end()) {
+    *result = found_insertion->second;
+    return true;
+  }
+  if (removes_.count(id) != 0u) {
+    result->reset();
+    return true;
+  }
+  return false;
+}
+
+void DeltaView::getSuppressedIds(
+    std::unordered_set<map_api_common::Id>* result) const {
+  CHECK_NOTNULL(result)->clear();
+  for (const RemoveMap::value_type& item : removes_) {
+    result->emplace(item.first);
+  }
 }
 
 void DeltaView::insert(std::shared_ptr<Revision> revision) {
@@ -152,6 +174,47 @@ bool DeltaView::hasConflictsAfterTryingToMerge(
                            nullptr, nullptr);
 }
 
+bool DeltaView::hasUnmergeableConflicts(
+    const std::unordered_map<map_api_common::Id, LogicalTime>& potential_conflicts,
+    const ViewBase& original_view, const ViewBase& conflict_view) const {
+  for (const InsertMap::value_type& item : insertions_) {
+    if (potential_conflicts.count(item.first) != 0u) {
+      return true;
+    }
+  }
+  for (const RemoveMap::value_type& item : removes_) {
+    if (potential_conflicts.count(item.first) != 0u) {
+      return true;
+    }
+  }
+  std::vector<UpdateMap::value_type> merge_attempts;
+  for (const UpdateMap::value_type& item : updates_) {
+    if (potential_conflicts.count(item.first) != 0u) {
+      merge_attempts.emplace_back(item.first, nullptr);
+      CHECK_NOTNULL(item.second.get())
+          ->copyForWrite(&merge_attempts.back().second);
+    }
+  }
+  std::vector<UpdateMap::value_type*> to_merge;
+  to_merge.reserve(merge_attempts.size());
+  for (UpdateMap::value_type& merge_attempt : merge_attempts) {
+    to_merge.push_back(&merge_attempt);
+  }
+  return !tryAutoMergeAll(original_view, conflict_view, to_merge);
+}
+
+void DeltaView::getChangedIds(std::vector<map_api_common::Id>* result) const {
+  CHECK_NOTNULL(result)->clear();
+  result->reserve(numChanges());
+  for (const RevisionEventMap* event_map :
+       std::vector<const RevisionEventMap*>(
+           {&insertions_, &updates_, &removes_})) {
+    for (const RevisionEventMap::value_type& item : *event_map) {
+      result->push_back(item.first);
+    }
+  }
+}
+
 void DeltaView::checkedCommitLocked(
     const LogicalTime& commit_time, ChunkBase* locked_chunk,
     std::unordered_map<map_api_common::Id, LogicalTime>* commit_history) {
@@ -234,14 +297,14 @@ bool DeltaView::traverseConflicts(
     }
   }
 
+  // Auto-merging is deferred until the cheaper checks for insertion and
+  // removal conflicts have passed.
+  std::vector<UpdateMap::value_type*> to_merge;
   for (UpdateMap::value_type& item : updates_) {
     if (potential_conflicts.count(item.first) != 0u) {
       if (mode == ConflictTraversalMode::kTryMergeOrBail) {
         VLOG(4) << "Update conflict!";
-        VLOG(4) << "Trying to auto-merge...";
-        if (!tryAutoMerge(original_view, conflict_view, &item)) {
-          return true;
-        }
+        to_merge.push_back(&item);
       } else {
         CHECK(mode == ConflictTraversalMode::kPrepareManualMerge);
         conflicts->push_back({conflict_view.get(item.first), item.second});
@@ -269,24 +332,53 @@ bool DeltaView::traverseConflicts(
     }
   }
 
+  if (!to_merge.empty()) {
+    VLOG(4) << "Trying to auto-merge " << to_merge.size() << " updates...";
+    if (!tryAutoMergeAll(original_view, conflict_view, to_merge)) {
+      return true;
+    }
+  }
   return false;
 }
 
-bool DeltaView::tryAutoMerge(const ViewBase& original_view,
-                             const ViewBase& conflict_view,
-                             UpdateMap::value_type* item) const {
-  CHECK_NOTNULL(item);
-  std::shared_ptr<const Revision> conflicting_revision =
-      conflict_view.get(item->first);
-  std::shared_ptr<const Revision> original_revision =
-      original_view.get(item->first);
-  CHECK(conflicting_revision);
-  // Original revision must exist, since db_stamp > begin_time_ and the
-  // transaction wouldn't know about the item unless it existed before
-  // begin_time_.
-  CHECK(original_revision);
-  return item->second->tryAutoMerge(*conflicting_revision, *original_revision,
-                                    table_.getAutoMergePolicies());
+bool DeltaView::tryAutoMergeAll(
+    const ViewBase& original_view, const ViewBase& conflict_view,
+    const std::vector<UpdateMap::value_type*>& items) const {
+  // The views are read on the calling thread, as they may lock the chunk,
+  // whose write lock is held by the calling thread during commit.
+  std::vector<map_api_common::Id> ids;
+  ids.reserve(items.size());
+  for (const UpdateMap::value_type* item : items) {
+    ids.push_back(CHECK_NOTNULL(item)->first);
+  }
+  std::vector<std::shared_ptr<const Revision>> conflicting_revisions;
+  conflict_view.getMany(ids, &conflicting_revisions);
+  std::vector<std::shared_ptr<const Revision>> original_revisions;
+  original_view.getMany(ids, &original_revisions);
+  for (size_t i = 0u; i < ids.size(); ++i) {
+    CHECK(conflicting_revisions[i]);
+    // Original revision must exist, since db_stamp > begin_time_ and the
+    // transaction wouldn't know about the item unless it existed before
+    // begin_time_.
+    CHECK(original_revisions[i]);
+  }
+
+  // Only the merge policies, which are pure functions of the revisions, run
+  // in parallel.
+  const std::vector<Revision::AutoMergePolicy>& policies =
+      table_.getAutoMergePolicies();
+  std::atomic<bool> all_merged(true);
+  WorkerPool::instance().parallelFor(items.size(), [&](size_t i) {
+    if (!all_merged) {
+      return;
+    }
+    if (!items[i]->second->tryAutoMerge(*conflicting_revisions[i],
+                                        *original_revisions[i], policies)) {
+      VLOG(4) << "Can't auto-merge item " << items[i]->first;
+      all_merged = false;
+    }
+  });
+  return all_merged;
 }
 
 }  // namespace internal
@@ -21,10 +21,24 @@
 
 #include "map-api/internal/overriding-view-base.h"
 
+#include <glog/logging.h>
+#include <map-api-common/unique-id.h>
+
 namespace map_api {
 namespace internal {
 
 OverridingViewBase::~OverridingViewBase() {}
 
+bool OverridingViewBase::tryGet(const map_api_common::Id& id,
+                                std::shared_ptr<const Revision>* result) const {
+  CHECK_NOTNULL(result);
+  return tryGetOverride(id, result) && static_cast<bool>(*result);
+}
+
+bool OverridingViewBase::suppresses(const map_api_common::Id& id) const {
+  std::shared_ptr<const Revision> item;
+  return tryGetOverride(id, &item) && !item;
+}
+
 }  // namespace internal
 }  // namespace map_api
@@ -21,10 +21,35 @@
 
 #include "map-api/internal/view-base.h"
 
+#include <glog/logging.h>
+#include <map-api-common/unique-id.h>
+
 namespace map_api {
 namespace internal {
 
 ViewBase::~ViewBase() {}
 
+bool ViewBase::has(const map_api_common::Id& id) const {
+  std::shared_ptr<const Revision> item;
+  return tryGet(id, &item);
+}
+
+std::shared_ptr<const Revision> ViewBase::get(const map_api_common::Id& id)
+    const {
+  std::shared_ptr<const Revision> item;
+  tryGet(id, &item);
+  return item;
+}
+
+void ViewBase::getMany(
+    const std::vector<map_api_common::Id>& ids,
+    std::vector<std::shared_ptr<const Revision>>* results) const {
+  CHECK_NOTNULL(results)->clear();
+  results->resize(ids.size());
+  for (size_t i = 0u; i < ids.size(); ++i) {
+    tryGet(ids[i], &(*results)[i]);
+  }
+}
+
 }  // namespace internal
 }  // namespace map_api
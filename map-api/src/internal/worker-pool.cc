@@ -0,0 +1,142 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+#include "map-api/internal/worker-pool.h"
+
+#include <algorithm>
+#include <atomic>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+DEFINE_uint64(map_api_worker_threads, 8u,
+              "Number of threads for parallel commit work, which mostly waits "
+              "for chunk peers. 0 stands for the number of hardware threads.");
+
+namespace map_api {
+namespace internal {
+
+struct WorkerPool::Batch {
+  Batch(size_t _num_tasks, const std::function<void(size_t)>& _function)
+      : num_tasks(_num_tasks), function(_function) {}
+
+  const size_t num_tasks;
+  const std::function<void(size_t)>& function;  // NOLINT
+  std::atomic<size_t> next_task{0u};
+  size_t num_done = 0u;
+  std::mutex mutex;
+  std::condition_variable done;
+};
+
+WorkerPool::WorkerPool(size_t num_threads) {
+  threads_.reserve(num_threads);
+  for (size_t i = 0u; i < num_threads; ++i) {
+    threads_.emplace_back(&WorkerPool::workerThread, this);
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+WorkerPool& WorkerPool::instance() {
+  static WorkerPool pool(FLAGS_map_api_worker_threads != 0u
+                             ? FLAGS_map_api_worker_threads
+                             : std::max(1u, std::thread::hardware_concurrency()));
+  return pool;
+}
+
+void WorkerPool::parallelFor(size_t num_tasks,
+                             const std::function<void(size_t)>& function) {
+  if (num_tasks == 0u) {
+    return;
+  }
+  if (num_tasks == 1u || threads_.empty()) {
+    for (size_t i = 0u; i < num_tasks; ++i) {
+      function(i);
+    }
+    return;
+  }
+  std::shared_ptr<Batch> batch = std::make_shared<Batch>(num_tasks, function);
+  const size_t num_helpers = std::min(num_tasks - 1u, threads_.size());
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0u; i < num_helpers; ++i) {
+      queue_.push_back(batch);
+    }
+  }
+  if (num_helpers == threads_.size()) {
+    cv_.notify_all();
+  } else {
+    for (size_t i = 0u; i < num_helpers; ++i) {
+      cv_.notify_one();
+    }
+  }
+  work(batch.get());
+  std::unique_lock<std::mutex> lock(batch->mutex);
+  batch->done.wait(lock, [&batch]() {
+    return batch->num_done == batch->num_tasks;
+  });
+}
+
+void WorkerPool::work(Batch* batch) {
+  CHECK_NOTNULL(batch);
+  size_t num_done = 0u;
+  for (size_t task = batch->next_task++; task < batch->num_tasks;
+       task = batch->next_task++) {
+    batch->function(task);
+    ++num_done;
+  }
+  if (num_done == 0u) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(batch->mutex);
+  batch->num_done += num_done;
+  if (batch->num_done == batch->num_tasks) {
+    batch->done.notify_all();
+  }
+}
+
+void WorkerPool::workerThread() {
+  while (true) {
+    std::shared_ptr<Batch> batch;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+      if (stop_) {
+        return;
+      }
+      batch = queue_.front();
+      queue_.pop_front();
+    }
+    work(batch.get());
+  }
+}
+
+}  // namespace internal
+}  // namespace map_api
@@ -21,11 +21,20 @@
 
 #include "map-api/legacy-chunk-data-container-base.h"
 
+#include <algorithm>
+
+#include <gflags/gflags.h>
+
+DEFINE_double(map_api_history_compaction_min_dead_fraction, 0.5,
+              "Fraction of the data of an append-only chunk store that must "
+              "have been dropped by history compaction before the store is "
+              "rewritten to release it.");
+
 namespace map_api {
 
 bool LegacyChunkDataContainerBase::insert(
     const LogicalTime& time, const std::shared_ptr<Revision>& query) {
-  std::lock_guard<std::mutex> lock(access_mutex_);
+  map_api_common::ScopedWriteLock lock(&access_mutex_);
   CHECK(query.get() != nullptr);
   CHECK(isInitialized()) << "Attempted to insert into non-initialized table";
   std::shared_ptr<Revision> reference = getTemplate();
@@ -35,12 +44,19 @@ bool LegacyChunkDataContainerBase::insert(
       << "Attempted to insert element with invalid ID";
   query->setInsertTime(time);
   query->setUpdateTime(time);
-  return insertImpl(query);
+  if (!insertImpl(query)) {
+    return false;
+  }
+  if (item_listener_) {
+    item_listener_(std::vector<map_api_common::Id>(
+        1u, query->getId<map_api_common::Id>()));
+  }
+  return true;
 }
 
 bool LegacyChunkDataContainerBase::bulkInsert(const LogicalTime& time,
                                               const MutableRevisionMap& query) {
-  std::lock_guard<std::mutex> lock(access_mutex_);
+  map_api_common::ScopedWriteLock lock(&access_mutex_);
   CHECK(isInitialized()) << "Attempted to insert into non-initialized table";
   std::shared_ptr<Revision> reference = getTemplate();
   map_api_common::Id id;
@@ -54,19 +70,69 @@ bool LegacyChunkDataContainerBase::bulkInsert(const LogicalTime& time,
     id_revision.second->setInsertTime(time);
     id_revision.second->setUpdateTime(time);
   }
-  return bulkInsertImpl(query);
+  if (!bulkInsertImpl(query)) {
+    return false;
+  }
+  if (item_listener_) {
+    std::vector<map_api_common::Id> item_ids;
+    item_ids.reserve(query.size());
+    for (const typename MutableRevisionMap::value_type& id_revision : query) {
+      item_ids.emplace_back(id_revision.first);
+    }
+    item_listener_(item_ids);
+  }
+  return true;
 }
 
 bool LegacyChunkDataContainerBase::patch(
     const std::shared_ptr<const Revision>& query) {
-  std::lock_guard<std::mutex> lock(access_mutex_);
+  map_api_common::ScopedWriteLock lock(&access_mutex_);
   CHECK(query != nullptr);
   CHECK(isInitialized()) << "Attempted to insert into non-initialized table";
   std::shared_ptr<Revision> reference = getTemplate();
   CHECK(query->structureMatch(*reference)) << "Bad structure of patch revision";
   CHECK(query->getId<map_api_common::Id>().isValid())
       << "Attempted to insert element with invalid ID";
-  return patchImpl(query);
+  if (!patchImpl(query)) {
+    return false;
+  }
+  if (item_listener_) {
+    item_listener_(std::vector<map_api_common::Id>(
+        1u, query->getId<map_api_common::Id>()));
+  }
+  return true;
+}
+
+bool LegacyChunkDataContainerBase::bulkPatch(
+    std::vector<std::shared_ptr<const Revision> >* revisions) {
+  CHECK_NOTNULL(revisions);
+  map_api_common::ScopedWriteLock lock(&access_mutex_);
+  CHECK(isInitialized()) << "Attempted to insert into non-initialized table";
+  std::shared_ptr<Revision> reference = getTemplate();
+  for (const std::shared_ptr<const Revision>& revision : *revisions) {
+    CHECK(revision != nullptr);
+    CHECK(revision->structureMatch(*reference))
+        << "Bad structure of patch revision";
+    CHECK(revision->getId<map_api_common::Id>().isValid())
+        << "Attempted to insert element with invalid ID";
+  }
+  std::stable_sort(revisions->begin(), revisions->end(),
+                   [](const std::shared_ptr<const Revision>& lhs,
+                      const std::shared_ptr<const Revision>& rhs) {
+    return lhs->getUpdateTime() < rhs->getUpdateTime();
+  });
+  if (!bulkPatchImpl(*revisions)) {
+    return false;
+  }
+  if (item_listener_) {
+    std::vector<map_api_common::Id> item_ids;
+    item_ids.reserve(revisions->size());
+    for (const std::shared_ptr<const Revision>& revision : *revisions) {
+      item_ids.emplace_back(revision->getId<map_api_common::Id>());
+    }
+    item_listener_(item_ids);
+  }
+  return true;
 }
 
 LegacyChunkDataContainerBase::History::~History() {}
@@ -83,6 +149,7 @@ void LegacyChunkDataContainerBase::findHistoryByRevision(
 
 void LegacyChunkDataContainerBase::update(
     const LogicalTime& time, const std::shared_ptr<Revision>& query) {
+  map_api_common::ScopedWriteLock lock(&access_mutex_);
   CHECK(query != nullptr);
   CHECK(isInitialized()) << "Attempted to update in non-initialized table";
   std::shared_ptr<Revision> reference = getTemplate();
@@ -97,6 +164,7 @@ void LegacyChunkDataContainerBase::update(
 
 void LegacyChunkDataContainerBase::remove(
     const LogicalTime& time, const std::shared_ptr<Revision>& query) {
+  map_api_common::ScopedWriteLock lock(&access_mutex_);
   CHECK(query != nullptr);
   CHECK(isInitialized());
   std::shared_ptr<Revision> reference = getTemplate();
@@ -108,9 +176,29 @@ void LegacyChunkDataContainerBase::remove(
   CHECK(insertUpdatedImpl(query));
 }
 
+void LegacyChunkDataContainerBase::setItemListener(
+    const ItemListener& listener) {
+  map_api_common::ScopedWriteLock lock(&access_mutex_);
+  item_listener_ = listener;
+}
+
 void LegacyChunkDataContainerBase::clear() {
-  std::lock_guard<std::mutex> lock(access_mutex_);
+  map_api_common::ScopedWriteLock lock(&access_mutex_);
   clearImpl();
 }
 
+size_t LegacyChunkDataContainerBase::compact(const LogicalTime& watermark) {
+  map_api_common::ScopedWriteLock lock(&access_mutex_);
+  CHECK(isInitialized()) << "Attempted to compact non-initialized table";
+  CHECK(watermark.isValid());
+  return compactImpl(watermark);
+}
+
+bool LegacyChunkDataContainerBase::isWorthRewriting(size_t dead_amount,
+                                                    size_t total_amount) {
+  return dead_amount > 0u &&
+         dead_amount >= FLAGS_map_api_history_compaction_min_dead_fraction *
+                            total_amount;
+}
+
 }  // namespace map_api
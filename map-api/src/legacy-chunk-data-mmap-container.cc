@@ -0,0 +1,536 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+#include "map-api/legacy-chunk-data-mmap-container.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <libgen.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+
+namespace map_api {
+
+const char LegacyChunkDataMmapContainer::kSegmentMagic[] = "MAPAPISG";
+const char LegacyChunkDataMmapContainer::kSegmentFileExtension[] = ".segment";
+
+constexpr size_t kSegmentMagicSize =
+    sizeof(LegacyChunkDataMmapContainer::kSegmentMagic) - 1u;
+constexpr size_t kInitialSegmentSize = 1u << 20;
+
+LegacyChunkDataMmapContainer::LegacyChunkDataMmapContainer(
+    const std::string& segment_file)
+    : segment_file_(segment_file),
+      file_descriptor_(-1),
+      mapped_(nullptr),
+      mapped_size_(0u),
+      end_(0u),
+      dead_bytes_(0u) {}
+
+LegacyChunkDataMmapContainer::~LegacyChunkDataMmapContainer() {
+  closeSegment();
+}
+
+LogicalTime LegacyChunkDataMmapContainer::latestModificationTime() const {
+  map_api_common::ScopedReadLock lock(&access_mutex_);
+  return latest_modification_time_;
+}
+
+void LegacyChunkDataMmapContainer::removeSegment() {
+  map_api_common::ScopedWriteLock lock(&access_mutex_);
+  closeSegment();
+  data_.clear();
+  end_ = 0u;
+  dead_bytes_ = 0u;
+  CHECK(unlink(segment_file_.c_str()) == 0 || errno == ENOENT)
+      << "Couldn't delete " << segment_file_ << ": " << strerror(errno);
+}
+
+std::string LegacyChunkDataMmapContainer::segmentFileName(
+    const std::string& directory, const std::string& table_name,
+    const map_api_common::Id& chunk_id) {
+  return directory + "/" + segmentFilePrefix(table_name) +
+         chunk_id.hexString() + kSegmentFileExtension;
+}
+
+bool LegacyChunkDataMmapContainer::parseSegmentFileName(
+    const std::string& file_name, const std::string& table_name,
+    map_api_common::Id* chunk_id) {
+  CHECK_NOTNULL(chunk_id);
+  const std::string prefix = segmentFilePrefix(table_name);
+  const std::string extension(kSegmentFileExtension);
+  if (file_name.size() <= prefix.size() + extension.size() ||
+      file_name.compare(0u, prefix.size(), prefix) != 0 ||
+      file_name.compare(file_name.size() - extension.size(), extension.size(),
+                        extension) != 0) {
+    return false;
+  }
+  const std::string hex_string = file_name.substr(
+      prefix.size(), file_name.size() - prefix.size() - extension.size());
+  if (hex_string.find_first_not_of("0123456789abcdef") != std::string::npos) {
+    return false;
+  }
+  return chunk_id->fromHexString(hex_string);
+}
+
+bool LegacyChunkDataMmapContainer::initImpl() {
+  openSegment();
+  return true;
+}
+
+bool LegacyChunkDataMmapContainer::insertImpl(
+    const Revision::ConstPtr& query) {
+  CHECK(query != nullptr);
+  map_api_common::Id id = query->getId<map_api_common::Id>();
+  if (data_.find(id) != data_.end()) {
+    return false;
+  }
+  const size_t begin = end_;
+  SegmentRevisionInformation revision_information;
+  append(*query, &revision_information);
+  data_[id].push_front(revision_information);
+  sync(begin, end_);
+  return true;
+}
+
+bool LegacyChunkDataMmapContainer::bulkInsertImpl(
+    const MutableRevisionMap& query) {
+  for (const MutableRevisionMap::value_type& pair : query) {
+    if (data_.find(pair.first) != data_.end()) {
+      return false;
+    }
+  }
+  const size_t begin = end_;
+  for (const MutableRevisionMap::value_type& pair : query) {
+    SegmentRevisionInformation revision_information;
+    append(*pair.second, &revision_information);
+    data_[pair.first].push_front(revision_information);
+  }
+  sync(begin, end_);
+  return true;
+}
+
+bool LegacyChunkDataMmapContainer::patchImpl(const Revision::ConstPtr& query) {
+  const size_t begin = end_;
+  if (appendPatch(query)) {
+    sync(begin, end_);
+  }
+  return true;
+}
+
+bool LegacyChunkDataMmapContainer::bulkPatchImpl(
+    const std::vector<Revision::ConstPtr>& revisions) {
+  // Grow the segment at most once.
+  size_t required_size = end_;
+  for (const Revision::ConstPtr& revision : revisions) {
+    required_size += sizeof(uint32_t) + revision->byteSize();
+  }
+  reserve(required_size);
+  data_.reserve(data_.size() + revisions.size());
+  const size_t begin = end_;
+  for (const Revision::ConstPtr& revision : revisions) {
+    appendPatch(revision);
+  }
+  sync(begin, end_);
+  return true;
+}
+
+Revision::ConstPtr LegacyChunkDataMmapContainer::getByIdImpl(
+    const map_api_common::Id& id, const LogicalTime& time) const {
+  SegmentHistoryMap::const_iterator found = data_.find(id);
+  if (found == data_.end()) {
+    return Revision::ConstPtr();
+  }
+  SegmentHistory::const_iterator latest = found->second.latestAt(time);
+  if (latest == found->second.end() || latest->is_removed) {
+    return Revision::ConstPtr();
+  }
+  return read(*latest);
+}
+
+void LegacyChunkDataMmapContainer::findByRevisionImpl(
+    int key, const Revision& value_holder, const LogicalTime& time,
+    ConstRevisionMap* dest) const {
+  CHECK_NOTNULL(dest);
+  dest->clear();
+  forEachItemFoundAtTime(
+      key, value_holder, time,
+      [&dest](const map_api_common::Id& id, const Revision::ConstPtr& item) {
+        CHECK(dest->emplace(id, item).second);
+      });
+}
+
+void LegacyChunkDataMmapContainer::getAvailableIdsImpl(
+    const LogicalTime& time, std::vector<map_api_common::Id>* ids) const {
+  CHECK_NOTNULL(ids);
+  ids->clear();
+  std::vector<std::pair<size_t, map_api_common::Id>> offsets_and_ids;
+  offsets_and_ids.reserve(data_.size());
+  for (const SegmentHistoryMap::value_type& pair : data_) {
+    SegmentHistory::const_iterator latest = pair.second.latestAt(time);
+    if (latest != pair.second.cend() && !latest->is_removed) {
+      offsets_and_ids.emplace_back(latest->offset, pair.first);
+    }
+  }
+  // Sequential access to the segment for callers that read all ids in order.
+  std::sort(offsets_and_ids.begin(), offsets_and_ids.end(),
+            [](const std::pair<size_t, map_api_common::Id>& lhs,
+               const std::pair<size_t, map_api_common::Id>& rhs) {
+    return lhs.first < rhs.first;
+  });
+  ids->reserve(offsets_and_ids.size());
+  for (const std::pair<size_t, map_api_common::Id>& pair : offsets_and_ids) {
+    ids->emplace_back(pair.second);
+  }
+}
+
+int LegacyChunkDataMmapContainer::countByRevisionImpl(
+    int key, const Revision& value_holder, const LogicalTime& time) const {
+  int count = 0;
+  forEachItemFoundAtTime(
+      key, value_holder, time,
+      [&count](const map_api_common::Id& /*id*/,
+               const Revision::ConstPtr& /*item*/) { ++count; });
+  return count;
+}
+
+bool LegacyChunkDataMmapContainer::insertUpdatedImpl(
+    const std::shared_ptr<Revision>& query) {
+  return patchImpl(query);
+}
+
+void LegacyChunkDataMmapContainer::findHistoryByRevisionImpl(
+    int key, const Revision& valueHolder, const LogicalTime& time,
+    HistoryMap* dest) const {
+  CHECK_NOTNULL(dest);
+  dest->clear();
+  for (const SegmentHistoryMap::value_type& pair : data_) {
+    // using current state for filter
+    if (key < 0 ||
+        valueHolder.fieldMatch(*read(*pair.second.begin()), key)) {
+      readHistory(pair.second, time, &(*dest)[pair.first]);
+    }
+  }
+}
+
+void LegacyChunkDataMmapContainer::chunkHistory(
+    const map_api_common::Id& chunk_id, const LogicalTime& time,
+    HistoryMap* dest) const {
+  CHECK_NOTNULL(dest)->clear();
+  for (const SegmentHistoryMap::value_type& pair : data_) {
+    if (pair.second.begin()->chunk_id == chunk_id) {
+      readHistory(pair.second, time, &(*dest)[pair.first]);
+    }
+  }
+}
+
+void LegacyChunkDataMmapContainer::itemHistoryImpl(
+    const map_api_common::Id& id, const LogicalTime& time,
+    History* dest) const {
+  CHECK_NOTNULL(dest)->clear();
+  SegmentHistoryMap::const_iterator found = data_.find(id);
+  CHECK(found != data_.end());
+  readHistory(found->second, time, dest);
+}
+
+void LegacyChunkDataMmapContainer::clearImpl() {
+  data_.clear();
+  memset(mapped_ + kSegmentMagicSize, 0, end_ - kSegmentMagicSize);
+  sync(kSegmentMagicSize, end_);
+  end_ = kSegmentMagicSize;
+  dead_bytes_ = 0u;
+}
+
+size_t LegacyChunkDataMmapContainer::compactImpl(
+    const LogicalTime& watermark) {
+  std::vector<SegmentRevisionInformation> dropped;
+  const size_t num_dropped = trimHistories(
+      watermark,
+      [](const SegmentRevisionInformation& revision_information) {
+        return revision_information.update_time;
+      },
+      [](const SegmentRevisionInformation& revision_information) {
+        return revision_information.is_removed;
+      },
+      &data_, &dropped);
+  for (const SegmentRevisionInformation& revision_information : dropped) {
+    dead_bytes_ += sizeof(uint32_t) + revision_information.size;
+  }
+  // Rewriting blocks all access to the container, so it is only worth it once
+  // enough of the segment is dead.
+  if (!isWorthRewriting(dead_bytes_, end_ - kSegmentMagicSize)) {
+    return num_dropped;
+  }
+  // The segment is append-only, so the remaining records are copied to a
+  // fresh segment, which then atomically replaces the old one.
+  const std::string compacted_file = segment_file_ + ".compacting";
+  const int old_file_descriptor = file_descriptor_;
+  char* const old_mapped = mapped_;
+  const size_t old_mapped_size = mapped_size_;
+  file_descriptor_ =
+      open(compacted_file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  CHECK_GE(file_descriptor_, 0) << "Couldn't open " << compacted_file << ": "
+                                << strerror(errno);
+  mapped_ = nullptr;
+  mapped_size_ = 0u;
+  reserve(end_ - dead_bytes_);
+  memcpy(mapped_, kSegmentMagic, kSegmentMagicSize);
+  end_ = kSegmentMagicSize;
+  dead_bytes_ = 0u;
+  for (SegmentHistoryMap::value_type& pair : data_) {
+    for (SegmentRevisionInformation& revision_information : pair.second) {
+      reserve(end_ + sizeof(uint32_t) + revision_information.size);
+      memcpy(mapped_ + end_ + sizeof(uint32_t),
+             old_mapped + revision_information.offset,
+             revision_information.size);
+      memcpy(mapped_ + end_, &revision_information.size, sizeof(uint32_t));
+      revision_information.offset = end_ + sizeof(uint32_t);
+      end_ += sizeof(uint32_t) + revision_information.size;
+    }
+  }
+  // The compacted segment must be on disk before it replaces the old one.
+  sync(0u, end_);
+  CHECK_EQ(0, munmap(old_mapped, old_mapped_size));
+  CHECK_EQ(0, close(old_file_descriptor));
+  CHECK_EQ(0, rename(compacted_file.c_str(), segment_file_.c_str()))
+      << strerror(errno);
+  // Persists the rename itself.
+  std::string directory_name(segment_file_);
+  const int directory_descriptor =
+      open(dirname(&directory_name[0]), O_RDONLY | O_DIRECTORY);
+  CHECK_GE(directory_descriptor, 0) << strerror(errno);
+  CHECK_EQ(0, fsync(directory_descriptor)) << strerror(errno);
+  CHECK_EQ(0, close(directory_descriptor));
+  return num_dropped;
+}
+
+void LegacyChunkDataMmapContainer::openSegment() {
+  CHECK_EQ(-1, file_descriptor_);
+  file_descriptor_ = open(segment_file_.c_str(), O_RDWR | O_CREAT, 0644);
+  CHECK_GE(file_descriptor_, 0) << "Couldn't open " << segment_file_ << ": "
+                                << strerror(errno);
+  struct stat file_status;
+  CHECK_EQ(0, fstat(file_descriptor_, &file_status));
+  const size_t file_size = static_cast<size_t>(file_status.st_size);
+  reserve(std::max(file_size, kSegmentMagicSize));
+  if (file_size == 0u) {
+    memcpy(mapped_, kSegmentMagic, kSegmentMagicSize);
+    end_ = kSegmentMagicSize;
+    sync(0u, end_);
+  } else {
+    CHECK_EQ(0, memcmp(mapped_, kSegmentMagic, kSegmentMagicSize))
+        << segment_file_ << " is not a Map API segment file";
+    restoreIndex();
+  }
+}
+
+void LegacyChunkDataMmapContainer::closeSegment() {
+  if (mapped_ != nullptr) {
+    CHECK_EQ(0, munmap(mapped_, mapped_size_));
+    mapped_ = nullptr;
+    mapped_size_ = 0u;
+  }
+  if (file_descriptor_ >= 0) {
+    CHECK_EQ(0, close(file_descriptor_));
+    file_descriptor_ = -1;
+  }
+}
+
+void LegacyChunkDataMmapContainer::restoreIndex() {
+  data_.clear();
+  size_t position = kSegmentMagicSize;
+  size_t num_restored = 0u;
+  while (position + sizeof(uint32_t) <= mapped_size_) {
+    uint32_t size;
+    memcpy(&size, mapped_ + position, sizeof(uint32_t));
+    if (size == 0u) {
+      break;
+    }
+    std::unique_ptr<proto::Revision> revision_proto(new proto::Revision);
+    if (position + sizeof(uint32_t) + size > mapped_size_ ||
+        !revision_proto->ParseFromArray(mapped_ + position + sizeof(uint32_t),
+                                        size)) {
+      LOG(WARNING) << "Discarding truncated record at " << position << " of "
+                   << segment_file_;
+      memset(mapped_ + position, 0, mapped_size_ - position);
+      sync(position, mapped_size_);
+      break;
+    }
+    Revision::ConstPtr revision;
+    Revision::fromProto(std::move(revision_proto), &revision);
+    SegmentRevisionInformation revision_information;
+    revision_information.offset = position + sizeof(uint32_t);
+    revision_information.size = size;
+    revision_information.update_time = revision->getUpdateTime();
+    revision_information.is_removed = revision->isRemoved();
+    revision_information.chunk_id = revision->getChunkId();
+    insertIntoHistory(revision_information,
+                      &data_[revision->getId<map_api_common::Id>()]);
+    if (revision->getModificationTime() > latest_modification_time_) {
+      latest_modification_time_ = revision->getModificationTime();
+    }
+    // Logical time must advance past all restored data.
+    LogicalTime::synchronize(revision_information.update_time);
+    position += sizeof(uint32_t) + size;
+    ++num_restored;
+  }
+  end_ = position;
+  VLOG(3) << "Restored " << num_restored << " revisions of " << data_.size()
+          << " items from " << segment_file_;
+}
+
+void LegacyChunkDataMmapContainer::append(
+    const Revision& revision, SegmentRevisionInformation* info) {
+  CHECK_NOTNULL(info);
+  const uint32_t size = static_cast<uint32_t>(revision.byteSize());
+  CHECK_GT(size, 0u);
+  reserve(end_ + sizeof(uint32_t) + size);
+  google::protobuf::io::ArrayOutputStream array_stream(
+      mapped_ + end_ + sizeof(uint32_t), size);
+  google::protobuf::io::CodedOutputStream coded_stream(&array_stream);
+  CHECK(revision.SerializeToCodedStream(&coded_stream));
+  // The size is written last, so a partially written record reads as the end
+  // of the segment.
+  memcpy(mapped_ + end_, &size, sizeof(uint32_t));
+  info->offset = end_ + sizeof(uint32_t);
+  info->size = size;
+  info->update_time = revision.getUpdateTime();
+  info->is_removed = revision.isRemoved();
+  info->chunk_id = revision.getChunkId();
+  end_ += sizeof(uint32_t) + size;
+  if (revision.getModificationTime() > latest_modification_time_) {
+    latest_modification_time_ = revision.getModificationTime();
+  }
+}
+
+bool LegacyChunkDataMmapContainer::appendPatch(
+    const Revision::ConstPtr& query) {
+  CHECK(query != nullptr);
+  map_api_common::Id id = query->getId<map_api_common::Id>();
+  SegmentHistory& history = data_[id];
+  const LogicalTime time = query->getUpdateTime();
+  for (const SegmentRevisionInformation& revision_information : history) {
+    if (revision_information.update_time == time) {
+      // Already restored from the segment file, e.g. when a restarted peer
+      // receives the chunk again.
+      return false;
+    }
+  }
+  SegmentRevisionInformation revision_information;
+  append(*query, &revision_information);
+  insertIntoHistory(revision_information, &history);
+  return true;
+}
+
+void LegacyChunkDataMmapContainer::sync(size_t begin, size_t end) {
+  if (begin >= end) {
+    return;
+  }
+  // msync requires a page-aligned start address.
+  static const size_t kPageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  const size_t aligned_begin = begin - begin % kPageSize;
+  CHECK_EQ(0, msync(mapped_ + aligned_begin, end - aligned_begin, MS_SYNC))
+      << "Couldn't sync " << segment_file_ << ": " << strerror(errno);
+  // Persists the file size, which reserve() may have changed.
+  CHECK_EQ(0, fsync(file_descriptor_)) << strerror(errno);
+}
+
+void LegacyChunkDataMmapContainer::reserve(size_t required_size) {
+  if (required_size <= mapped_size_) {
+    return;
+  }
+  const size_t new_size =
+      std::max(std::max(2u * mapped_size_, required_size), kInitialSegmentSize);
+  CHECK_EQ(0, ftruncate(file_descriptor_, new_size)) << strerror(errno);
+  void* mapped = mmap(nullptr, new_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      file_descriptor_, 0);
+  CHECK(mapped != MAP_FAILED) << "Couldn't map " << segment_file_ << ": "
+                              << strerror(errno);
+  if (mapped_ != nullptr) {
+    CHECK_EQ(0, munmap(mapped_, mapped_size_));
+  }
+  mapped_ = static_cast<char*>(mapped);
+  mapped_size_ = new_size;
+}
+
+std::string LegacyChunkDataMmapContainer::segmentFilePrefix(
+    const std::string& table_name) {
+  return table_name + "_";
+}
+
+Revision::ConstPtr LegacyChunkDataMmapContainer::read(
+    const SegmentRevisionInformation& info) const {
+  CHECK_LE(info.offset + info.size, end_);
+  std::unique_ptr<proto::Revision> revision_proto(new proto::Revision);
+  CHECK(revision_proto->ParseFromArray(mapped_ + info.offset, info.size));
+  Revision::ConstPtr revision;
+  Revision::fromProto(std::move(revision_proto), &revision);
+  return revision;
+}
+
+void LegacyChunkDataMmapContainer::insertIntoHistory(
+    const SegmentRevisionInformation& info, SegmentHistory* history) {
+  CHECK_NOTNULL(history);
+  for (SegmentHistory::iterator it = history->begin(); it != history->end();
+       ++it) {
+    if (it->update_time <= info.update_time) {
+      CHECK_NE(info.update_time, it->update_time);
+      history->insert(it, info);
+      return;
+    }
+  }
+  history->push_back(info);
+}
+
+void LegacyChunkDataMmapContainer::readHistory(const SegmentHistory& history,
+                                               const LogicalTime& time,
+                                               History* dest) const {
+  CHECK_NOTNULL(dest)->clear();
+  for (const SegmentRevisionInformation& revision_information : history) {
+    if (revision_information.update_time <= time) {
+      dest->emplace_back(read(revision_information));
+    }
+  }
+}
+
+inline void LegacyChunkDataMmapContainer::forEachItemFoundAtTime(
+    int key, const Revision& value_holder, const LogicalTime& time,
+    const std::function<void(const map_api_common::Id& id,
+                             const Revision::ConstPtr& item)>& action) const {
+  for (const SegmentHistoryMap::value_type& pair : data_) {
+    SegmentHistory::const_iterator latest = pair.second.latestAt(time);
+    if (latest != pair.second.cend() && !latest->is_removed) {
+      Revision::ConstPtr revision = read(*latest);
+      if (key < 0 || value_holder.fieldMatch(*revision, key)) {
+        action(pair.first, revision);
+      }
+    }
+  }
+}
+
+}  // namespace map_api
@@ -72,6 +72,17 @@ bool LegacyChunkDataRamContainer::patchImpl(const Revision::ConstPtr& query) {
   return true;
 }
 
+bool LegacyChunkDataRamContainer::bulkPatchImpl(
+    const std::vector<Revision::ConstPtr>& revisions) {
+  data_.reserve(data_.size() + revisions.size());
+  for (const Revision::ConstPtr& revision : revisions) {
+    if (!patchImpl(revision)) {
+      return false;
+    }
+  }
+  return true;
+}
+
 Revision::ConstPtr LegacyChunkDataRamContainer::getByIdImpl(
     const map_api_common::Id& id, const LogicalTime& time) const {
   HistoryMap::const_iterator found = data_.find(id);
@@ -166,6 +177,16 @@ void LegacyChunkDataRamContainer::itemHistoryImpl(const map_api_common::Id& id,
 
 void LegacyChunkDataRamContainer::clearImpl() { data_.clear(); }
 
+size_t LegacyChunkDataRamContainer::compactImpl(const LogicalTime& watermark) {
+  return trimHistories(
+      watermark,
+      [](const Revision::ConstPtr& revision) {
+        return revision->getUpdateTime();
+      },
+      [](const Revision::ConstPtr& revision) { return revision->isRemoved(); },
+      &data_, nullptr);
+}
+
 inline void LegacyChunkDataRamContainer::forEachItemFoundAtTime(
     int key, const Revision& value_holder, const LogicalTime& time,
     const std::function<void(const map_api_common::Id& id,
@@ -21,10 +21,25 @@
 
 #include "map-api/legacy-chunk-data-stxxl-container.h"
 
+#include <gflags/gflags.h>
+
+DEFINE_uint64(map_api_stxxl_store_shards, 4u,
+              "Amount of shards of the STXXL revision store of each chunk. "
+              "Batch reads, e.g. of histories, read the shards in parallel, "
+              "but each shard brings its own page cache.");
+DEFINE_uint64(map_api_stxxl_cache_pages, map_api::kSTXXLDefaultCachePages,
+              "Pages cached by each shard of an STXXL revision store, a power "
+              "of two up to 64.");
+DEFINE_string(map_api_stxxl_pager, "lru",
+              "Page replacement policy of the STXXL revision stores, \"lru\" "
+              "or \"random\".");
+
 namespace map_api {
 
 LegacyChunkDataStxxlContainer::LegacyChunkDataStxxlContainer()
-    : revision_store_(new STXXLRevisionStore<kBlockSize>()) {}
+    : revision_store_(newRevisionStore(FLAGS_map_api_stxxl_store_shards)),
+      num_stored_revisions_(0u),
+      num_dead_revisions_(0u) {}
 
 LegacyChunkDataStxxlContainer::~LegacyChunkDataStxxlContainer() {}
 
@@ -39,7 +54,7 @@ bool LegacyChunkDataStxxlContainer::insertImpl(
     return false;
   }
   CRURevisionInformation revision_information;
-  CHECK(revision_store_->storeRevision(*query, &revision_information));
+  storeRevision(*query, &revision_information);
   data_[id].push_front(revision_information);
   return true;
 }
@@ -53,7 +68,7 @@ bool LegacyChunkDataStxxlContainer::bulkInsertImpl(
   }
   for (const MutableRevisionMap::value_type& pair : query) {
     CRURevisionInformation revision_information;
-    CHECK(revision_store_->storeRevision(*pair.second, &revision_information));
+    storeRevision(*pair.second, &revision_information);
     data_[pair.first].push_front(revision_information);
   }
   return true;
@@ -68,7 +83,7 @@ bool LegacyChunkDataStxxlContainer::patchImpl(const Revision::ConstPtr& query) {
     found = data_.insert(std::make_pair(id, STXXLHistory())).first;
   }
   CRURevisionInformation revision_information;
-  CHECK(revision_store_->storeRevision(*query, &revision_information));
+  storeRevision(*query, &revision_information);
   for (STXXLHistory::iterator it = found->second.begin();
        it != found->second.end(); ++it) {
     if (it->update_time_ <= time) {
@@ -82,6 +97,17 @@ bool LegacyChunkDataStxxlContainer::patchImpl(const Revision::ConstPtr& query) {
   return true;
 }
 
+bool LegacyChunkDataStxxlContainer::bulkPatchImpl(
+    const std::vector<Revision::ConstPtr>& revisions) {
+  data_.reserve(data_.size() + revisions.size());
+  for (const Revision::ConstPtr& revision : revisions) {
+    if (!patchImpl(revision)) {
+      return false;
+    }
+  }
+  return true;
+}
+
 Revision::ConstPtr LegacyChunkDataStxxlContainer::getByIdImpl(
     const map_api_common::Id& id, const LogicalTime& time) const {
   STXXLHistoryMap::const_iterator found = data_.find(id);
@@ -127,7 +153,7 @@ void LegacyChunkDataStxxlContainer::getAvailableIdsImpl(
   std::sort(ids_and_info.begin(), ids_and_info.end(),
             [](const std::pair<map_api_common::Id, CRURevisionInformation>& lhs,
                const std::pair<map_api_common::Id, CRURevisionInformation>& rhs) {
-    return lhs.second.memory_block_ < rhs.second.memory_block_;
+    return lhs.second.isStoredBefore(rhs.second);
   });
   ids->reserve(ids_and_info.size());
   for (const std::pair<map_api_common::Id, CRURevisionInformation>& pair :
@@ -156,41 +182,43 @@ void LegacyChunkDataStxxlContainer::findHistoryByRevisionImpl(
     HistoryMap* dest) const {
   CHECK_NOTNULL(dest);
   dest->clear();
-  for (const STXXLHistoryMap::value_type& pair : data_) {
+  std::vector<const STXXLHistoryMap::value_type*> matching_items;
+  matching_items.reserve(data_.size());
+  if (key < 0) {
+    for (const STXXLHistoryMap::value_type& pair : data_) {
+      matching_items.emplace_back(&pair);
+    }
+  } else {
     // using current state for filter
-    Revision::ConstPtr revision;
-    CHECK(revision_store_->retrieveRevision(*pair.second.begin(), &revision));
-    if (key < 0 || valueHolder.fieldMatch(*revision, key)) {
-      History history;
-      for (const CRURevisionInformation& revision_information : pair.second) {
-        Revision::ConstPtr history_entry;
-        CHECK(revision_store_->retrieveRevision(revision_information,
-                                                &history_entry));
-        history.emplace_back(history_entry);
+    std::vector<const CRRevisionInformation*> current_infos;
+    current_infos.reserve(data_.size());
+    for (const STXXLHistoryMap::value_type& pair : data_) {
+      current_infos.emplace_back(&*pair.second.begin());
+    }
+    std::vector<Revision::ConstPtr> current_revisions;
+    CHECK(revision_store_->retrieveRevisions(current_infos, &current_revisions));
+    size_t i = 0u;
+    for (const STXXLHistoryMap::value_type& pair : data_) {
+      if (valueHolder.fieldMatch(*current_revisions[i], key)) {
+        matching_items.emplace_back(&pair);
       }
-      CHECK(dest->emplace(pair.first, history).second);
+      ++i;
     }
   }
-  trimToTime(time, dest);
+  retrieveHistories(matching_items, time, dest);
 }
 
 void LegacyChunkDataStxxlContainer::chunkHistory(const map_api_common::Id& chunk_id,
                                                  const LogicalTime& time,
                                                  HistoryMap* dest) const {
   CHECK_NOTNULL(dest)->clear();
+  std::vector<const STXXLHistoryMap::value_type*> chunk_items;
   for (const STXXLHistoryMap::value_type& pair : data_) {
     if (pair.second.begin()->chunk_id_ == chunk_id) {
-      History history;
-      for (const CRURevisionInformation& revision_information : pair.second) {
-        Revision::ConstPtr history_entry;
-        CHECK(revision_store_->retrieveRevision(revision_information,
-                                                &history_entry));
-        history.emplace_back(history_entry);
-      }
-      CHECK(dest->emplace(std::make_pair(pair.first, history)).second);
+      chunk_items.emplace_back(&pair);
     }
   }
-  trimToTime(time, dest);
+  retrieveHistories(chunk_items, time, dest);
 }
 
 void LegacyChunkDataStxxlContainer::itemHistoryImpl(const map_api_common::Id& id,
@@ -199,37 +227,76 @@ void LegacyChunkDataStxxlContainer::itemHistoryImpl(const map_api_common::Id& id
   CHECK_NOTNULL(dest)->clear();
   STXXLHistoryMap::const_iterator found = data_.find(id);
   CHECK(found != data_.end());
-  History& history = *dest;
+  std::vector<const CRRevisionInformation*> revision_infos;
   for (const CRURevisionInformation& revision_information : found->second) {
-    Revision::ConstPtr history_entry;
-    CHECK(revision_store_->retrieveRevision(revision_information,
-                                            &history_entry));
-    history.emplace_back(history_entry);
+    if (revision_information.update_time_ <= time) {
+      revision_infos.emplace_back(&revision_information);
+    }
   }
-  dest->remove_if([&time](const Revision::ConstPtr& item) {
-    return item->getUpdateTime() > time;
-  });
+  std::vector<Revision::ConstPtr> revisions;
+  CHECK(revision_store_->retrieveRevisions(revision_infos, &revisions));
+  dest->insert(dest->end(), revisions.begin(), revisions.end());
 }
 
 void LegacyChunkDataStxxlContainer::clearImpl() {
   data_.clear();
-  revision_store_.reset(new STXXLRevisionStore<kBlockSize>());
+  revision_store_ = newRevisionStore(revision_store_->numShards());
+  num_stored_revisions_ = 0u;
+  num_dead_revisions_ = 0u;
+}
+
+size_t LegacyChunkDataStxxlContainer::compactImpl(
+    const LogicalTime& watermark) {
+  const size_t num_dropped = trimHistories(
+      watermark,
+      [](const CRURevisionInformation& revision_information) {
+        return revision_information.update_time_;
+      },
+      [](const CRURevisionInformation& revision_information) {
+        return revision_information.is_removed_;
+      },
+      &data_, nullptr);
+  num_dead_revisions_ += num_dropped;
+  if (!isWorthRewriting(num_dead_revisions_, num_stored_revisions_)) {
+    return num_dropped;
+  }
+  // The revision store only ever appends, so the space of dropped revisions
+  // can only be released by moving the remaining ones to a fresh store.
+  std::unique_ptr<STXXLRevisionStoreBase> old_store =
+      newRevisionStore(revision_store_->numShards());
+  old_store.swap(revision_store_);
+  num_stored_revisions_ = 0u;
+  num_dead_revisions_ = 0u;
+  for (STXXLHistoryMap::value_type& pair : data_) {
+    for (CRURevisionInformation& revision_information : pair.second) {
+      Revision::ConstPtr revision;
+      CHECK(old_store->retrieveRevision(revision_information, &revision));
+      storeRevision(*revision, &revision_information);
+    }
+  }
+  return num_dropped;
 }
 
 inline void LegacyChunkDataStxxlContainer::forEachItemFoundAtTime(
     int key, const Revision& value_holder, const LogicalTime& time,
     const std::function<void(const map_api_common::Id& id,
                              const Revision::ConstPtr& item)>& action) const {
+  std::vector<const map_api_common::Id*> ids;
+  std::vector<const CRRevisionInformation*> revision_infos;
+  ids.reserve(data_.size());
+  revision_infos.reserve(data_.size());
   for (const STXXLHistoryMap::value_type& pair : data_) {
     STXXLHistory::const_iterator latest = pair.second.latestAt(time);
-    if (latest != pair.second.cend()) {
-      Revision::ConstPtr revision;
-      CHECK(revision_store_->retrieveRevision(*latest, &revision));
-      if (key < 0 || value_holder.fieldMatch(*revision, key)) {
-        if (!revision->isRemoved()) {
-          action(pair.first, revision);
-        }
-      }
+    if (latest != pair.second.cend() && !latest->is_removed_) {
+      ids.emplace_back(&pair.first);
+      revision_infos.emplace_back(&*latest);
+    }
+  }
+  std::vector<Revision::ConstPtr> revisions;
+  CHECK(revision_store_->retrieveRevisions(revision_infos, &revisions));
+  for (size_t i = 0u; i < revisions.size(); ++i) {
+    if (key < 0 || value_holder.fieldMatch(*revisions[i], key)) {
+      action(*ids[i], revisions[i]);
     }
   }
 }
@@ -253,14 +320,45 @@ inline void LegacyChunkDataStxxlContainer::forChunkItemsAtTime(
   }
 }
 
-inline void LegacyChunkDataStxxlContainer::trimToTime(
-    const LogicalTime& time, HistoryMap* subject) const {
-  CHECK_NOTNULL(subject);
-  for (HistoryMap::value_type& pair : *subject) {
-    pair.second.remove_if([&time](const Revision::ConstPtr& item) {
-      return item->getUpdateTime() > time;
-    });
+inline void LegacyChunkDataStxxlContainer::retrieveHistories(
+    const std::vector<const STXXLHistoryMap::value_type*>& items,
+    const LogicalTime& time, HistoryMap* dest) const {
+  CHECK_NOTNULL(dest);
+  std::vector<const CRRevisionInformation*> revision_infos;
+  for (const STXXLHistoryMap::value_type* item : items) {
+    for (const CRURevisionInformation& revision_information : item->second) {
+      if (revision_information.update_time_ <= time) {
+        revision_infos.emplace_back(&revision_information);
+      }
+    }
+  }
+  std::vector<Revision::ConstPtr> revisions;
+  CHECK(revision_store_->retrieveRevisions(revision_infos, &revisions));
+  // Revisions are in the order of the histories, newest to oldest.
+  std::vector<Revision::ConstPtr>::const_iterator revision = revisions.begin();
+  for (const STXXLHistoryMap::value_type* item : items) {
+    History& history = (*dest)[item->first];
+    for (const CRURevisionInformation& revision_information : item->second) {
+      if (revision_information.update_time_ <= time) {
+        history.emplace_back(*revision);
+        ++revision;
+      }
+    }
   }
+  CHECK(revision == revisions.end());
+}
+
+void LegacyChunkDataStxxlContainer::storeRevision(
+    const Revision& revision, CRURevisionInformation* revision_information) {
+  CHECK(revision_store_->storeRevision(revision, revision_information));
+  ++num_stored_revisions_;
+}
+
+std::unique_ptr<STXXLRevisionStoreBase>
+LegacyChunkDataStxxlContainer::newRevisionStore(size_t num_shards) {
+  return createSTXXLRevisionStore<kBlockSize>(
+      num_shards, static_cast<unsigned>(FLAGS_map_api_stxxl_cache_pages),
+      FLAGS_map_api_stxxl_pager);
 }
 
 }  // namespace map_api
@@ -28,6 +28,7 @@
 
 #include "./core.pb.h"
 #include "./chunk.pb.h"
+#include "map-api/legacy-chunk-data-mmap-container.h"
 #include "map-api/legacy-chunk-data-ram-container.h"
 #include "map-api/legacy-chunk-data-stxxl-container.h"
 #include "map-api/hub.h"
@@ -36,6 +37,10 @@
 #include "map-api/revision-map.h"
 
 DEFINE_bool(use_external_memory, false, "STXXL vs. RAM data container.");
+DEFINE_string(map_api_chunk_segment_dir, "",
+              "If set, chunk data is kept in memory-mapped segment files in "
+              "this directory, which persist across restarts. Takes precedence "
+              "over --use_external_memory.");
 enum UnlockStrategy {
   REVERSE,
   FORWARD,
@@ -47,11 +52,16 @@ DEFINE_uint64(unlock_strategy, 2,
 DEFINE_bool(writelock_persist, true,
             "Enables more persisting write lock strategy");
 DEFINE_bool(map_api_time_chunk, false, "Toggle chunk timing.");
+DEFINE_bool(map_api_field_delta_updates, false,
+            "Only send the custom fields that differ from the previous "
+            "version of an item to the other chunk peers on update. Peers "
+            "that can't apply such an update are sent the whole item.");
 
 DECLARE_bool(blame_trigger);
 
 namespace map_api {
 
+const char LegacyChunk::kBulkInsertRequest[] = "map_api_chunk_bulk_insert";
 const char LegacyChunk::kConnectRequest[] = "map_api_chunk_connect";
 const char LegacyChunk::kInitRequest[] = "map_api_chunk_init_request";
 const char LegacyChunk::kInsertRequest[] = "map_api_chunk_insert";
@@ -60,8 +70,12 @@ const char LegacyChunk::kLockRequest[] = "map_api_chunk_lock_request";
 const char LegacyChunk::kNewPeerRequest[] = "map_api_chunk_new_peer_request";
 const char LegacyChunk::kUnlockRequest[] = "map_api_chunk_unlock_request";
 const char LegacyChunk::kUpdateRequest[] = "map_api_chunk_update_request";
+const char LegacyChunk::kNeedFullRevisionResponse[] =
+    "map_api_chunk_need_full_revision_response";
 
-MAP_API_PROTO_MESSAGE(LegacyChunk::kConnectRequest, proto::ChunkRequestMetadata);
+MAP_API_PROTO_MESSAGE(LegacyChunk::kBulkInsertRequest,
+                      proto::BulkPatchRequest);
+MAP_API_PROTO_MESSAGE(LegacyChunk::kConnectRequest, proto::ConnectRequest);
 MAP_API_PROTO_MESSAGE(LegacyChunk::kInitRequest, proto::InitRequest);
 MAP_API_PROTO_MESSAGE(LegacyChunk::kInsertRequest, proto::PatchRequest);
 MAP_API_PROTO_MESSAGE(LegacyChunk::kLeaveRequest, proto::ChunkRequestMetadata);
@@ -86,12 +100,23 @@ bool LegacyChunk::init(const map_api_common::Id& id,
                        bool initialize) {
   CHECK(descriptor);
   id_ = id;
-  if (FLAGS_use_external_memory) {
+  const bool persistent = !FLAGS_map_api_chunk_segment_dir.empty();
+  if (persistent) {
+    data_container_.reset(new LegacyChunkDataMmapContainer(
+        LegacyChunkDataMmapContainer::segmentFileName(
+            FLAGS_map_api_chunk_segment_dir, descriptor->name(), id)));
+  } else if (FLAGS_use_external_memory) {
     data_container_.reset(new LegacyChunkDataStxxlContainer);
   } else {
     data_container_.reset(new LegacyChunkDataRamContainer);
   }
   CHECK(data_container_->init(descriptor));
+  if (persistent) {
+    // The segment file may contain data from before a restart.
+    syncLatestCommitTime(
+        static_cast<LegacyChunkDataMmapContainer*>(data_container_.get())
+            ->latestModificationTime());
+  }
   if (initialize) {
     initialized_.notify();
   }
@@ -103,33 +128,52 @@ void LegacyChunk::initializeNewImpl(
   CHECK(init(id, descriptor, true));
 }
 
+LogicalTime LegacyChunk::restore(const map_api_common::Id& id,
+                                 std::shared_ptr<TableDescriptor> descriptor) {
+  CHECK(!FLAGS_map_api_chunk_segment_dir.empty());
+  CHECK(init(id, descriptor, false));
+  return latest_commit_time_;
+}
+
 bool LegacyChunk::init(const map_api_common::Id& id,
                        const proto::InitRequest& init_request,
                        const PeerId& sender,
                        std::shared_ptr<TableDescriptor> descriptor) {
-  CHECK(init(id, descriptor, false));
+  // A chunk prepared by restore() already holds its data container.
+  if (data_container_ == nullptr) {
+    CHECK(init(id, descriptor, false));
+  } else {
+    CHECK_EQ(id_, id);
+  }
   CHECK_GT(init_request.peer_address_size(), 0);
   for (int i = 0; i < init_request.peer_address_size(); ++i) {
     peers_.add(PeerId(init_request.peer_address(i)));
   }
   // feed data from connect_response into underlying table TODO(tcies) piecewise
+  // The revisions are kept by the chunk, so they are not parsed into a shared
+  // arena, which would stay alive as long as any of them.
+  std::vector<std::shared_ptr<const Revision> > revisions;
   for (int i = 0; i < init_request.serialized_items_size(); ++i) {
     proto::History history_proto;
     CHECK(history_proto.ParseFromString(init_request.serialized_items(i)));
     CHECK_GT(history_proto.revisions_size(), 0);
+    revisions.reserve(revisions.size() + history_proto.revisions_size());
     while (history_proto.revisions_size() > 0) {
       // using ReleaseLast allows zero-copy ownership transfer to the revision
       // object.
-      std::shared_ptr<Revision> data;
+      std::shared_ptr<const Revision> data;
       Revision::fromProto(std::unique_ptr<proto::Revision>(
                               history_proto.mutable_revisions()->ReleaseLast()),
                           &data);
-      CHECK(static_cast<LegacyChunkDataContainerBase*>(data_container_.get())
-                ->patch(data));
-      // TODO(tcies) guarantee order, then only sync latest time
-      syncLatestCommitTime(*data);
+      revisions.emplace_back(data);
     }
   }
+  if (!revisions.empty()) {
+    CHECK(static_cast<LegacyChunkDataContainerBase*>(data_container_.get())
+              ->bulkPatch(&revisions));
+    // bulkPatch() sorts by update time.
+    syncLatestCommitTime(*revisions.back());
+  }
   std::lock_guard<std::mutex> metalock(lock_.mutex);
   lock_.preempted_state = DistributedRWLock::State::UNLOCKED;
   lock_.state = DistributedRWLock::State::WRITE_LOCKED;
@@ -244,6 +288,8 @@ void LegacyChunk::leaveImpl() {
   distributedUnlock();  // i.e. must be able to handle unlocks from outside
   // the swarm. Should this pose problems in the future, we could tie unlocking
   // to leaving.
+  // A segment file is kept, so that a restarted peer only needs to fetch the
+  // revisions committed since, see NetTable::restorePersistedChunks().
 }
 
 void LegacyChunk::awaitShared() {
@@ -260,8 +306,28 @@ bool LegacyChunk::isWriteLocked() const {
   return isWriter(PeerId::self()) && lock_.thread == std::this_thread::get_id();
 }
 
+std::thread::id LegacyChunk::adoptWriteLock() {
+  std::lock_guard<std::mutex> metalock(lock_.mutex);
+  CHECK(isWriter(PeerId::self()));
+  const std::thread::id previous_holder = lock_.thread;
+  lock_.thread = std::this_thread::get_id();
+  return previous_holder;
+}
+
+void LegacyChunk::handOverWriteLock(const std::thread::id& thread) {
+  std::lock_guard<std::mutex> metalock(lock_.mutex);
+  CHECK(isWriter(PeerId::self()));
+  CHECK(lock_.thread == std::this_thread::get_id());
+  lock_.thread = thread;
+}
+
 void LegacyChunk::unlock() const { distributedUnlock(); }
 
+void LegacyChunk::setItemListener(const ItemListener& listener) {
+  static_cast<LegacyChunkDataContainerBase*>(data_container_.get())
+      ->setItemListener(listener);
+}
+
 // not expressing in terms of the peer-specifying overload in order to avoid
 // unnecessary distributed lock and unlocks
 int LegacyChunk::requestParticipation() {
@@ -280,7 +346,7 @@ int LegacyChunk::requestParticipation(const PeerId& peer) {
   std::set<PeerId> hub_peers;
   Hub::instance().getPeers(&hub_peers);
   if (peers_.peers().find(peer) == peers_.peers().end()) {
-    if (addPeer(peer)) {
+    if (addPeer(peer, LogicalTime())) {
       ++participant_count;
     }
   } else {
@@ -296,16 +362,16 @@ void LegacyChunk::update(const std::shared_ptr<Revision>& item) {
   CHECK_EQ(id(), item->getChunkId());
   proto::PatchRequest update_request;
   fillMetadata(&update_request);
-  Message request;
   distributedWriteLock();  // avoid adding of new peers while inserting
+  const LogicalTime time = LogicalTime::sample();
+  std::shared_ptr<const Revision> base = getUpdateBase(*item, time);
   static_cast<LegacyChunkDataContainerBase*>(data_container_.get())
-      ->update(LogicalTime::sample(), item);
+      ->update(time, item);
   // at this point, update() has modified the revision such that all default
   // fields are also set, which allows remote peers to just patch the revision
   // into their table.
-  update_request.set_serialized_revision(item->serializeUnderlying());
-  request.impose<kUpdateRequest>(update_request);
-  CHECK(peers_.undisputableBroadcast(&request));
+  fillUpdateRequest(base, *item, &update_request);
+  broadcastUpdateRequest(update_request, *item);
   syncLatestCommitTime(*item);
   distributedUnlock();
 }
@@ -317,32 +383,34 @@ LogicalTime LegacyChunk::getLatestCommitTime() const {
   return result;
 }
 
+size_t LegacyChunk::compactHistory(const LogicalTime& watermark) {
+  return static_cast<LegacyChunkDataContainerBase*>(data_container_.get())
+      ->compact(watermark);
+}
+
 void LegacyChunk::bulkInsertLocked(const MutableRevisionMap& items,
                                    const LogicalTime& time) {
-  std::vector<proto::PatchRequest> insert_requests;
-  insert_requests.resize(items.size());
-  int i = 0;
+  if (items.empty()) {
+    return;
+  }
   for (const MutableRevisionMap::value_type& item : items) {
     CHECK_NOTNULL(item.second.get());
     item.second->setChunkId(id());
-    fillMetadata(&insert_requests[i]);
-    ++i;
   }
-  Message request;
   static_cast<LegacyChunkDataContainerBase*>(data_container_.get())
       ->bulkInsert(time, items);
   // at this point, insert() has modified the revisions such that all default
-  // fields are also set, which allows remote peers to just patch the revision
+  // fields are also set, which allows remote peers to just patch the revisions
   // into their table.
-  i = 0;
-  for (const ConstRevisionMap::value_type& item : items) {
-    insert_requests[i]
-        .set_serialized_revision(item.second->serializeUnderlying());
-    request.impose<kInsertRequest>(insert_requests[i]);
-    CHECK(peers_.undisputableBroadcast(&request));
-    // TODO(tcies) also bulk this
-    ++i;
+  proto::BulkPatchRequest bulk_insert_request;
+  fillMetadata(&bulk_insert_request);
+  for (const MutableRevisionMap::value_type& item : items) {
+    bulk_insert_request.add_serialized_revisions(
+        item.second->serializeUnderlying());
   }
+  Message request;
+  request.impose<kBulkInsertRequest>(bulk_insert_request);
+  CHECK(peers_.undisputableBroadcast(&request));
 }
 
 void LegacyChunk::updateLocked(const LogicalTime& time,
@@ -353,15 +421,14 @@ void LegacyChunk::updateLocked(const LogicalTime& time,
       << item->getId<map_api_common::Id>();
   proto::PatchRequest update_request;
   fillMetadata(&update_request);
-  Message request;
+  std::shared_ptr<const Revision> base = getUpdateBase(*item, time);
   static_cast<LegacyChunkDataContainerBase*>(data_container_.get())
       ->update(time, item);
   // at this point, update() has modified the revision such that all default
   // fields are also set, which allows remote peers to just patch the revision
   // into their table.
-  update_request.set_serialized_revision(item->serializeUnderlying());
-  request.impose<kUpdateRequest>(update_request);
-  CHECK(peers_.undisputableBroadcast(&request));
+  fillUpdateRequest(base, *item, &update_request);
+  broadcastUpdateRequest(update_request, *item);
 }
 
 void LegacyChunk::removeLocked(const LogicalTime& time,
@@ -370,18 +437,70 @@ void LegacyChunk::removeLocked(const LogicalTime& time,
   CHECK_EQ(item->getChunkId(), id());
   proto::PatchRequest remove_request;
   fillMetadata(&remove_request);
-  Message request;
+  std::shared_ptr<const Revision> base = getUpdateBase(*item, time);
   static_cast<LegacyChunkDataContainerBase*>(data_container_.get())
       ->remove(time, item);
   // at this point, update() has modified the revision such that all default
   // fields are also set, which allows remote peers to just patch the revision
   // into their table.
-  remove_request.set_serialized_revision(item->serializeUnderlying());
-  request.impose<kUpdateRequest>(remove_request);
-  CHECK(peers_.undisputableBroadcast(&request));
+  fillUpdateRequest(base, *item, &remove_request);
+  broadcastUpdateRequest(remove_request, *item);
+}
+
+std::shared_ptr<const Revision> LegacyChunk::getUpdateBase(
+    const Revision& item, const LogicalTime& time) const {
+  if (!FLAGS_map_api_field_delta_updates) {
+    return std::shared_ptr<const Revision>();
+  }
+  return data_container_->getById(item.getId<map_api_common::Id>(), time);
 }
 
-bool LegacyChunk::addPeer(const PeerId& peer) {
+void LegacyChunk::fillUpdateRequest(const std::shared_ptr<const Revision>& base,
+                                    const Revision& item,
+                                    proto::PatchRequest* request) {
+  CHECK_NOTNULL(request);
+  if (base != nullptr && base->customFieldCount() == item.customFieldCount()) {
+    std::vector<int> changed_fields;
+    item.getCustomFieldsChangedFrom(*base, &changed_fields);
+    if (static_cast<int>(changed_fields.size()) < item.customFieldCount()) {
+      request->set_serialized_revision(
+          item.serializeFieldDelta(changed_fields));
+      request->set_base_update_time(base->getModificationTime().serialize());
+      for (int field : changed_fields) {
+        request->add_changed_fields(field);
+      }
+      return;
+    }
+  }
+  request->set_serialized_revision(item.serializeUnderlying());
+}
+
+void LegacyChunk::broadcastUpdateRequest(
+    const proto::PatchRequest& update_request, const Revision& item) {
+  Message request;
+  request.impose<kUpdateRequest>(update_request);
+  std::unordered_map<PeerId, Message> responses;
+  peers_.broadcast(&request, &responses);
+  Message full_request;
+  for (const std::pair<const PeerId, Message>& response : responses) {
+    if (!response.second.isType<kNeedFullRevisionResponse>()) {
+      CHECK(response.second.isOk()) << response.second.type();
+      continue;
+    }
+    CHECK(update_request.has_base_update_time());
+    if (!full_request.has_type()) {
+      proto::PatchRequest full_update_request;
+      fillMetadata(&full_update_request);
+      full_update_request.set_serialized_revision(item.serializeUnderlying());
+      full_request.impose<kUpdateRequest>(full_update_request);
+    }
+    Message full_response;
+    peers_.request(response.first, &full_request, &full_response);
+    CHECK(full_response.isOk()) << full_response.type();
+  }
+}
+
+bool LegacyChunk::addPeer(const PeerId& peer, const LogicalTime& known_until) {
   std::lock_guard<std::mutex> add_peer_lock(add_peer_mutex_);
   {
     std::lock_guard<std::mutex> metalock(lock_.mutex);
@@ -392,7 +511,7 @@ bool LegacyChunk::addPeer(const PeerId& peer) {
     LOG(FATAL) << "Peer already in swarm!";
     return false;
   }
-  prepareInitRequest(&request);
+  prepareInitRequest(known_until, &request);
   if (!Hub::instance().ackRequest(peer, &request)) {
     LOG(WARNING) << peer << " did not accept init request!";
     return false;
@@ -420,7 +539,7 @@ size_t LegacyChunk::addAllPeers() {
   Message request;
   proto::InitRequest init_request;
   fillMetadata(&init_request);
-  initRequestSetData(&init_request);
+  initRequestSetData(LogicalTime(), &init_request);
   proto::NewPeerRequest new_peer_request;
   fillMetadata(&new_peer_request);
 
@@ -674,19 +793,27 @@ bool LegacyChunk::isWriter(const PeerId& peer) const {
           lock_.holder == peer);
 }
 
-void LegacyChunk::initRequestSetData(proto::InitRequest* request) {
+void LegacyChunk::initRequestSetData(const LogicalTime& known_until,
+                                     proto::InitRequest* request) {
   CHECK_NOTNULL(request);
   LegacyChunkDataContainerBase::HistoryMap data;
   static_cast<LegacyChunkDataContainerBase*>(data_container_.get())
       ->chunkHistory(id(), LogicalTime::sample(), &data);
+  // Scratch histories are only needed for serialization.
+  google::protobuf::Arena arena;
   for (const LegacyChunkDataContainerBase::HistoryMap::value_type& data_pair :
        data) {
-    proto::History history_proto;
+    proto::History* history_proto =
+        google::protobuf::Arena::CreateMessage<proto::History>(&arena);
+    history_proto->mutable_revisions()->Reserve(data_pair.second.size());
     for (const std::shared_ptr<const Revision>& revision : data_pair.second) {
-      history_proto.mutable_revisions()->AddAllocated(
-          new proto::Revision(*revision->underlying_revision_));
+      if (revision->getUpdateTime() > known_until) {
+        revision->copyUnderlyingTo(history_proto->add_revisions());
+      }
+    }
+    if (history_proto->revisions_size() > 0) {
+      request->add_serialized_items(history_proto->SerializeAsString());
     }
-    request->add_serialized_items(history_proto.SerializeAsString());
   }
 }
 
@@ -699,16 +826,19 @@ void LegacyChunk::initRequestSetPeers(proto::InitRequest* request) {
   request->add_peer_address(PeerId::self().ipPort());
 }
 
-void LegacyChunk::prepareInitRequest(Message* request) {
+void LegacyChunk::prepareInitRequest(const LogicalTime& known_until,
+                                     Message* request) {
   CHECK_NOTNULL(request);
   proto::InitRequest init_request;
   fillMetadata(&init_request);
   initRequestSetPeers(&init_request);
-  initRequestSetData(&init_request);
+  initRequestSetData(known_until, &init_request);
   request->impose<kInitRequest, proto::InitRequest>(init_request);
 }
 
-void LegacyChunk::handleConnectRequest(const PeerId& peer, Message* response) {
+void LegacyChunk::handleConnectRequest(const PeerId& peer,
+                                       const LogicalTime& known_until,
+                                       Message* response) {
   awaitInitialized();
   VLOG(3) << "Received connect request from " << peer;
   CHECK_NOTNULL(response);
@@ -724,7 +854,8 @@ void LegacyChunk::handleConnectRequest(const PeerId& peer, Message* response) {
    * is locked, another peer will never succeed to unlock it because the
    * server thread of the RPC handler is busy.
    */
-  std::thread handle_thread(handleConnectRequestThread, this, peer);
+  std::thread handle_thread(handleConnectRequestThread, this, peer,
+                            known_until);
   handle_thread.detach();
 
   leave_lock_.releaseReadLock();
@@ -732,7 +863,8 @@ void LegacyChunk::handleConnectRequest(const PeerId& peer, Message* response) {
 }
 
 void LegacyChunk::handleConnectRequestThread(LegacyChunk* self,
-                                             const PeerId& peer) {
+                                             const PeerId& peer,
+                                             const LogicalTime& known_until) {
   self->awaitInitialized();
   CHECK_NOTNULL(self);
   self->leave_lock_.acquireReadLock();
@@ -746,7 +878,7 @@ void LegacyChunk::handleConnectRequestThread(LegacyChunk* self,
   self->distributedWriteLock();
   if (self->peers_.peers().find(peer) == self->peers_.peers().end()) {
     // Peer has no reason to refuse the init request.
-    CHECK(self->addPeer(peer));
+    CHECK(self->addPeer(peer, known_until));
   } else {
     LOG(INFO) << "Peer requesting to join already in swarm, could have been "
                  "added by some requestParticipation() call.";
@@ -788,6 +920,36 @@ void LegacyChunk::handleInsertRequest(const std::shared_ptr<Revision>& item,
   handleCommitInsert(id);
 }
 
+void LegacyChunk::handleBulkInsertRequest(
+    std::vector<std::shared_ptr<const Revision> >* items, Message* response) {
+  CHECK_NOTNULL(items);
+  CHECK_NOTNULL(response);
+  awaitInitialized();
+  leave_lock_.acquireReadLock();
+  if (relinquished_) {
+    leave_lock_.releaseReadLock();
+    response->decline();
+    return;
+  }
+  // Same locking considerations as for single inserts apply.
+  {
+    std::lock_guard<std::mutex> metalock(lock_.mutex);
+    CHECK(!isWriter(PeerId::self()));
+  }
+  if (!items->empty()) {
+    CHECK(static_cast<LegacyChunkDataContainerBase*>(data_container_.get())
+              ->bulkPatch(items));
+    // bulkPatch() sorts by update time.
+    syncLatestCommitTime(*items->back());
+  }
+  response->ack();
+  leave_lock_.releaseReadLock();
+
+  for (const std::shared_ptr<const Revision>& item : *items) {
+    handleCommitInsert(item->getId<map_api_common::Id>());
+  }
+}
+
 void LegacyChunk::handleLeaveRequest(const PeerId& leaver, Message* response) {
   CHECK_NOTNULL(response);
   awaitInitialized();
@@ -910,6 +1072,32 @@ void LegacyChunk::handleUpdateRequest(const std::shared_ptr<Revision>& item,
   handleCommitUpdate(id);
 }
 
+void LegacyChunk::handleFieldDeltaUpdateRequest(
+    const proto::PatchRequest& request, const PeerId& sender,
+    Message* response) {
+  CHECK(request.has_base_update_time());
+  CHECK_NOTNULL(response);
+  awaitInitialized();
+  std::shared_ptr<const Revision> delta =
+      Revision::fromProtoString(request.serialized_revision());
+  const map_api_common::Id item_id = delta->getId<map_api_common::Id>();
+  // The writer holds the chunk lock, so the base can't change concurrently.
+  std::shared_ptr<const Revision> base =
+      data_container_->getById(item_id, LogicalTime::sample());
+  const std::vector<int> changed_fields(request.changed_fields().begin(),
+                                        request.changed_fields().end());
+  if (base == nullptr ||
+      base->getModificationTime() != LogicalTime(request.base_update_time()) ||
+      !base->isFieldDeltaApplicable(*delta, changed_fields)) {
+    VLOG(3) << "Can't apply field delta of item " << item_id << " from "
+            << sender << ", requesting whole item";
+    response->impose<kNeedFullRevisionResponse>();
+    return;
+  }
+  handleUpdateRequest(base->applyFieldDelta(delta, changed_fields), sender,
+                      response);
+}
+
 void LegacyChunk::awaitInitialized() const { initialized_.wait(); }
 
 void LegacyChunk::startState(LockState new_state) const {
@@ -28,6 +28,7 @@
 #include "map-api/hub.h"
 #include "map-api/legacy-chunk.h"
 #include "map-api/revision.h"
+#include "map-api/transaction.h"
 #include "./net-table.pb.h"
 
 namespace map_api {
@@ -68,6 +69,8 @@ bool NetTableManager::getTableForRequestWithMetadataOrDecline<
 
 void NetTableManager::registerHandlers() {
   // Chunk requests.
+  Hub::instance().registerHandler(LegacyChunk::kBulkInsertRequest,
+                                  handleBulkInsertRequest);
   Hub::instance().registerHandler(LegacyChunk::kConnectRequest,
                                   handleConnectRequest);
   Hub::instance().registerHandler(LegacyChunk::kInitRequest, handleInitRequest);
@@ -90,6 +93,8 @@ void NetTableManager::registerHandlers() {
                                   handleAnnounceToListenersRequest);
   Hub::instance().registerHandler(SpatialIndex::kTriggerRequest,
                                   handleSpatialTriggerNotification);
+  Hub::instance().registerHandler(NetTable::kOldestActiveBeginTimeRequest,
+                                  handleOldestActiveBeginTimeRequest);
 
   // Chord requests.
   Hub::instance().registerHandler(NetTableIndex::kRoutedChordRequest,
@@ -350,10 +355,10 @@ bool NetTableManager::Iterator::operator!=(const Iterator& other) const {
 void NetTableManager::handleConnectRequest(const Message& request,
                                            Message* response) {
   CHECK_NOTNULL(response);
-  proto::ChunkRequestMetadata metadata;
-  request.extract<LegacyChunk::kConnectRequest>(&metadata);
-  const std::string& table = metadata.table();
-  map_api_common::Id chunk_id(metadata.chunk_id());
+  proto::ConnectRequest connect_request;
+  request.extract<LegacyChunk::kConnectRequest>(&connect_request);
+  const std::string& table = connect_request.metadata().table();
+  map_api_common::Id chunk_id(connect_request.metadata().chunk_id());
   CHECK_NOTNULL(Core::instance());
   map_api_common::ScopedReadLock lock(&instance().tables_lock_);
   std::unordered_map<std::string, std::unique_ptr<NetTable> >::iterator found =
@@ -362,8 +367,27 @@ void NetTableManager::handleConnectRequest(const Message& request,
     response->impose<Message::kDecline>();
     return;
   }
-  found->second->handleConnectRequest(chunk_id, PeerId(request.sender()),
-                                      response);
+  found->second->handleConnectRequest(
+      chunk_id, PeerId(request.sender()),
+      LogicalTime(connect_request.known_until()), response);
+}
+
+void NetTableManager::handleBulkInsertRequest(const Message& request,
+                                              Message* response) {
+  proto::BulkPatchRequest bulk_patch_request;
+  request.extract<LegacyChunk::kBulkInsertRequest>(&bulk_patch_request);
+  TableMap::iterator found;
+  if (getTableForRequestWithMetadataOrDecline(bulk_patch_request, response,
+                                              &found)) {
+    map_api_common::Id chunk_id(bulk_patch_request.metadata().chunk_id());
+    std::vector<std::shared_ptr<const Revision> > to_insert;
+    to_insert.reserve(bulk_patch_request.serialized_revisions_size());
+    for (const std::string& serialized_revision :
+         bulk_patch_request.serialized_revisions()) {
+      to_insert.emplace_back(Revision::fromProtoString(serialized_revision));
+    }
+    found->second->handleBulkInsertRequest(chunk_id, &to_insert, response);
+  }
 }
 
 void NetTableManager::handleInitRequest(const Message& request,
@@ -445,9 +469,14 @@ void NetTableManager::handleUpdateRequest(const Message& request,
   if (getTableForRequestWithMetadataOrDecline(patch_request, response,
                                               &found)) {
     map_api_common::Id chunk_id(patch_request.metadata().chunk_id());
+    PeerId sender(request.sender());
+    if (patch_request.has_base_update_time()) {
+      found->second->handleFieldDeltaUpdateRequest(chunk_id, patch_request,
+                                                   sender, response);
+      return;
+    }
     std::shared_ptr<Revision> to_insert =
         Revision::fromProtoString(patch_request.serialized_revision());
-    PeerId sender(request.sender());
     found->second->handleUpdateRequest(chunk_id, to_insert, sender, response);
   }
 }
@@ -487,6 +516,17 @@ void NetTableManager::handleSpatialTriggerNotification(const Message& request,
   }
 }
 
+void NetTableManager::handleOldestActiveBeginTimeRequest(
+    const Message& request, Message* response) {
+  CHECK_NOTNULL(response);
+  CHECK(request.isType<NetTable::kOldestActiveBeginTimeRequest>());
+  proto::LogicalTimeMessage oldest_active_begin_time;
+  oldest_active_begin_time.set_logical_time(
+      Transaction::oldestActiveBeginTime().serialize());
+  response->impose<NetTable::kOldestActiveBeginTimeResponse>(
+      oldest_active_begin_time);
+}
+
 void NetTableManager::handleRoutedNetTableChordRequests(const Message& request,
                                                         Message* response) {
   CHECK_NOTNULL(response);
@@ -21,12 +21,21 @@
 
 #include "map-api/net-table-transaction.h"
 
+#include <atomic>
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
 #include "map-api/conflicts.h"
 #include "map-api/internal/commit-future.h"
+#include "map-api/internal/worker-pool.h"
 
 DEFINE_bool(map_api_dump_available_chunk_contents, false,
             "Will print all available ids if enabled.");
 
+DECLARE_bool(map_api_optimistic_commit_check);
+
 DEFINE_bool(map_api_blame_updates, false,
             "Print update counts per chunk per table.");
 
@@ -52,8 +61,66 @@ NetTableTransaction::NetTableTransaction(const LogicalTime& begin_time,
               chunk_commit_futures.first, table));
     }
   }
+}
 
-  refreshIdToChunkIdMap();
+void NetTableTransaction::getByCommonIds(
+    const std::vector<map_api_common::Id>& ids,
+    std::vector<std::shared_ptr<const Revision>>* results) {
+  CHECK_NOTNULL(results)->clear();
+  results->resize(ids.size());
+
+  // Ids are grouped by chunk, so that each chunk is read from only once.
+  // Chunk transactions are created serially, as transactionOf() isn't
+  // threadsafe.
+  struct ChunkRequest {
+    const ChunkBase* chunk;
+    const ChunkTransaction* transaction;
+    std::vector<map_api_common::Id> ids;
+    std::vector<size_t> indices;
+  };
+  std::vector<ChunkRequest> requests;
+  std::unordered_map<const ChunkBase*, size_t> chunk_to_request;
+  for (size_t i = 0u; i < ids.size(); ++i) {
+    const ChunkBase* chunk = chunkOf(ids[i]);
+    if (chunk == nullptr || !workspace_.contains(chunk->id())) {
+      continue;
+    }
+    std::pair<std::unordered_map<const ChunkBase*, size_t>::iterator, bool>
+        emplaced = chunk_to_request.emplace(chunk, requests.size());
+    if (emplaced.second) {
+      requests.push_back({chunk, transactionOf(chunk), {}, {}});
+    }
+    ChunkRequest& request = requests[emplaced.first->second];
+    request.ids.push_back(ids[i]);
+    request.indices.push_back(i);
+  }
+
+  const std::function<void(size_t)> read_chunk = [&requests,  // NOLINT
+                                                  results](size_t i) {
+    const ChunkRequest& request = requests[i];
+    std::vector<std::shared_ptr<const Revision>> chunk_results;
+    request.transaction->getByIds(request.ids, &chunk_results);
+    CHECK_EQ(request.ids.size(), chunk_results.size());
+    for (size_t j = 0u; j < request.indices.size(); ++j) {
+      (*results)[request.indices[j]] = chunk_results[j];
+    }
+  };
+  // Chunks that are write-locked by the calling thread can only be read from
+  // that thread.
+  bool read_in_parallel = true;
+  for (const ChunkRequest& request : requests) {
+    if (request.chunk->isWriteLocked()) {
+      read_in_parallel = false;
+      break;
+    }
+  }
+  if (read_in_parallel) {
+    internal::WorkerPool::instance().parallelFor(requests.size(), read_chunk);
+  } else {
+    for (size_t i = 0u; i < requests.size(); ++i) {
+      read_chunk(i);
+    }
+  }
 }
 
 void NetTableTransaction::dumpChunk(const ChunkBase* chunk,
@@ -75,6 +142,21 @@ void NetTableTransaction::dumpActiveChunks(ConstRevisionMap* result) {
   });
 }
 
+void NetTableTransaction::forEachItemInChunk(
+    const ChunkBase* chunk, const ChunkTransaction::ItemAction& action) {
+  CHECK_NOTNULL(chunk);
+  if (workspace_.contains(chunk->id())) {
+    transactionOf(chunk)->forEachItem(action);
+  }
+}
+
+void NetTableTransaction::forEachItemInActiveChunks(
+    const ChunkTransaction::ItemAction& action) {
+  workspace_.forEachChunk([&, this](const ChunkBase& chunk) {
+    forEachItemInChunk(&chunk, action);
+  });
+}
+
 void NetTableTransaction::insert(ChunkBase* chunk,
                                  std::shared_ptr<Revision> revision) {
   CHECK_NOTNULL(chunk);
@@ -105,6 +187,9 @@ void NetTableTransaction::remove(std::shared_ptr<Revision> revision) {
 }
 
 bool NetTableTransaction::commit() {
+  if (FLAGS_map_api_optimistic_commit_check && !hasNoVisibleConflicts()) {
+    return false;
+  }
   lock();
   if (!hasNoConflicts()) {
     unlock();
@@ -118,10 +203,17 @@ bool NetTableTransaction::commit() {
 void NetTableTransaction::checkedCommit(const LogicalTime& time) {
   if (FLAGS_map_api_blame_updates) {
     std::cout << "Updates in table " << table_->name() << ":" << std::endl;
+    // Sequential, to keep the output readable.
+    for (const TransactionPair& chunk_transaction : chunk_transactions_) {
+      ChunkBase::ScopedWriteLockAdoption adoption(chunk_transaction.first);
+      chunk_transaction.second->checkedCommit(time);
+    }
+    return;
   }
-  for (const TransactionPair& chunk_transaction : chunk_transactions_) {
-    chunk_transaction.second->checkedCommit(time);
-  }
+  forEachChunkTransactionInParallel(
+      [&time](const TransactionPair& chunk_transaction) {
+        chunk_transaction.second->checkedCommit(time);
+      });
 }
 
 // Deadlocks in lock() are prevented by imposing a global ordering on chunks,
@@ -135,18 +227,39 @@ void NetTableTransaction::lock() {
 }
 
 void NetTableTransaction::unlock() {
-  for (const TransactionPair& chunk_transaction : chunk_transactions_) {
-    chunk_transaction.first->unlock();
-  }
+  forEachChunkTransactionInParallel(
+      [](const TransactionPair& chunk_transaction) {
+        chunk_transaction.first->unlock();
+      });
 }
 
 bool NetTableTransaction::hasNoConflicts() {
+  std::atomic<bool> has_conflicts(false);
+  forEachChunkTransactionInParallel(
+      [&has_conflicts](const TransactionPair& chunk_transaction) {
+        // No need to check the remaining chunks once a conflict is found.
+        if (!has_conflicts && !chunk_transaction.second->hasNoConflicts()) {
+          has_conflicts = true;
+        }
+      });
+  return !has_conflicts;
+}
+
+bool NetTableTransaction::hasNoVisibleConflicts() const {
+  std::vector<const ChunkTransaction*> chunk_transactions;
+  chunk_transactions.reserve(chunk_transactions_.size());
   for (const TransactionPair& chunk_transaction : chunk_transactions_) {
-    if (!chunk_transaction.second->hasNoConflicts()) {
-      return false;
-    }
+    chunk_transactions.push_back(chunk_transaction.second.get());
   }
-  return true;
+  std::atomic<bool> has_conflicts(false);
+  internal::WorkerPool::instance().parallelFor(
+      chunk_transactions.size(), [&](size_t i) {
+        if (!has_conflicts &&
+            !chunk_transactions[i]->hasNoVisibleConflicts()) {
+          has_conflicts = true;
+        }
+      });
+  return !has_conflicts;
 }
 
 void NetTableTransaction::merge(
@@ -203,6 +316,23 @@ void NetTableTransaction::detachFutures() {
   }
 }
 
+void NetTableTransaction::forEachChunkTransactionInParallel(
+    const std::function<void(const TransactionPair&)>& function) const {
+  std::vector<const TransactionPair*> chunk_transactions;
+  chunk_transactions.reserve(chunk_transactions_.size());
+  for (const TransactionPair& chunk_transaction : chunk_transactions_) {
+    chunk_transactions.push_back(&chunk_transaction);
+  }
+  internal::WorkerPool::instance().parallelFor(
+      chunk_transactions.size(), [&](size_t i) {
+        // Ownership must return to the locking thread before the pool thread
+        // moves on to unrelated tasks.
+        ChunkBase::ScopedWriteLockAdoption adoption(
+            chunk_transactions[i]->first);
+        function(*chunk_transactions[i]);
+      });
+}
+
 ChunkTransaction* NetTableTransaction::transactionOf(const ChunkBase* chunk)
     const {
   CHECK_NOTNULL(chunk);
@@ -222,9 +352,9 @@ ChunkTransaction* NetTableTransaction::transactionOf(const ChunkBase* chunk)
   return chunk_transaction->second.get();
 }
 
-void NetTableTransaction::refreshIdToChunkIdMap() {
-  CHECK(!finalized_);
-  item_id_to_chunk_id_map_.clear();
+void NetTableTransaction::getAvailableCommonIds(
+    std::vector<map_api_common::Id>* ids) {
+  CHECK_NOTNULL(ids)->clear();
   if (FLAGS_map_api_dump_available_chunk_contents) {
     std::cout << table_->name() << " chunk contents:" << std::endl;
   }
@@ -233,15 +363,16 @@ void NetTableTransaction::refreshIdToChunkIdMap() {
     chunk.constData()->getAvailableIds(begin_time_, &chunk_result);
     if (FLAGS_map_api_dump_available_chunk_contents) {
       std::cout << "\tChunk " << chunk.id().hexString() << ":" << std::endl;
-    }
-    for (const map_api_common::Id& item_id : chunk_result) {
-      CHECK(item_id_to_chunk_id_map_.emplace(item_id, chunk.id()).second)
-          << table_->name() << " has redundant item id " << item_id;
-      if (FLAGS_map_api_dump_available_chunk_contents) {
+      for (const map_api_common::Id& item_id : chunk_result) {
         std::cout << "\t\tItem " << item_id.hexString() << std::endl;
       }
     }
+    ids->insert(ids->end(), chunk_result.begin(), chunk_result.end());
   });
+  for (const ItemIdToChunkIdMap::value_type& item_chunk_ids :
+       item_id_to_chunk_id_map_) {
+    ids->push_back(item_chunk_ids.first);
+  }
 }
 
 void NetTableTransaction::getChunkTrackers(
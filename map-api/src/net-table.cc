@@ -20,7 +20,10 @@
 // along with Map API. If not, see <http://www.gnu.org/licenses/>.
 
 #include <map-api/net-table.h>
+#include <algorithm>
+#include <dirent.h>
 #include <glog/logging.h>
+#include <map-api/legacy-chunk-data-mmap-container.h>
 #include <map-api/legacy-chunk-data-ram-container.h>
 #include <map-api/legacy-chunk-data-stxxl-container.h>
 
@@ -31,8 +34,13 @@
 #include "map-api/legacy-chunk.h"
 #include "map-api/net-table-manager.h"
 #include "map-api/transaction.h"
+#include "./net-table.pb.h"
 
 DEFINE_bool(use_raft, false, "Toggles use of Raft chunks.");
+DEFINE_uint64(map_api_history_compaction_interval_ms, 10000,
+              "Interval of background history compaction for tables that have "
+              "it enabled.");
+DECLARE_string(map_api_chunk_segment_dir);
 
 namespace map_api {
 
@@ -42,11 +50,20 @@ const char NetTable::kPushNewChunksRequest[] = "map_api_net_table_push_new";
 const char NetTable::kAnnounceToListeners[] =
     "map_api_net_table_announce_to_listeners";
 
+const char NetTable::kOldestActiveBeginTimeRequest[] =
+    "map_api_net_table_oldest_active_begin_time_request";
+const char NetTable::kOldestActiveBeginTimeResponse[] =
+    "map_api_net_table_oldest_active_begin_time_response";
+
 MAP_API_STRING_MESSAGE(NetTable::kPushNewChunksRequest);
 MAP_API_STRING_MESSAGE(NetTable::kAnnounceToListeners);
+MAP_API_PROTO_MESSAGE(NetTable::kOldestActiveBeginTimeResponse,
+                      proto::LogicalTimeMessage);
 
 NetTable::NetTable() {}
 
+NetTable::~NetTable() { stopHistoryCompaction(); }
+
 bool NetTable::init(std::shared_ptr<TableDescriptor> descriptor) {
   descriptor_ = descriptor;
   return true;
@@ -103,6 +120,17 @@ void NetTable::announceToListeners(const PeerIdList& listeners) {
 const std::string& NetTable::name() const { return descriptor_->name(); }
 
 ChunkBase* NetTable::addInitializedChunk(std::unique_ptr<ChunkBase>&& chunk) {
+  // Indexing the current contents after attaching the listener ensures that
+  // no item is missed, while items indexed twice are harmless.
+  const map_api_common::Id chunk_id = chunk->id();
+  chunk->setItemListener(
+      [this, chunk_id](const std::vector<map_api_common::Id>& item_ids) {
+        indexItems(item_ids, chunk_id);
+      });
+  std::vector<map_api_common::Id> item_ids;
+  chunk->constData()->getAvailableIds(LogicalTime::sample(), &item_ids);
+  indexItems(item_ids, chunk_id);
+
   map_api_common::ScopedWriteLock lock(&active_chunks_lock_);
   std::pair<ChunkMap::iterator, bool> emplaced =
       active_chunks_.emplace(chunk->id(), std::move(chunk));
@@ -156,6 +184,55 @@ ChunkBase* NetTable::newChunk(const map_api_common::Id& chunk_id) {
   return final_chunk_ptr;
 }
 
+size_t NetTable::restorePersistedChunks() {
+  CHECK(!FLAGS_map_api_chunk_segment_dir.empty());
+  DIR* directory = opendir(FLAGS_map_api_chunk_segment_dir.c_str());
+  CHECK(directory != nullptr) << "Couldn't open "
+                              << FLAGS_map_api_chunk_segment_dir;
+  std::vector<map_api_common::Id> chunk_ids;
+  for (struct dirent* entry = readdir(directory); entry != nullptr;
+       entry = readdir(directory)) {
+    map_api_common::Id chunk_id;
+    if (LegacyChunkDataMmapContainer::parseSegmentFileName(entry->d_name,
+                                                           name(), &chunk_id)) {
+      chunk_ids.emplace_back(chunk_id);
+    }
+  }
+  closedir(directory);
+
+  size_t num_restored = 0u;
+  for (const map_api_common::Id& chunk_id : chunk_ids) {
+    active_chunks_lock_.acquireReadLock();
+    const bool is_active = active_chunks_.count(chunk_id) > 0u;
+    active_chunks_lock_.releaseReadLock();
+    if (is_active) {
+      continue;
+    }
+    std::unordered_set<PeerId> peers;
+    getChunkHolders(chunk_id, &peers);
+    peers.erase(PeerId::self());
+    if (peers.empty()) {
+      std::unique_ptr<ChunkBase> chunk(new LegacyChunk);
+      chunk->initializeNew(chunk_id, descriptor_);
+      addInitializedChunk(std::move(chunk));
+      joinChunkHolders(chunk_id);
+    } else {
+      // Rejoins the swarm of the other holders with the restored chunk, which
+      // the init request then completes with the revisions committed since.
+      std::unique_ptr<LegacyChunk> chunk(new LegacyChunk);
+      const LogicalTime known_until = chunk->restore(chunk_id, descriptor_);
+      {
+        std::lock_guard<std::mutex> lock(m_restored_chunks_);
+        CHECK(restored_chunks_.emplace(chunk_id, std::move(chunk)).second);
+      }
+      connectTo(chunk_id, *peers.begin(), known_until);
+    }
+    ++num_restored;
+  }
+  VLOG(3) << "Restored " << num_restored << " chunks of " << name();
+  return num_restored;
+}
+
 ChunkBase* NetTable::getChunk(const map_api_common::Id& chunk_id) {
   active_chunks_lock_.acquireReadLock();
   ChunkMap::iterator found = active_chunks_.find(chunk_id);
@@ -181,6 +258,64 @@ ChunkBase* NetTable::getChunk(const map_api_common::Id& chunk_id) {
   return result;
 }
 
+ChunkBase* NetTable::getActiveChunkOfItem(
+    const map_api_common::Id& item_id) const {
+  map_api_common::Id chunk_id;
+  {
+    map_api_common::ScopedReadLock lock(&item_chunk_index_lock_);
+    ItemChunkIndex::const_iterator found = item_chunk_index_.find(item_id);
+    if (found == item_chunk_index_.end()) {
+      return nullptr;
+    }
+    chunk_id = found->second;
+  }
+  map_api_common::ScopedReadLock lock(&active_chunks_lock_);
+  ChunkMap::const_iterator found = active_chunks_.find(chunk_id);
+  if (found == active_chunks_.end()) {
+    return nullptr;
+  }
+  return found->second.get();
+}
+
+void NetTable::indexItems(const std::vector<map_api_common::Id>& item_ids,
+                          const map_api_common::Id& chunk_id) {
+  {
+    // Updates, e.g. patches from peers, only concern items that are indexed
+    // already, and don't need the write lock.
+    map_api_common::ScopedReadLock lock(&item_chunk_index_lock_);
+    bool all_indexed = true;
+    for (const map_api_common::Id& item_id : item_ids) {
+      if (item_chunk_index_.count(item_id) == 0u) {
+        all_indexed = false;
+        break;
+      }
+    }
+    if (all_indexed) {
+      return;
+    }
+  }
+  map_api_common::ScopedWriteLock lock(&item_chunk_index_lock_);
+  for (const map_api_common::Id& item_id : item_ids) {
+    std::pair<ItemChunkIndex::iterator, bool> emplaced =
+        item_chunk_index_.emplace(item_id, chunk_id);
+    LOG_IF(WARNING, !emplaced.second && emplaced.first->second != chunk_id)
+        << name() << " has redundant item id " << item_id << " in chunks "
+        << emplaced.first->second << " and " << chunk_id;
+  }
+}
+
+void NetTable::unindexChunk(const map_api_common::Id& chunk_id) {
+  map_api_common::ScopedWriteLock lock(&item_chunk_index_lock_);
+  for (ItemChunkIndex::iterator it = item_chunk_index_.begin();
+       it != item_chunk_index_.end();) {
+    if (it->second == chunk_id) {
+      it = item_chunk_index_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
 bool NetTable::ensureHasChunks(const map_api_common::IdSet& chunks_to_ensure) {
   bool success = true;
   for (const map_api_common::Id& chunk_id : chunks_to_ensure) {
@@ -398,12 +533,21 @@ void NetTable::dumpActiveChunksAtCurrentTime(ConstRevisionMap* destination) {
 }
 
 ChunkBase* NetTable::connectTo(const map_api_common::Id& chunk_id, const PeerId& peer) {
+  return connectTo(chunk_id, peer, LogicalTime());
+}
+
+ChunkBase* NetTable::connectTo(const map_api_common::Id& chunk_id,
+                               const PeerId& peer,
+                               const LogicalTime& known_until) {
   Message request, response;
   // sends request of chunk info to peer
-  proto::ChunkRequestMetadata metadata;
-  metadata.set_table(descriptor_->name());
-  chunk_id.serialize(metadata.mutable_chunk_id());
-  request.impose<LegacyChunk::kConnectRequest>(metadata);
+  proto::ConnectRequest connect_request;
+  connect_request.mutable_metadata()->set_table(descriptor_->name());
+  chunk_id.serialize(connect_request.mutable_metadata()->mutable_chunk_id());
+  if (known_until.isValid()) {
+    connect_request.set_known_until(known_until.serialize());
+  }
+  request.impose<LegacyChunk::kConnectRequest>(connect_request);
   // TODO(tcies) add to local peer subset as well?
   VLOG(5) << "Connecting to " << peer << " for chunk " << chunk_id;
   Hub::instance().request(peer, &request, &response);
@@ -466,11 +610,13 @@ size_t NetTable::activeChunksItemsSizeBytes() {
 }
 
 void NetTable::kill() {
+  stopHistoryCompaction();
   leaveAllChunks();
   leaveIndices();
 }
 
 void NetTable::killOnceShared() {
+  stopHistoryCompaction();
   leaveAllChunksOnceShared();
   leaveIndices();
 }
@@ -491,6 +637,19 @@ void NetTable::shareAllChunks(const PeerId& peer) {
   active_chunks_lock_.releaseReadLock();
 }
 
+void NetTable::leaveChunk(const map_api_common::Id& chunk_id) {
+  active_chunks_lock_.acquireReadLock();
+  ChunkMap::iterator found = active_chunks_.find(chunk_id);
+  CHECK(found != active_chunks_.end()) << "Chunk " << chunk_id
+                                       << " is not active";
+  found->second->leave();
+  leaveChunkHolders(chunk_id);
+  CHECK(active_chunks_lock_.upgradeToWriteLock());
+  active_chunks_.erase(chunk_id);
+  active_chunks_lock_.releaseWriteLock();
+  unindexChunk(chunk_id);
+}
+
 void NetTable::leaveAllChunks() {
   active_chunks_lock_.acquireReadLock();
   for (const ChunkMap::value_type& chunk : active_chunks_) {
@@ -500,6 +659,8 @@ void NetTable::leaveAllChunks() {
   CHECK(active_chunks_lock_.upgradeToWriteLock());
   active_chunks_.clear();
   active_chunks_lock_.releaseWriteLock();
+  map_api_common::ScopedWriteLock lock(&item_chunk_index_lock_);
+  item_chunk_index_.clear();
 }
 
 void NetTable::leaveAllChunksOnceShared() {
@@ -511,6 +672,8 @@ void NetTable::leaveAllChunksOnceShared() {
   CHECK(active_chunks_lock_.upgradeToWriteLock());
   active_chunks_.clear();
   active_chunks_lock_.releaseWriteLock();
+  map_api_common::ScopedWriteLock lock(&item_chunk_index_lock_);
+  item_chunk_index_.clear();
 }
 
 std::string NetTable::getStatistics() {
@@ -521,6 +684,74 @@ std::string NetTable::getStatistics() {
   return ss.str();
 }
 
+size_t NetTable::compactHistory() {
+  LogicalTime watermark;
+  if (!historyCompactionWatermark(&watermark)) {
+    VLOG(3) << "Couldn't agree on a history compaction watermark, skipping "
+            << "compaction of " << name();
+    return 0u;
+  }
+  size_t num_dropped = 0u;
+  active_chunks_lock_.acquireReadLock();
+  for (const ChunkMap::value_type& chunk : active_chunks_) {
+    num_dropped += chunk.second->compactHistory(watermark);
+  }
+  active_chunks_lock_.releaseReadLock();
+  VLOG(3) << "Compacted " << num_dropped << " revisions of " << name()
+          << " up to " << watermark;
+  return num_dropped;
+}
+
+void NetTable::enableHistoryCompaction() {
+  std::lock_guard<std::mutex> lock(m_history_compaction_);
+  if (history_compactor_.joinable()) {
+    return;
+  }
+  terminate_history_compaction_ = false;
+  history_compactor_ = std::thread([this]() {
+    std::unique_lock<std::mutex> lock(m_history_compaction_);
+    while (!cv_history_compaction_.wait_for(
+        lock, std::chrono::milliseconds(
+                  FLAGS_map_api_history_compaction_interval_ms),
+        [this]() { return terminate_history_compaction_; })) {
+      lock.unlock();
+      compactHistory();
+      lock.lock();
+    }
+  });
+}
+
+void NetTable::stopHistoryCompaction() {
+  {
+    std::lock_guard<std::mutex> lock(m_history_compaction_);
+    terminate_history_compaction_ = true;
+  }
+  cv_history_compaction_.notify_all();
+  if (history_compactor_.joinable()) {
+    history_compactor_.join();
+  }
+}
+
+bool NetTable::historyCompactionWatermark(LogicalTime* watermark) {
+  CHECK_NOTNULL(watermark);
+  *watermark = Transaction::oldestActiveBeginTime();
+  Message request;
+  request.impose<kOldestActiveBeginTimeRequest>();
+  std::unordered_map<PeerId, Message> responses;
+  Hub::instance().broadcast(&request, &responses);
+  for (const std::pair<const PeerId, Message>& response : responses) {
+    if (!response.second.isType<kOldestActiveBeginTimeResponse>()) {
+      return false;
+    }
+    proto::LogicalTimeMessage oldest_active_begin_time;
+    response.second.extract<kOldestActiveBeginTimeResponse>(
+        &oldest_active_begin_time);
+    *watermark = std::min(
+        *watermark, LogicalTime(oldest_active_begin_time.logical_time()));
+  }
+  return true;
+}
+
 void NetTable::getActiveChunkIds(std::set<map_api_common::Id>* chunk_ids) const {
   CHECK_NOTNULL(chunk_ids);
   chunk_ids->clear();
@@ -574,13 +805,15 @@ void NetTable::forEachActiveChunkUntil(const std::function<
 }
 
 void NetTable::handleConnectRequest(const map_api_common::Id& chunk_id,
-                                    const PeerId& peer, Message* response) {
+                                    const PeerId& peer,
+                                    const LogicalTime& known_until,
+                                    Message* response) {
   ChunkMap::iterator found;
   active_chunks_lock_.acquireReadLock();
   if (routingBasics(chunk_id, response, &found)) {
     LegacyChunk* chunk = CHECK_NOTNULL(
         dynamic_cast<LegacyChunk*>(found->second.get()));  // NOLINT
-    chunk->handleConnectRequest(peer, response);
+    chunk->handleConnectRequest(peer, known_until, response);
   }
   active_chunks_lock_.releaseReadLock();
 }
@@ -589,14 +822,37 @@ void NetTable::handleInitRequest(const proto::InitRequest& request,
                                  const PeerId& sender, Message* response) {
   CHECK_NOTNULL(response);
   map_api_common::Id chunk_id(request.metadata().chunk_id());
-  std::unique_ptr<LegacyChunk> chunk =
-      std::unique_ptr<LegacyChunk>(new LegacyChunk);
+  std::unique_ptr<LegacyChunk> chunk;
+  {
+    std::lock_guard<std::mutex> lock(m_restored_chunks_);
+    RestoredChunkMap::iterator found = restored_chunks_.find(chunk_id);
+    if (found != restored_chunks_.end()) {
+      chunk = std::move(found->second);
+      restored_chunks_.erase(found);
+    }
+  }
+  if (!chunk) {
+    chunk.reset(new LegacyChunk);
+  }
   CHECK(chunk->init(chunk_id, request, sender, descriptor_));
   addInitializedChunk(std::move(chunk));
   response->ack();
   std::thread(&NetTable::joinChunkHolders, this, chunk_id).detach();
 }
 
+void NetTable::handleBulkInsertRequest(
+    const map_api_common::Id& chunk_id,
+    std::vector<std::shared_ptr<const Revision> >* items, Message* response) {
+  ChunkMap::iterator found;
+  active_chunks_lock_.acquireReadLock();
+  if (routingBasics(chunk_id, response, &found)) {
+    LegacyChunk* chunk = CHECK_NOTNULL(
+        dynamic_cast<LegacyChunk*>(found->second.get()));  // NOLINT
+    chunk->handleBulkInsertRequest(items, response);
+  }
+  active_chunks_lock_.releaseReadLock();
+}
+
 void NetTable::handleInsertRequest(const map_api_common::Id& chunk_id,
                                    const std::shared_ptr<Revision>& item,
                                    Message* response) {
@@ -670,6 +926,18 @@ void NetTable::handleUpdateRequest(const map_api_common::Id& chunk_id,
   }
 }
 
+void NetTable::handleFieldDeltaUpdateRequest(const map_api_common::Id& chunk_id,
+                                             const proto::PatchRequest& request,
+                                             const PeerId& sender,
+                                             Message* response) {
+  ChunkMap::iterator found;
+  if (routingBasics(chunk_id, response, &found)) {
+    LegacyChunk* chunk = CHECK_NOTNULL(
+        dynamic_cast<LegacyChunk*>(found->second.get()));  // NOLINT
+    chunk->handleFieldDeltaUpdateRequest(request, sender, response);
+  }
+}
+
 void NetTable::handleRoutedNetTableChordRequests(const Message& request,
                                                  Message* response) {
   map_api_common::ScopedReadLock lock(&index_lock_);
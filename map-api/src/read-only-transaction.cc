@@ -0,0 +1,127 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "map-api/read-only-transaction.h"
+
+#include "map-api/internal/chunk-view.h"
+#include "map-api/transaction.h"
+
+namespace map_api {
+
+ReadOnlyTransaction::ReadOnlyTransaction(
+    const std::shared_ptr<Workspace>& workspace, const LogicalTime& begin_time)
+    : workspace_(workspace), begin_time_(begin_time) {
+  CHECK(workspace_);
+  // Registration keeps the history compaction from dropping revisions that
+  // are still visible to this transaction.
+  Transaction::registerActiveBeginTime(&begin_time_);
+  CHECK(begin_time_ < LogicalTime::sample());
+}
+
+// An invalid begin time is sampled in registerActiveBeginTime().
+ReadOnlyTransaction::ReadOnlyTransaction()
+    : ReadOnlyTransaction(std::shared_ptr<Workspace>(new Workspace),
+                          LogicalTime()) {}
+ReadOnlyTransaction::ReadOnlyTransaction(
+    const std::shared_ptr<Workspace>& workspace)
+    : ReadOnlyTransaction(workspace, LogicalTime()) {}
+ReadOnlyTransaction::ReadOnlyTransaction(const LogicalTime& begin_time)
+    : ReadOnlyTransaction(std::shared_ptr<Workspace>(new Workspace),
+                          begin_time) {}
+
+ReadOnlyTransaction::~ReadOnlyTransaction() {
+  Transaction::unregisterActiveBeginTime(begin_time_);
+}
+
+void ReadOnlyTransaction::dumpChunk(NetTable* table, ChunkBase* chunk,
+                                    ConstRevisionMap* result) const {
+  CHECK_NOTNULL(table);
+  CHECK_NOTNULL(chunk);
+  CHECK_NOTNULL(result)->clear();
+  if (workspace_->contains(table, chunk->id())) {
+    internal::ChunkView(*chunk, begin_time_).dump(result);
+  }
+}
+
+void ReadOnlyTransaction::dumpActiveChunks(NetTable* table,
+                                           ConstRevisionMap* result) const {
+  CHECK_NOTNULL(table);
+  CHECK_NOTNULL(result)->clear();
+  Workspace::TableInterface(*workspace_, table)
+      .forEachChunk([&, this](const ChunkBase& chunk) {
+        ConstRevisionMap chunk_revisions;
+        internal::ChunkView(chunk, begin_time_).dump(&chunk_revisions);
+        result->insert(chunk_revisions.begin(), chunk_revisions.end());
+      });
+}
+
+void ReadOnlyTransaction::forEachItemInChunk(NetTable* table,
+                                             ChunkBase* chunk,
+                                             const ItemAction& action) const {
+  CHECK_NOTNULL(table);
+  CHECK_NOTNULL(chunk);
+  CHECK(action);
+  if (workspace_->contains(table, chunk->id())) {
+    internal::ChunkView(*chunk, begin_time_).forEach(action);
+  }
+}
+
+void ReadOnlyTransaction::forEachItemInActiveChunks(
+    NetTable* table, const ItemAction& action) const {
+  CHECK_NOTNULL(table);
+  CHECK(action);
+  Workspace::TableInterface(*workspace_, table)
+      .forEachChunk([&, this](const ChunkBase& chunk) {
+        internal::ChunkView(chunk, begin_time_).forEach(action);
+      });
+}
+
+std::shared_ptr<const Revision> ReadOnlyTransaction::getByIdImpl(
+    const map_api_common::Id& id, NetTable* table) const {
+  const ChunkBase* chunk = table->getActiveChunkOfItem(id);
+  if (chunk == nullptr) {
+    return std::shared_ptr<const Revision>();
+  }
+  return getByIdImpl(id, table, *chunk);
+}
+
+std::shared_ptr<const Revision> ReadOnlyTransaction::getByIdImpl(
+    const map_api_common::Id& id, NetTable* table,
+    const ChunkBase& chunk) const {
+  if (!workspace_->contains(table, chunk.id())) {
+    return std::shared_ptr<const Revision>();
+  }
+  return internal::ChunkView(chunk, begin_time_).get(id);
+}
+
+void ReadOnlyTransaction::getAvailableIdsImpl(
+    NetTable* table, std::vector<map_api_common::Id>* ids) const {
+  CHECK_NOTNULL(ids)->clear();
+  Workspace::TableInterface(*workspace_, table)
+      .forEachChunk([&, this](const ChunkBase& chunk) {
+        std::vector<map_api_common::Id> chunk_ids;
+        chunk.constData()->getAvailableIds(begin_time_, &chunk_ids);
+        ids->insert(ids->end(), chunk_ids.begin(), chunk_ids.end());
+      });
+}
+
+}  // namespace map_api
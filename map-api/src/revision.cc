@@ -21,20 +21,297 @@
 
 #include <map-api/revision.h>
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include <google/protobuf/wire_format_lite.h>
 #include <map-api/logical-time.h>
 #include <map-api/net-table-manager.h>
 #include <map-api/trackee-multimap.h>
 #include <map-api-common/backtrace.h>
 #include <map-api-common/unique-id.h>
 
+DEFINE_int32(map_api_lazy_field_parsing_min_bytes, 1024,
+             "Revisions parsed from strings at least this large only decode "
+             "their custom fields on first access. Negative to disable.");
+
 namespace map_api {
 
+namespace {
+// Copies everything but the custom field values. Needs to be kept in sync
+// with proto::Revision.
+void copyMetadata(const proto::Revision& source, bool include_chunk_tracking,
+                  proto::Revision* destination) {
+  CHECK_NOTNULL(destination);
+  if (source.has_id()) {
+    destination->mutable_id()->CopyFrom(source.id());
+  }
+  if (source.has_insert_time()) {
+    destination->set_insert_time(source.insert_time());
+  }
+  if (source.has_update_time()) {
+    destination->set_update_time(source.update_time());
+  }
+  if (source.has_removed()) {
+    destination->set_removed(source.removed());
+  }
+  if (source.has_chunk_id()) {
+    destination->mutable_chunk_id()->CopyFrom(source.chunk_id());
+  }
+  if (include_chunk_tracking) {
+    destination->mutable_chunk_tracking()->CopyFrom(source.chunk_tracking());
+  }
+}
+
+// Adds custom fields that only hold the type of the source fields.
+void addCustomFieldPlaceholders(const proto::Revision& source,
+                                proto::Revision* destination) {
+  CHECK_NOTNULL(destination);
+  destination->mutable_custom_field_values()->Reserve(
+      source.custom_field_values_size());
+  for (const proto::TableField& field : source.custom_field_values()) {
+    destination->add_custom_field_values()->set_type(field.type());
+  }
+}
+
+size_t lengthDelimitedSize(int field_number,
+                           const google::protobuf::MessageLite& message) {
+  using google::protobuf::internal::WireFormatLite;
+  return google::protobuf::io::CodedOutputStream::VarintSize32(
+             WireFormatLite::MakeTag(
+                 field_number, WireFormatLite::WIRETYPE_LENGTH_DELIMITED)) +
+         WireFormatLite::LengthDelimitedSize(message.ByteSizeLong());
+}
+
+void writeLengthDelimited(int field_number,
+                          const google::protobuf::MessageLite& message,
+                          google::protobuf::io::CodedOutputStream* output) {
+  using google::protobuf::internal::WireFormatLite;
+  CHECK_NOTNULL(output)->WriteTag(WireFormatLite::MakeTag(
+      field_number, WireFormatLite::WIRETYPE_LENGTH_DELIMITED));
+  output->WriteVarint32(static_cast<uint32_t>(message.ByteSizeLong()));
+  message.SerializeWithCachedSizes(output);
+}
+
+// Returns the type of a serialized TableField, or 0 if it has none.
+int peekFieldType(const char* data, int size) {
+  using google::protobuf::internal::WireFormatLite;
+  google::protobuf::io::CodedInputStream input(
+      reinterpret_cast<const uint8_t*>(data), size);
+  uint32_t tag;
+  while ((tag = input.ReadTag()) != 0u) {
+    if (tag == WireFormatLite::MakeTag(proto::TableField::kTypeFieldNumber,
+                                       WireFormatLite::WIRETYPE_VARINT)) {
+      uint32_t type;
+      return input.ReadVarint32(&type) ? static_cast<int>(type) : 0;
+    }
+    if (!WireFormatLite::SkipField(&input, tag)) {
+      return 0;
+    }
+  }
+  return 0;
+}
+
+// Splits a serialized revision into everything but the custom field values,
+// and the positions and types of the serialized custom field values.
+bool splitCustomFields(const std::string& serialized, std::string* metadata,
+                       std::vector<std::pair<int, int> >* field_ranges,
+                       std::vector<int>* field_types) {
+  using google::protobuf::internal::WireFormatLite;
+  CHECK_NOTNULL(metadata)->clear();
+  CHECK_NOTNULL(field_ranges)->clear();
+  CHECK_NOTNULL(field_types)->clear();
+  google::protobuf::io::CodedInputStream input(
+      reinterpret_cast<const uint8_t*>(serialized.data()),
+      static_cast<int>(serialized.size()));
+  const uint32_t custom_field_tag =
+      WireFormatLite::MakeTag(proto::Revision::kCustomFieldValuesFieldNumber,
+                              WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+  while (true) {
+    const int start = input.CurrentPosition();
+    const uint32_t tag = input.ReadTag();
+    if (tag == 0u) {
+      return input.ConsumedEntireMessage();
+    }
+    if (tag == custom_field_tag) {
+      uint32_t size;
+      if (!input.ReadVarint32(&size)) {
+        return false;
+      }
+      const int offset = input.CurrentPosition();
+      if (!input.Skip(static_cast<int>(size))) {
+        return false;
+      }
+      field_ranges->emplace_back(offset, static_cast<int>(size));
+      field_types->push_back(
+          peekFieldType(serialized.data() + offset, static_cast<int>(size)));
+    } else {
+      if (!WireFormatLite::SkipField(&input, tag)) {
+        return false;
+      }
+      metadata->append(serialized, start, input.CurrentPosition() - start);
+    }
+  }
+}
+
+// FNV-1a, which, unlike std::hash, can hash a range without copying it.
+size_t hashBytes(const char* data, size_t size) {
+  uint64_t hash = 14695981039346656037u;
+  for (size_t i = 0u; i < size; ++i) {
+    hash ^= static_cast<uint8_t>(data[i]);
+    hash *= 1099511628211u;
+  }
+  return static_cast<size_t>(hash);
+}
+}  // namespace
+
+class Revision::LazyCustomFields {
+ public:
+  LazyCustomFields(const std::string& serialized,
+                   const std::vector<std::pair<int, int> >& field_ranges)
+      : fields_(field_ranges.size()) {
+    for (size_t i = 0u; i < field_ranges.size(); ++i) {
+      fields_[i].serialized.assign(serialized, field_ranges[i].first,
+                                   field_ranges[i].second);
+    }
+  }
+
+  // Decodes the field on first access and releases its serialized form.
+  const proto::TableField& get(int index) {
+    CHECK_LT(static_cast<size_t>(index), fields_.size());
+    Field& field = fields_[index];
+    if (!field.decoded.load(std::memory_order_acquire)) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!field.decoded.load(std::memory_order_relaxed)) {
+        CHECK(field.value.ParseFromString(field.serialized));
+        std::string().swap(field.serialized);
+        field.decoded.store(true, std::memory_order_release);
+      }
+    }
+    return field.value;
+  }
+
+  // Writes the serialized field as received if it hasn't been decoded.
+  void write(int index, google::protobuf::io::CodedOutputStream* output) const {
+    using google::protobuf::internal::WireFormatLite;
+    CHECK_NOTNULL(output);
+    const Field& field = fields_[index];
+    if (field.decoded.load(std::memory_order_acquire)) {
+      writeLengthDelimited(proto::Revision::kCustomFieldValuesFieldNumber,
+                           field.value, output);
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (field.decoded.load(std::memory_order_relaxed)) {
+      writeLengthDelimited(proto::Revision::kCustomFieldValuesFieldNumber,
+                           field.value, output);
+      return;
+    }
+    output->WriteTag(
+        WireFormatLite::MakeTag(proto::Revision::kCustomFieldValuesFieldNumber,
+                                WireFormatLite::WIRETYPE_LENGTH_DELIMITED));
+    output->WriteVarint32(static_cast<uint32_t>(field.serialized.size()));
+    output->WriteRaw(field.serialized.data(),
+                     static_cast<int>(field.serialized.size()));
+  }
+
+  // Hash of the serialized field, without decoding it.
+  size_t hash(int index) const {
+    const Field& field = fields_[index];
+    std::string serialized;
+    if (field.decoded.load(std::memory_order_acquire)) {
+      CHECK(field.value.SerializeToString(&serialized));
+      return hashBytes(serialized.data(), serialized.size());
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (field.decoded.load(std::memory_order_relaxed)) {
+      CHECK(field.value.SerializeToString(&serialized));
+      return hashBytes(serialized.data(), serialized.size());
+    }
+    return hashBytes(field.serialized.data(), field.serialized.size());
+  }
+
+  size_t byteSize(int index) const {
+    using google::protobuf::internal::WireFormatLite;
+    const Field& field = fields_[index];
+    if (field.decoded.load(std::memory_order_acquire)) {
+      return lengthDelimitedSize(proto::Revision::kCustomFieldValuesFieldNumber,
+                                 field.value);
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (field.decoded.load(std::memory_order_relaxed)) {
+      return lengthDelimitedSize(proto::Revision::kCustomFieldValuesFieldNumber,
+                                 field.value);
+    }
+    return google::protobuf::io::CodedOutputStream::VarintSize32(
+               WireFormatLite::MakeTag(
+                   proto::Revision::kCustomFieldValuesFieldNumber,
+                   WireFormatLite::WIRETYPE_LENGTH_DELIMITED)) +
+           WireFormatLite::LengthDelimitedSize(field.serialized.size());
+  }
+
+ private:
+  struct Field {
+    // Empty once decoded.
+    std::string serialized;
+    proto::TableField value;
+    std::atomic<bool> decoded{false};
+  };
+  std::vector<Field> fields_;
+  // Guards decoding, which releases the serialized form.
+  mutable std::mutex mutex_;
+};
+
+Revision::ArenaPtr Revision::createArena() {
+  return std::make_shared<google::protobuf::Arena>();
+}
+
 void Revision::copyForWrite(std::shared_ptr<Revision>* result) const {
+  copyForWrite(ArenaPtr(), result);
+}
+
+Revision::Revision(const Revision& other)
+    : underlying_revision_(newProto(ArenaPtr())),
+      changed_fields_(other.changed_fields_),
+      is_copy_(other.is_copy_) {
+  copyMetadata(*other.underlying_revision_, true, underlying_revision_.get());
+  shareCustomFieldsOf(other);
+}
+
+void Revision::copyForWrite(const ArenaPtr& arena,
+                            std::shared_ptr<Revision>* result) const {
   CHECK_NOTNULL(result);
-  std::shared_ptr<proto::Revision> copy(
-      new proto::Revision(*underlying_revision_));
-  return fromProto(copy, result);
+  std::shared_ptr<proto::Revision> copy = newProto(arena);
+  copyMetadata(*underlying_revision_, true, copy.get());
+  fromProto(copy, result);
+  Revision& copy_revision = **result;
+  copy_revision.shareCustomFieldsOf(*this);
+  copy_revision.changed_fields_.assign(customFieldCount(), false);
+  copy_revision.is_copy_ = true;
+}
+
+void Revision::shareCustomFieldsOf(const Revision& source) {
+  addCustomFieldPlaceholders(*source.underlying_revision_,
+                             underlying_revision_.get());
+  const int num_fields = source.customFieldCount();
+  shared_fields_.clear();
+  shared_fields_.reserve(num_fields);
+  for (int i = 0; i < num_fields; ++i) {
+    if (source.isLazyCustomField(i)) {
+      shared_fields_.emplace_back();
+    } else {
+      shared_fields_.emplace_back(source.shareCustomField(i));
+    }
+  }
+  lazy_fields_ = source.lazy_fields_;
 }
 
 void Revision::fromProto(const std::shared_ptr<proto::Revision>& revision_proto,
@@ -56,20 +333,84 @@ void Revision::fromProto(const std::shared_ptr<proto::Revision>& revision_proto,
 
 std::shared_ptr<Revision> Revision::fromProtoString(
     const std::string& revision_proto_string) {
+  return fromProtoString(revision_proto_string, ArenaPtr());
+}
+
+std::shared_ptr<Revision> Revision::fromProtoString(
+    const std::string& revision_proto_string, const ArenaPtr& arena) {
   std::shared_ptr<Revision> result(new Revision);
-  result->underlying_revision_.reset(new proto::Revision);
-  CHECK(result->underlying_revision_->ParseFromString(revision_proto_string));
+  result->underlying_revision_ = newProto(arena);
+  if (FLAGS_map_api_lazy_field_parsing_min_bytes < 0 ||
+      revision_proto_string.size() <
+          static_cast<size_t>(FLAGS_map_api_lazy_field_parsing_min_bytes)) {
+    CHECK(result->underlying_revision_->ParseFromString(revision_proto_string));
+    return result;
+  }
+  std::string metadata;
+  std::vector<std::pair<int, int> > field_ranges;
+  std::vector<int> field_types;
+  CHECK(splitCustomFields(revision_proto_string, &metadata, &field_ranges,
+                          &field_types));
+  CHECK(result->underlying_revision_->ParseFromString(metadata));
+  if (field_ranges.empty()) {
+    return result;
+  }
+  result->underlying_revision_->mutable_custom_field_values()->Reserve(
+      field_types.size());
+  for (int type : field_types) {
+    proto::TableField* placeholder =
+        result->underlying_revision_->add_custom_field_values();
+    if (type != 0) {
+      placeholder->set_type(static_cast<proto::Type>(type));
+    }
+  }
+  result->lazy_fields_ =
+      std::make_shared<LazyCustomFields>(revision_proto_string, field_ranges);
   return result;
 }
 
+std::shared_ptr<proto::Revision> Revision::newProto(const ArenaPtr& arena) {
+  if (!arena) {
+    return std::make_shared<proto::Revision>();
+  }
+  return aliasArenaProto(
+      arena, google::protobuf::Arena::CreateMessage<proto::Revision>(
+                 arena.get()));
+}
+
+std::shared_ptr<proto::Revision> Revision::aliasArenaProto(
+    const ArenaPtr& arena, proto::Revision* revision_proto) {
+  CHECK(arena);
+  CHECK_NOTNULL(revision_proto);
+  CHECK_EQ(arena.get(), revision_proto->GetArena());
+  // The proto is destroyed with the arena; the returned pointer only shares
+  // ownership of the latter.
+  return std::shared_ptr<proto::Revision>(arena, revision_proto);
+}
+
 void Revision::addField(int index, proto::Type type) {
   CHECK_EQ(underlying_revision_->custom_field_values_size(), index)
       << "Custom fields must be added in-order!";
+  resolveLazyCustomFields();
   underlying_revision_->add_custom_field_values()->set_type(type);
+  if (!shared_fields_.empty()) {
+    shared_fields_.emplace_back();
+  }
+  if (is_copy_) {
+    changed_fields_.push_back(true);
+  }
 }
 void Revision::removeLastField() {
   CHECK_GT(underlying_revision_->custom_field_values_size(), 0);
+  stopLendingCustomFields();
+  resolveLazyCustomFields();
   underlying_revision_->mutable_custom_field_values()->RemoveLast();
+  if (!shared_fields_.empty()) {
+    shared_fields_.pop_back();
+  }
+  if (is_copy_) {
+    changed_fields_.pop_back();
+  }
 }
 
 bool Revision::hasField(int index) const {
@@ -81,14 +422,252 @@ proto::Type Revision::getFieldType(int index) const {
 }
 
 void Revision::clearCustomFieldValues() {
-  for (proto::TableField& custom_field :
-       *underlying_revision_->mutable_custom_field_values()) {
-    proto::Type type = custom_field.type();
-    custom_field.Clear();
-    custom_field.set_type(type);
+  if (lends_custom_fields_) {
+    std::shared_ptr<proto::Revision> cleared =
+        std::make_shared<proto::Revision>();
+    copyMetadata(*underlying_revision_, true, cleared.get());
+    addCustomFieldPlaceholders(*underlying_revision_, cleared.get());
+    underlying_revision_ = cleared;
+    lends_custom_fields_ = false;
+  } else {
+    for (proto::TableField& custom_field :
+         *underlying_revision_->mutable_custom_field_values()) {
+      proto::Type type = custom_field.type();
+      custom_field.Clear();
+      custom_field.set_type(type);
+    }
+  }
+  shared_fields_.clear();
+  lazy_fields_.reset();
+  if (is_copy_) {
+    changed_fields_.assign(customFieldCount(), true);
+  }
+}
+
+bool Revision::isCustomFieldChanged(int index) const {
+  CHECK_LT(index, customFieldCount());
+  return !is_copy_ || changed_fields_[index];
+}
+
+void Revision::getChangedCustomFields(std::vector<int>* indices) const {
+  CHECK_NOTNULL(indices)->clear();
+  for (int i = 0; i < customFieldCount(); ++i) {
+    if (isCustomFieldChanged(i)) {
+      indices->push_back(i);
+    }
   }
 }
 
+std::string Revision::serializeUnderlying() const {
+  if (!hasSharedFields()) {
+    return underlying_revision_->SerializeAsString();
+  }
+  std::string result;
+  {
+    google::protobuf::io::StringOutputStream string_stream(&result);
+    google::protobuf::io::CodedOutputStream coded_stream(&string_stream);
+    CHECK(SerializeToCodedStream(&coded_stream));
+  }
+  return result;
+}
+
+bool Revision::SerializeToCodedStream(
+    google::protobuf::io::CodedOutputStream* output) const {
+  CHECK_NOTNULL(output);
+  if (!hasSharedFields()) {
+    return underlying_revision_->SerializeToCodedStream(output);
+  }
+  // Same wire format as the complete proto, with the shared values written
+  // in place of the placeholders, in field number order.
+  proto::Revision metadata;
+  copyMetadata(*underlying_revision_, false, &metadata);
+  if (!metadata.SerializeToCodedStream(output)) {
+    return false;
+  }
+  for (int i = 0; i < customFieldCount(); ++i) {
+    if (isLazyCustomField(i)) {
+      lazy_fields_->write(i, output);
+    } else {
+      writeLengthDelimited(proto::Revision::kCustomFieldValuesFieldNumber,
+                           customField(i), output);
+    }
+  }
+  for (const proto::TableChunkTracking& tracking :
+       underlying_revision_->chunk_tracking()) {
+    writeLengthDelimited(proto::Revision::kChunkTrackingFieldNumber, tracking,
+                         output);
+  }
+  return !output->HadError();
+}
+
+int Revision::byteSize() const {
+  if (!hasSharedFields()) {
+    return underlying_revision_->ByteSize();
+  }
+  proto::Revision metadata;
+  copyMetadata(*underlying_revision_, true, &metadata);
+  return static_cast<int>(metadata.ByteSizeLong() + customFieldsByteSize());
+}
+
+void Revision::copyUnderlyingTo(proto::Revision* destination) const {
+  CHECK_NOTNULL(destination)->CopyFrom(*underlying_revision_);
+  if (!hasSharedFields()) {
+    return;
+  }
+  for (int i = 0; i < customFieldCount(); ++i) {
+    destination->mutable_custom_field_values(i)->CopyFrom(customField(i));
+  }
+}
+
+void Revision::getCustomFieldsChangedFrom(const Revision& base,
+                                          std::vector<int>* indices) const {
+  CHECK_NOTNULL(indices)->clear();
+  CHECK_EQ(getId<map_api_common::Id>(), base.getId<map_api_common::Id>());
+  CHECK_EQ(customFieldCount(), base.customFieldCount());
+  for (int i = 0; i < customFieldCount(); ++i) {
+    if (isCustomFieldChanged(i)) {
+      indices->push_back(i);
+      continue;
+    }
+    // Avoids decoding fields that are lazy in both revisions.
+    if (lazy_fields_ && lazy_fields_ == base.lazy_fields_ &&
+        isLazyCustomField(i) && base.isLazyCustomField(i)) {
+      continue;
+    }
+    if (&customField(i) != &base.customField(i) && !fieldMatch(base, i)) {
+      indices->push_back(i);
+    }
+  }
+}
+
+std::string Revision::serializeFieldDelta(
+    const std::vector<int>& indices) const {
+  proto::Revision delta;
+  copyMetadata(*underlying_revision_, true, &delta);
+  delta.mutable_custom_field_values()->Reserve(indices.size());
+  for (int index : indices) {
+    CHECK_LT(index, customFieldCount());
+    delta.add_custom_field_values()->CopyFrom(customField(index));
+  }
+  return delta.SerializeAsString();
+}
+
+std::shared_ptr<Revision> Revision::applyFieldDelta(
+    const std::shared_ptr<const Revision>& delta,
+    const std::vector<int>& indices) const {
+  CHECK(delta);
+  CHECK_EQ(delta->customFieldCount(), static_cast<int>(indices.size()));
+  CHECK_EQ(delta->getId<map_api_common::Id>(), getId<map_api_common::Id>());
+  std::shared_ptr<Revision> result;
+  copyForWrite(&result);
+  result->underlying_revision_->Clear();
+  copyMetadata(*delta->underlying_revision_, true,
+               result->underlying_revision_.get());
+  addCustomFieldPlaceholders(*underlying_revision_,
+                             result->underlying_revision_.get());
+  for (size_t i = 0u; i < indices.size(); ++i) {
+    const int index = indices[i];
+    CHECK_LT(index, customFieldCount());
+    CHECK_EQ(delta->customField(i).type(), getFieldType(index));
+    result->shared_fields_[index] = delta->shareCustomField(i);
+    result->changed_fields_[index] = true;
+  }
+  return result;
+}
+
+bool Revision::isFieldDeltaApplicable(const Revision& delta,
+                                      const std::vector<int>& indices) const {
+  if (delta.customFieldCount() != static_cast<int>(indices.size()) ||
+      delta.getId<map_api_common::Id>() != getId<map_api_common::Id>()) {
+    return false;
+  }
+  for (size_t i = 0u; i < indices.size(); ++i) {
+    if (indices[i] < 0 || indices[i] >= customFieldCount() ||
+        delta.customField(i).type() != getFieldType(indices[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+proto::TableField* Revision::mutableCustomField(int index) {
+  CHECK_LT(index, customFieldCount());
+  stopLendingCustomFields();
+  resolveLazyCustomFields();
+  if (!shared_fields_.empty()) {
+    // The placeholder already holds the type.
+    shared_fields_[index].reset();
+  }
+  if (is_copy_) {
+    changed_fields_[index] = true;
+  }
+  return underlying_revision_->mutable_custom_field_values(index);
+}
+
+bool Revision::hasSharedFields() const {
+  if (lazy_fields_) {
+    return true;
+  }
+  return std::any_of(
+      shared_fields_.begin(), shared_fields_.end(),
+      [](const std::shared_ptr<const proto::TableField>& field) {
+        return static_cast<bool>(field);
+      });
+}
+
+std::shared_ptr<const proto::TableField> Revision::shareCustomField(
+    int index) const {
+  if (!shared_fields_.empty() && shared_fields_[index]) {
+    return shared_fields_[index];
+  }
+  if (lazy_fields_) {
+    return std::shared_ptr<const proto::TableField>(lazy_fields_,
+                                                    &lazyCustomField(index));
+  }
+  lends_custom_fields_ = true;
+  return std::shared_ptr<const proto::TableField>(
+      underlying_revision_, &underlying_revision_->custom_field_values(index));
+}
+
+void Revision::stopLendingCustomFields() {
+  if (!lends_custom_fields_) {
+    return;
+  }
+  // The revisions we lent to keep the current proto alive. Continue on a new
+  // proto that borrows from it as well, rather than copying the values.
+  std::shared_ptr<proto::Revision> own = std::make_shared<proto::Revision>();
+  copyMetadata(*underlying_revision_, true, own.get());
+  addCustomFieldPlaceholders(*underlying_revision_, own.get());
+  shared_fields_.resize(customFieldCount());
+  for (int i = 0; i < customFieldCount(); ++i) {
+    if (!shared_fields_[i]) {
+      shared_fields_[i] = std::shared_ptr<const proto::TableField>(
+          underlying_revision_, &underlying_revision_->custom_field_values(i));
+    }
+  }
+  underlying_revision_ = own;
+  lends_custom_fields_ = false;
+}
+
+const proto::TableField& Revision::lazyCustomField(int index) const {
+  CHECK(lazy_fields_);
+  return lazy_fields_->get(index);
+}
+
+void Revision::resolveLazyCustomFields() {
+  if (!lazy_fields_) {
+    return;
+  }
+  shared_fields_.resize(customFieldCount());
+  for (int i = 0; i < customFieldCount(); ++i) {
+    if (!shared_fields_[i]) {
+      shared_fields_[i] = std::shared_ptr<const proto::TableField>(
+          lazy_fields_, &lazy_fields_->get(i));
+    }
+  }
+  lazy_fields_.reset();
+}
+
 bool Revision::operator==(const Revision& other) const {
   if (!structureMatch(other)) {
     return false;
@@ -134,14 +713,23 @@ bool Revision::structureMatch(const Revision& reference) const {
 }
 
 bool Revision::fieldMatch(const Revision& other, int key) const {
-  const proto::TableField& a = underlying_revision_->custom_field_values(key);
-  const proto::TableField& b =
-      other.underlying_revision_->custom_field_values(key);
+  const proto::TableField& a = customField(key);
+  const proto::TableField& b = other.customField(key);
   switch (a.type()) {
     case proto::Type::BLOB: { return a.blob_value() == b.blob_value(); }
     case(proto::Type::DOUBLE) : { return a.double_value() == b.double_value(); }
     case(proto::Type::HASH128) : {
-      return a.string_value() == b.string_value();
+      if (a.has_hash128_first() && b.has_hash128_first()) {
+        return a.hash128_first() == b.hash128_first() &&
+               a.hash128_second() == b.hash128_second();
+      }
+      if (!a.has_hash128_first() && !b.has_hash128_first()) {
+        return a.string_value() == b.string_value();
+      }
+      // One of the values is stored in the legacy hex form.
+      map_api_common::HashId a_value, b_value;
+      return getHash128(a, &a_value) && getHash128(b, &b_value) &&
+             a_value == b_value;
     }
     case(proto::Type::INT32) : { return a.int_value() == b.int_value(); }
     case(proto::Type::UINT32) : {
@@ -167,6 +755,35 @@ bool Revision::areAllCustomFieldsEqual(const Revision& other) const {
   return true;
 }
 
+size_t Revision::customFieldsHash() const {
+  size_t hash = 0u;
+  std::string serialized_field;
+  for (int i = 0; i < customFieldCount(); ++i) {
+    size_t field_hash;
+    if (isLazyCustomField(i)) {
+      field_hash = lazy_fields_->hash(i);
+    } else {
+      CHECK(customField(i).SerializeToString(&serialized_field));
+      field_hash = hashBytes(serialized_field.data(), serialized_field.size());
+    }
+    hash ^= field_hash + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+  }
+  return hash;
+}
+
+size_t Revision::customFieldsByteSize() const {
+  size_t size = 0u;
+  for (int i = 0; i < customFieldCount(); ++i) {
+    if (isLazyCustomField(i)) {
+      size += lazy_fields_->byteSize(i);
+    } else {
+      size += lengthDelimitedSize(
+          proto::Revision::kCustomFieldValuesFieldNumber, customField(i));
+    }
+  }
+  return size;
+}
+
 std::string Revision::dumpToString() const {
   std::ostringstream dump_ss;
   dump_ss << "{" << std::endl;
@@ -183,8 +800,7 @@ std::string Revision::dumpToString() const {
   }
   for (int i = 0; i < underlying_revision_->custom_field_values_size(); ++i) {
     dump_ss << "\t" << i << ": ";
-    const proto::TableField& field =
-        underlying_revision_->custom_field_values(i);
+    const proto::TableField& field = customField(i);
     if (field.has_blob_value()) dump_ss << field.blob_value();
     if (field.has_double_value()) dump_ss << field.double_value();
     if (field.has_int_value()) dump_ss << field.int_value();
@@ -192,6 +808,11 @@ std::string Revision::dumpToString() const {
     if (field.has_long_value()) dump_ss << field.long_value();
     if (field.has_unsigned_long_value()) dump_ss << field.unsigned_long_value();
     if (field.has_string_value()) dump_ss << field.string_value();
+    if (field.has_hash128_first()) {
+      map_api_common::HashId hash_id;
+      getHash128(field, &hash_id);
+      dump_ss << hash_id.hexString();
+    }
     dump_ss << std::endl;
   }
   dump_ss << "}" << std::endl;
@@ -236,10 +857,30 @@ bool Revision::defaultAutoMergePolicy(const Revision& conflicting_revision,
     if (this_innovates) {
       VLOG(3) << "Custom fields innovated by both!";
       return false;
+    } else if (conflicting_revision.customFieldCount() ==
+               revision_at_hand->customFieldCount()) {
+      // Adopt the conflicting values by sharing them. Relative to the
+      // conflicting revision, no field is changed anymore.
+      revision_at_hand->stopLendingCustomFields();
+      revision_at_hand->shared_fields_.resize(
+          revision_at_hand->customFieldCount());
+      for (int i = 0; i < revision_at_hand->customFieldCount(); ++i) {
+        revision_at_hand->shared_fields_[i] =
+            conflicting_revision.shareCustomField(i);
+      }
+      revision_at_hand->lazy_fields_.reset();
+      revision_at_hand->changed_fields_.assign(
+          revision_at_hand->customFieldCount(), false);
     } else {
+      revision_at_hand->stopLendingCustomFields();
+      proto::Revision scratch;
+      conflicting_revision.copyUnderlyingTo(&scratch);
       revision_at_hand->underlying_revision_->mutable_custom_field_values()
-          ->CopyFrom(conflicting_revision.underlying_revision_
-                         ->custom_field_values());
+          ->Swap(scratch.mutable_custom_field_values());
+      revision_at_hand->shared_fields_.clear();
+      revision_at_hand->lazy_fields_.reset();
+      revision_at_hand->changed_fields_.assign(
+          revision_at_hand->customFieldCount(), true);
     }
   }
 
@@ -284,6 +925,27 @@ bool Revision::tryAutoMerge(
   return false;
 }
 
+void Revision::setHash128(const map_api_common::HashId& value,
+                          proto::TableField* field) {
+  CHECK_NOTNULL(field);
+  uint64_t words[2];
+  value.toUint64(words);
+  field->clear_string_value();
+  field->set_hash128_first(words[0]);
+  field->set_hash128_second(words[1]);
+}
+
+bool Revision::getHash128(const proto::TableField& field,
+                          map_api_common::HashId* value) {
+  CHECK_NOTNULL(value);
+  if (field.has_hash128_first()) {
+    const uint64_t words[2] = {field.hash128_first(), field.hash128_second()};
+    value->fromUint64(words);
+    return true;
+  }
+  return value->fromHexString(field.string_value());
+}
+
 /**
  * PROTOBUFENUM
  */
@@ -326,11 +988,11 @@ MAP_API_REVISION_SET(bool /*value*/) {
   return true;
 }
 MAP_API_REVISION_SET(map_api_common::Id /*value*/) {
-  field->set_string_value(value.hexString());
+  setHash128(value, field);
   return true;
 }
 MAP_API_REVISION_SET(map_api_common::HashId /*value*/) {
-  field->set_string_value(value.hexString());
+  setHash128(value, field);
   return true;
 }
 MAP_API_REVISION_SET(int64_t /*value*/) {
@@ -378,7 +1040,7 @@ MAP_API_REVISION_GET(uint32_t /*value*/) {
   return true;
 }
 MAP_API_REVISION_GET(map_api_common::Id /*value*/) {
-  if (!value->fromHexString(field.string_value())) {
+  if (!getHash128(field, value)) {
     LOG(FATAL) << "Failed to parse Hash id from string \""
                << field.string_value() << "\"";
   }
@@ -389,7 +1051,7 @@ MAP_API_REVISION_GET(bool /*value*/) {
   return true;
 }
 MAP_API_REVISION_GET(map_api_common::HashId /*value*/) {
-  if (!value->fromHexString(field.string_value())) {
+  if (!getHash128(field, value)) {
     LOG(FATAL) << "Failed to parse Hash id from string \""
                << field.string_value() << "\"";
   }
@@ -408,12 +1070,22 @@ MAP_API_REVISION_GET(LogicalTime /*value*/) {
   return true;
 }
 MAP_API_REVISION_GET(Revision /*value*/) {
-  bool parsed =
-      value->underlying_revision_->ParseFromString(field.blob_value());
+  // Parses into a new proto, since the custom fields of the current one may
+  // be shared with other revisions.
+  std::shared_ptr<proto::Revision> parsed_revision =
+      std::make_shared<proto::Revision>();
+  bool parsed = parsed_revision->ParseFromString(field.blob_value());
   if (!parsed) {
     LOG(FATAL) << "Failed to parse revision";
     return false;
   }
+  value->underlying_revision_ = parsed_revision;
+  value->shared_fields_.clear();
+  value->lazy_fields_.reset();
+  value->lends_custom_fields_ = false;
+  if (value->is_copy_) {
+    value->changed_fields_.assign(value->customFieldCount(), true);
+  }
   return true;
 }
 MAP_API_REVISION_GET(testBlob /*value*/) {
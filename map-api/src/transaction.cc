@@ -22,6 +22,7 @@
 #include "map-api/transaction.h"
 
 #include <algorithm>
+#include <atomic>
 
 #include <map-api-common/backtrace.h>
 
@@ -29,6 +30,7 @@
 #include "map-api/chunk-manager.h"
 #include "map-api/conflicts.h"
 #include "map-api/internal/commit-future.h"
+#include "map-api/internal/worker-pool.h"
 #include "map-api/legacy-chunk.h"
 #include "map-api/net-table.h"
 #include "map-api/net-table-manager.h"
@@ -40,10 +42,14 @@
 
 DECLARE_bool(cache_blame_dirty);
 DECLARE_bool(cache_blame_insert);
+DECLARE_bool(map_api_optimistic_commit_check);
 DEFINE_bool(blame_commit, false, "Print stack trace for every commit");
 
 namespace map_api {
 
+std::multiset<LogicalTime> Transaction::active_begin_times_;
+std::mutex Transaction::active_begin_times_mutex_;
+
 Transaction::Transaction(const std::shared_ptr<Workspace>& workspace,
                          const LogicalTime& begin_time,
                          const CommitFutureTree* commit_futures)
@@ -52,13 +58,14 @@ Transaction::Transaction(const std::shared_ptr<Workspace>& workspace,
       chunk_tracking_disabled_(false),
       is_parallel_commit_running_(false),
       finalized_(false) {
-  CHECK(begin_time < LogicalTime::sample());
+  registerActiveBeginTime(&begin_time_);
+  CHECK(begin_time_ < LogicalTime::sample());
   if (commit_futures != nullptr) {
     for (const CommitFutureTree::value_type& table_commit_futures :
          *commit_futures) {
       net_table_transactions_[table_commit_futures.first] =
           std::shared_ptr<NetTableTransaction>(new NetTableTransaction(
-              begin_time, *workspace, &table_commit_futures.second,
+              begin_time_, *workspace, &table_commit_futures.second,
               table_commit_futures.first));
     }
   }
@@ -67,18 +74,29 @@ Transaction::Transaction(const std::shared_ptr<Workspace>& workspace,
 Transaction::Transaction(const std::shared_ptr<Workspace>& workspace,
                          const LogicalTime& begin_time)
     : Transaction(workspace, begin_time, nullptr) {}
+// An invalid begin time is sampled in registerActiveBeginTime().
 Transaction::Transaction()
-    : Transaction(std::shared_ptr<Workspace>(new Workspace),
-                  LogicalTime::sample()) {}
+    : Transaction(std::shared_ptr<Workspace>(new Workspace), LogicalTime()) {}
 Transaction::Transaction(const std::shared_ptr<Workspace>& workspace)
-    : Transaction(workspace, LogicalTime::sample()) {}
+    : Transaction(workspace, LogicalTime()) {}
 Transaction::Transaction(const LogicalTime& begin_time)
     : Transaction(std::shared_ptr<Workspace>(new Workspace), begin_time) {}
 Transaction::Transaction(const CommitFutureTree& commit_futures)
-    : Transaction(std::shared_ptr<Workspace>(new Workspace),
-                  LogicalTime::sample(), &commit_futures) {}
+    : Transaction(std::shared_ptr<Workspace>(new Workspace), LogicalTime(),
+                  &commit_futures) {}
+
+Transaction::~Transaction() {
+  joinParallelCommitIfRunning();
+  unregisterActiveBeginTime(begin_time_);
+}
 
-Transaction::~Transaction() { joinParallelCommitIfRunning(); }
+LogicalTime Transaction::oldestActiveBeginTime() {
+  std::lock_guard<std::mutex> lock(active_begin_times_mutex_);
+  if (active_begin_times_.empty()) {
+    return LogicalTime::sample();
+  }
+  return *active_begin_times_.begin();
+}
 
 void Transaction::dumpChunk(NetTable* table, ChunkBase* chunk,
                             ConstRevisionMap* result) {
@@ -102,6 +120,25 @@ void Transaction::dumpActiveChunks(NetTable* table, ConstRevisionMap* result) {
   }
 }
 
+void Transaction::forEachItemInChunk(NetTable* table, ChunkBase* chunk,
+                                     const ItemAction& action) {
+  CHECK_NOTNULL(table);
+  CHECK_NOTNULL(chunk);
+  CHECK(action);
+  if (workspace_->contains(table, chunk->id())) {
+    transactionOf(table)->forEachItemInChunk(chunk, action);
+  }
+}
+
+void Transaction::forEachItemInActiveChunks(NetTable* table,
+                                            const ItemAction& action) {
+  CHECK_NOTNULL(table);
+  CHECK(action);
+  if (workspace_->contains(table)) {
+    transactionOf(table)->forEachItemInActiveChunks(action);
+  }
+}
+
 bool Transaction::fetchAllChunksTrackedByItemsInTable(NetTable* const table) {
   CHECK_NOTNULL(table);
   std::vector<map_api_common::Id> item_ids;
@@ -115,9 +152,6 @@ bool Transaction::fetchAllChunksTrackedByItemsInTable(NetTable* const table) {
     }
   }
   disableDirectAccess();
-  refreshIdToChunkIdMaps();
-  // Id to chunk id maps must be refreshed first, otherwise getAvailableIds will
-  // nor work.
   refreshAvailableIdsInCaches();
   return success;
 }
@@ -234,12 +268,7 @@ size_t Transaction::numChangedItems() const {
   return count;
 }
 
-void Transaction::refreshIdToChunkIdMaps() {
-  CHECK(!finalized_);
-  for (TransactionPair& net_table_transaction : net_table_transactions_) {
-    net_table_transaction.second->refreshIdToChunkIdMap();
-  }
-}
+void Transaction::refreshIdToChunkIdMaps() { CHECK(!finalized_); }
 
 void Transaction::refreshAvailableIdsInCaches() {
   CHECK(!finalized_);
@@ -385,19 +414,43 @@ void Transaction::commitImpl(const bool finalize_after_check,
   for (const CacheMap::value_type& cache_pair : caches_) {
     cache_pair.second->discardCachedInsertions();
   }
+  internal::WorkerPool& worker_pool = internal::WorkerPool::instance();
+  std::vector<NetTableTransaction*> table_transactions;
+  table_transactions.reserve(net_table_transactions_.size());
   for (const TransactionPair& net_table_transaction : net_table_transactions_) {
-    net_table_transaction.second->lock();
+    table_transactions.push_back(net_table_transaction.second.get());
   }
-  for (const TransactionPair& net_table_transaction : net_table_transactions_) {
-    if (!net_table_transaction.second->hasNoConflicts()) {
-      will_commit_succeed->set_value(false);
-      for (const TransactionPair& net_table_transaction :
-           net_table_transactions_) {
-        net_table_transaction.second->unlock();
+  std::atomic<bool> has_conflicts(false);
+  // A transaction that already conflicts with the local replicas would only
+  // cause a futile round of distributed locking.
+  if (FLAGS_map_api_optimistic_commit_check) {
+    worker_pool.parallelFor(table_transactions.size(), [&](size_t i) {
+      if (!has_conflicts && !table_transactions[i]->hasNoVisibleConflicts()) {
+        has_conflicts = true;
       }
+    });
+    if (has_conflicts) {
+      will_commit_succeed->set_value(false);
       return;
     }
   }
+  // Locks are acquired in the global order to prevent deadlocks. Once all are
+  // held, the tables can be checked, committed and unlocked concurrently.
+  for (NetTableTransaction* table_transaction : table_transactions) {
+    table_transaction->lock();
+  }
+  worker_pool.parallelFor(table_transactions.size(), [&](size_t i) {
+    if (!has_conflicts && !table_transactions[i]->hasNoConflicts()) {
+      has_conflicts = true;
+    }
+  });
+  if (has_conflicts) {
+    will_commit_succeed->set_value(false);
+    worker_pool.parallelFor(table_transactions.size(), [&](size_t i) {
+      table_transactions[i]->unlock();
+    });
+    return;
+  }
 
   if (finalize_after_check) {
     finalize();
@@ -414,10 +467,10 @@ void Transaction::commitImpl(const bool finalize_after_check,
   // subsequent transaction must be after the commit time.
   will_commit_succeed->set_value(true);
   VLOG(4) << "Commit from " << begin_time_ << " to " << commit_time_;
-  for (const TransactionPair& net_table_transaction : net_table_transactions_) {
-    net_table_transaction.second->checkedCommit(commit_time_);
-    net_table_transaction.second->unlock();
-  }
+  worker_pool.parallelFor(table_transactions.size(), [&](size_t i) {
+    table_transactions[i]->checkedCommit(commit_time_);
+    table_transactions[i]->unlock();
+  });
 }
 
 void Transaction::finalize() {
@@ -427,4 +480,21 @@ void Transaction::finalize() {
   }
 }
 
+void Transaction::registerActiveBeginTime(LogicalTime* begin_time) {
+  CHECK_NOTNULL(begin_time);
+  std::lock_guard<std::mutex> lock(active_begin_times_mutex_);
+  if (!begin_time->isValid()) {
+    *begin_time = LogicalTime::sample();
+  }
+  active_begin_times_.insert(*begin_time);
+}
+
+void Transaction::unregisterActiveBeginTime(const LogicalTime& begin_time) {
+  std::lock_guard<std::mutex> lock(active_begin_times_mutex_);
+  std::multiset<LogicalTime>::iterator found =
+      active_begin_times_.find(begin_time);
+  CHECK(found != active_begin_times_.end());
+  active_begin_times_.erase(found);
+}
+
 }  // namespace map_api */
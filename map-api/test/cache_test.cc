@@ -19,7 +19,9 @@
 // You should have received a copy of the GNU General Public License
 // along with Map API. If not, see <http://www.gnu.org/licenses/>.
 
+#include <memory>
 #include <set>
+#include <vector>
 
 #include <glog/logging.h>
 #include <gtest/gtest.h>
@@ -138,6 +140,50 @@ TEST_F(CacheTest, GeneralTest) {
   }
 }
 
+TEST_F(CacheTest, SharesObjectsAcrossTransactions) {
+  initCacheView();
+  EXPECT_TRUE(cache_->insert(IdData::get<1>(), IntData::get<1>()));
+  EXPECT_TRUE(transaction_->commit());
+
+  initCacheView();
+  const int* shared_object = &cache_->get(IdData::get<1>());
+  initCacheView();
+  EXPECT_EQ(shared_object, &cache_->get(IdData::get<1>()));
+
+  // Copy on write.
+  cache_->getMutable(IdData::get<1>()) = IntData::get<2>();
+  EXPECT_EQ(IntData::get<1>(), *shared_object);
+  EXPECT_EQ(IntData::get<2>(), cache_->get(IdData::get<1>()));
+  EXPECT_TRUE(transaction_->commit());
+
+  initCacheView();
+  EXPECT_EQ(IntData::get<2>(), cache_->get(IdData::get<1>()));
+}
+
+TEST_F(CacheTest, MemoryBudgetReleasesEvictedObjects) {
+  constexpr int kNumItems = 100;
+  initCacheView();
+  std::vector<IntId> ids(kNumItems);
+  for (int i = 0; i < kNumItems; ++i) {
+    generateId(&ids[i]);
+    EXPECT_TRUE(cache_->insert(ids[i], i));
+  }
+  EXPECT_TRUE(transaction_->commit());
+
+  typedef internal::SharedObjectCache<IntId, int> SharedObjects;
+  SharedObjects::instance().clear();
+  initCacheView();
+  // Every load evicts all other clean objects.
+  cache_->setMemoryBudget(0u, [](const int&) { return sizeof(int); });
+  const std::shared_ptr<const int> first = cache_->getShared(ids[0]);
+  for (int i = 0; i < kNumItems; ++i) {
+    EXPECT_EQ(i, *cache_->getShared(ids[i]));
+  }
+  EXPECT_EQ(0, *first);
+  // Nothing keeps evicted objects alive.
+  EXPECT_EQ(0u, SharedObjects::instance().size());
+}
+
 }  // namespace map_api
 
 MAP_API_UNITTEST_ENTRYPOINT
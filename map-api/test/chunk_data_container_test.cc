@@ -19,20 +19,37 @@
 // You should have received a copy of the GNU General Public License
 // along with Map API. If not, see <http://www.gnu.org/licenses/>.
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>  // NOLINT
+#include <mutex>
 #include <string>
+#include <thread>
 #include <type_traits>
+#include <unordered_set>
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 #include <map-api-common/unique-id.h>
 
 #include "map-api/core.h"
+#include "map-api/legacy-chunk-data-mmap-container.h"
 #include "map-api/legacy-chunk-data-ram-container.h"
 #include "map-api/legacy-chunk-data-stxxl-container.h"
 #include "map-api/logical-time.h"
 #include "map-api/test/testing-entrypoint.h"
 #include "./test_table.cc"
 
+DECLARE_double(map_api_history_compaction_min_dead_fraction);
+DECLARE_int32(map_api_lazy_field_parsing_min_bytes);
+DECLARE_uint64(map_api_stxxl_cache_pages);
+DECLARE_string(map_api_stxxl_pager);
+DECLARE_uint64(map_api_stxxl_store_shards);
+
 namespace map_api {
 
 template <typename TableType>
@@ -309,6 +326,30 @@ TYPED_TEST(FieldTestWithInit, CreateRead) {
   EXPECT_EQ(this->sample_data_1(), dataFromTable);
 }
 
+TYPED_TEST(FieldTestWithInit, ForEachItemAllowsContainerAccess) {
+  constexpr size_t kNumItems = 3u;
+  std::unordered_set<map_api_common::Id> inserted;
+  for (size_t i = 0u; i < kNumItems; ++i) {
+    inserted.emplace(this->fillRevision());
+    EXPECT_TRUE(this->insertRevision());
+  }
+
+  const LogicalTime time = LogicalTime::sample();
+  size_t num_visited = 0u;
+  // The container is not locked while the action runs.
+  this->table_->forEachItem(
+      time, [&](const map_api_common::Id& id,
+                const std::shared_ptr<const Revision>& item) {
+        ASSERT_TRUE(static_cast<bool>(item));
+        EXPECT_EQ(1u, inserted.count(id));
+        std::shared_ptr<const Revision> read = this->table_->getById(id, time);
+        ASSERT_TRUE(static_cast<bool>(read));
+        EXPECT_TRUE(*item == *read);
+        ++num_visited;
+      });
+  EXPECT_EQ(kNumItems, num_visited);
+}
+
 TYPED_TEST(FieldTestWithInit, ReadInexistentRow) {
   this->fillRevision();
   EXPECT_TRUE(this->insertRevision());
@@ -368,6 +409,89 @@ TYPED_TEST(IntTestWithInit, CreateReadThousand) {
   }
 }
 
+TYPED_TEST(IntTestWithInit, FindHistoryWithShardedStore) {
+  google::FlagSaver flag_saver;
+  FLAGS_map_api_stxxl_store_shards = 3u;
+  FLAGS_map_api_stxxl_cache_pages = 2u;
+  FLAGS_map_api_stxxl_pager = "random";
+  this->table_.reset(
+      FieldTestTable<TableDataTypes<TypeParam, int64_t>>::forge());
+  constexpr int kNumItems = 100;
+  for (int i = 0; i < kNumItems; ++i) {
+    this->fillRevision(i);
+    ASSERT_TRUE(this->insertRevision());
+  }
+  const LogicalTime before_updates = LogicalTime::sample();
+  std::vector<map_api_common::Id> ids;
+  this->table_->getAvailableIds(before_updates, &ids);
+  ASSERT_EQ(static_cast<size_t>(kNumItems), ids.size());
+  for (const map_api_common::Id& id : ids) {
+    this->getRevision(id);
+    std::shared_ptr<Revision> revision;
+    this->query_->copyForWrite(&revision);
+    this->table_->update(LogicalTime::sample(), revision);
+  }
+
+  LegacyChunkDataContainerBase::HistoryMap histories;
+  this->table_->findHistory(-1, 0, LogicalTime::sample(), &histories);
+  ASSERT_EQ(static_cast<size_t>(kNumItems), histories.size());
+  for (const LegacyChunkDataContainerBase::HistoryMap::value_type& history :
+       histories) {
+    ASSERT_EQ(2u, history.second.size());
+    EXPECT_EQ(history.first,
+              history.second.front()->template getId<map_api_common::Id>());
+    EXPECT_GT(history.second.front()->getUpdateTime(),
+              history.second.back()->getUpdateTime());
+  }
+  this->table_->findHistory(-1, 0, before_updates, &histories);
+  for (const LegacyChunkDataContainerBase::HistoryMap::value_type& history :
+       histories) {
+    EXPECT_EQ(1u, history.second.size());
+  }
+}
+
+TYPED_TEST(IntTestWithInit, ConcurrentGetByIdWithWriter) {
+  constexpr int kNumItems = 100;
+  constexpr int kNumReaders = 4;
+  constexpr int kNumSweeps = 20;
+  std::vector<map_api_common::Id> ids;
+  for (int i = 0; i < kNumItems; ++i) {
+    ids.emplace_back(this->fillRevision(i));
+    ASSERT_TRUE(this->insertRevision());
+  }
+  const LogicalTime time = LogicalTime::sample();
+
+  std::atomic<int> num_mismatches(0);
+  std::vector<std::thread> readers;
+  for (int reader = 0; reader < kNumReaders; ++reader) {
+    readers.emplace_back([&]() {
+      for (int sweep = 0; sweep < kNumSweeps; ++sweep) {
+        for (int i = 0; i < kNumItems; ++i) {
+          std::shared_ptr<const Revision> item =
+              this->table_->getById(ids[i], time);
+          int64_t value = -1;
+          if (!item ||
+              !item->get(FieldTestTable<TableDataTypes<TypeParam, int64_t>>::
+                             kTestField,
+                         &value) ||
+              value != i) {
+            ++num_mismatches;
+          }
+        }
+      }
+    });
+  }
+  // Writes take the lock exclusively and must not disturb the readers.
+  for (int i = 0; i < kNumItems; ++i) {
+    this->fillRevision(kNumItems + i);
+    ASSERT_TRUE(this->insertRevision());
+  }
+  for (std::thread& reader : readers) {
+    reader.join();
+  }
+  EXPECT_EQ(0, num_mismatches);
+}
+
 TYPED_TEST(CruMapIntTestWithInit, HistoryAtTime) {
   typedef FieldTestTable<TypeParam> FieldTestTableType;
   constexpr int64_t kFirst = 42, kSecond = 21, kThird = 84;
@@ -416,6 +540,485 @@ TYPED_TEST(CruMapIntTestWithInit, Remove) {
   EXPECT_EQ(0u, result.size());
 }
 
+TYPED_TEST(CruMapIntTestWithInit, CompactHistory) {
+  typedef FieldTestTable<TypeParam> FieldTestTableType;
+  constexpr int64_t kFirst = 42, kSecond = 21, kThird = 84;
+  map_api_common::Id id = this->fillRevision(kFirst);
+  ASSERT_TRUE(this->insertRevision());
+  this->getRevision(id);
+  this->query_->set(FieldTestTableType::kTestField, kSecond);
+  ASSERT_TRUE(this->updateRevision());
+  LogicalTime watermark = LogicalTime::sample();
+  this->getRevision(id);
+  this->query_->set(FieldTestTableType::kTestField, kThird);
+  ASSERT_TRUE(this->updateRevision());
+
+  EXPECT_EQ(1u, this->table_->compact(watermark));
+  EXPECT_EQ(0u, this->table_->compact(watermark));
+
+  LegacyChunkDataContainerBase::History history;
+  this->table_->itemHistory(id, LogicalTime::sample(), &history);
+  EXPECT_EQ(2u, history.size());
+  int64_t value;
+  this->table_->getById(id, watermark)
+      ->get(FieldTestTableType::kTestField, &value);
+  EXPECT_EQ(kSecond, value);
+  this->table_->getById(id, LogicalTime::sample())
+      ->get(FieldTestTableType::kTestField, &value);
+  EXPECT_EQ(kThird, value);
+}
+
+TYPED_TEST(CruMapIntTestWithInit, CompactRemoved) {
+  constexpr int64_t kValue = 42;
+  map_api_common::Id id = this->fillRevision(kValue);
+  ASSERT_TRUE(this->insertRevision());
+  this->getRevision(id);
+  this->table_->remove(LogicalTime::sample(), this->query_);
+
+  EXPECT_EQ(2u, this->table_->compact(LogicalTime::sample()));
+  std::vector<map_api_common::Id> ids;
+  this->table_->getAvailableIds(LogicalTime::sample(), &ids);
+  EXPECT_TRUE(ids.empty());
+  EXPECT_FALSE(this->table_->getById(id, LogicalTime::sample()));
+}
+
+TYPED_TEST(CruMapIntTestWithInit, BulkPatch) {
+  typedef FieldTestTable<TypeParam> FieldTestTableType;
+  constexpr int kNumItems = 10;
+  for (int i = 0; i < kNumItems; ++i) {
+    map_api_common::Id id = this->fillRevision(i);
+    ASSERT_TRUE(this->insertRevision());
+    this->getRevision(id);
+    this->query_->set(FieldTestTableType::kTestField, i + kNumItems);
+    ASSERT_TRUE(this->updateRevision());
+  }
+  LegacyChunkDataContainerBase::HistoryMap histories;
+  this->table_->findHistory(-1, 0, LogicalTime::sample(), &histories);
+  ASSERT_EQ(static_cast<size_t>(kNumItems), histories.size());
+  // Histories are newest first, so this patches in the worst order.
+  std::vector<std::shared_ptr<const Revision> > revisions;
+  for (const LegacyChunkDataContainerBase::HistoryMap::value_type& history :
+       histories) {
+    revisions.insert(revisions.end(), history.second.begin(),
+                     history.second.end());
+  }
+
+  std::unique_ptr<LegacyChunkDataContainerBase> patched(
+      FieldTestTableType::forge());
+  EXPECT_TRUE(patched->bulkPatch(&revisions));
+  for (size_t i = 1u; i < revisions.size(); ++i) {
+    EXPECT_LT(revisions[i - 1]->getUpdateTime(),
+              revisions[i]->getUpdateTime());
+  }
+  LegacyChunkDataContainerBase::HistoryMap patched_histories;
+  patched->findHistory(-1, 0, LogicalTime::sample(), &patched_histories);
+  ASSERT_EQ(histories.size(), patched_histories.size());
+  for (const LegacyChunkDataContainerBase::HistoryMap::value_type& history :
+       histories) {
+    const LegacyChunkDataContainerBase::History& patched_history =
+        patched_histories[history.first];
+    ASSERT_EQ(history.second.size(), patched_history.size());
+    EXPECT_TRUE(std::equal(
+        history.second.begin(), history.second.end(), patched_history.begin(),
+        [](const std::shared_ptr<const Revision>& lhs,
+           const std::shared_ptr<const Revision>& rhs) {
+          return *lhs == *rhs;
+        }));
+  }
+}
+
+// Blocks each getById() until "num_readers" of them are inside the container
+// at the same time, or until a timeout, and records the highest amount of
+// concurrent readers seen.
+class ConcurrentReadContainer : public ChunkDataContainerBase {
+ public:
+  explicit ConcurrentReadContainer(int num_readers)
+      : num_readers_(num_readers), num_inside_(0), max_inside_(0) {}
+
+  int maxConcurrentReaders() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return max_inside_;
+  }
+
+ private:
+  virtual bool initImpl() final override { return true; }
+  virtual std::shared_ptr<const Revision> getByIdImpl(
+      const map_api_common::Id& /*id*/,
+      const LogicalTime& /*time*/) const final override {
+    std::unique_lock<std::mutex> lock(mutex_);
+    ++num_inside_;
+    max_inside_ = std::max(max_inside_, num_inside_);
+    cv_.notify_all();
+    cv_.wait_for(lock, std::chrono::seconds(10),
+                 [this]() { return max_inside_ >= num_readers_; });
+    --num_inside_;
+    return std::shared_ptr<const Revision>();
+  }
+  virtual void findByRevisionImpl(int /*key*/,
+                                  const Revision& /*valueHolder*/,
+                                  const LogicalTime& /*time*/,
+                                  ConstRevisionMap* /*dest*/) const final
+      override {}
+  virtual void getAvailableIdsImpl(
+      const LogicalTime& /*time*/,
+      std::vector<map_api_common::Id>* /*ids*/) const final override {}
+  virtual int countByRevisionImpl(int /*key*/,
+                                  const Revision& /*valueHolder*/,
+                                  const LogicalTime& /*time*/) const final
+      override {
+    return 0;
+  }
+
+  const int num_readers_;
+  mutable std::mutex mutex_;
+  mutable std::condition_variable cv_;
+  mutable int num_inside_;
+  mutable int max_inside_;
+};
+
+TEST(ChunkDataContainerLockTest, GetByIdCallsProceedConcurrently) {
+  constexpr int kNumReaders = 4;
+  ConcurrentReadContainer container(kNumReaders);
+  std::shared_ptr<TableDescriptor> descriptor(new TableDescriptor);
+  descriptor->setName("concurrent_read_table");
+  ASSERT_TRUE(container.init(descriptor));
+
+  std::vector<std::thread> readers;
+  for (int i = 0; i < kNumReaders; ++i) {
+    readers.emplace_back([&container]() {
+      map_api_common::Id id;
+      generateId(&id);
+      EXPECT_FALSE(container.getById(id, LogicalTime::sample()));
+    });
+  }
+  for (std::thread& reader : readers) {
+    reader.join();
+  }
+  // With an exclusive container lock, each reader would time out alone.
+  EXPECT_EQ(kNumReaders, container.maxConcurrentReaders());
+}
+
+TEST(RevisionArenaTest, ArenaOutlivesCreator) {
+  std::shared_ptr<proto::Revision> source_proto(new proto::Revision);
+  source_proto->add_custom_field_values()->set_type(proto::Type::INT32);
+  source_proto->mutable_custom_field_values(0)->set_int_value(42);
+  std::shared_ptr<Revision> source;
+  Revision::fromProto(source_proto, &source);
+
+  Revision::ArenaPtr arena = Revision::createArena();
+  std::weak_ptr<google::protobuf::Arena> weak_arena = arena;
+  std::shared_ptr<Revision> copy;
+  source->copyForWrite(arena, &copy);
+  std::shared_ptr<Revision> parsed =
+      Revision::fromProtoString(source->serializeUnderlying(), arena);
+  arena.reset();
+
+  ASSERT_FALSE(weak_arena.expired());
+  EXPECT_TRUE(*copy == *source);
+  EXPECT_TRUE(*parsed == *source);
+  ASSERT_TRUE(copy->set(0, 21));
+  int32_t value;
+  ASSERT_TRUE(source->get(0, &value));
+  EXPECT_EQ(42, value);
+
+  copy.reset();
+  EXPECT_FALSE(weak_arena.expired());
+  parsed.reset();
+  EXPECT_TRUE(weak_arena.expired());
+}
+
+TEST(RevisionCopyOnWriteTest, CopiesShareUnchangedFields) {
+  std::shared_ptr<proto::Revision> source_proto(new proto::Revision);
+  proto::TableField* blob_field = source_proto->add_custom_field_values();
+  blob_field->set_type(proto::Type::BLOB);
+  blob_field->set_blob_value(std::string(1000, 'x'));
+  proto::TableField* int_field = source_proto->add_custom_field_values();
+  int_field->set_type(proto::Type::INT32);
+  int_field->set_int_value(42);
+  std::shared_ptr<Revision> source;
+  Revision::fromProto(source_proto, &source);
+
+  std::shared_ptr<Revision> copy;
+  source->copyForWrite(&copy);
+  std::vector<int> changed;
+  copy->getChangedCustomFields(&changed);
+  EXPECT_TRUE(changed.empty());
+  EXPECT_EQ(source->serializeUnderlying(), copy->serializeUnderlying());
+  EXPECT_EQ(source->byteSize(), copy->byteSize());
+
+  ASSERT_TRUE(copy->set(1, 21));
+  copy->getChangedCustomFields(&changed);
+  ASSERT_EQ(1u, changed.size());
+  EXPECT_EQ(1, changed[0]);
+  EXPECT_FALSE(copy->isCustomFieldChanged(0));
+
+  // Modifying the original must not affect the copy.
+  ASSERT_TRUE(source->set(0, Revision::Blob(10, 'y')));
+  Revision::Blob blob;
+  ASSERT_TRUE(copy->get(0, &blob));
+  EXPECT_EQ(1000u, blob.size());
+  int32_t value;
+  ASSERT_TRUE(source->get(1, &value));
+  EXPECT_EQ(42, value);
+
+  std::shared_ptr<Revision> parsed =
+      Revision::fromProtoString(copy->serializeUnderlying());
+  EXPECT_TRUE(*parsed == *copy);
+  EXPECT_EQ(static_cast<int>(copy->serializeUnderlying().size()),
+            copy->byteSize());
+
+  // Copy construction shares fields the same way, and keeps track of changes.
+  Revision constructed(*copy);
+  EXPECT_TRUE(constructed == *copy);
+  EXPECT_TRUE(constructed.isCustomFieldChanged(1));
+  EXPECT_FALSE(constructed.isCustomFieldChanged(0));
+  ASSERT_TRUE(constructed.set(1, 84));
+  ASSERT_TRUE(copy->get(1, &value));
+  EXPECT_EQ(21, value);
+}
+
+TEST(RevisionFieldDeltaTest, DeltaOnlyCarriesChangedFields) {
+  std::shared_ptr<proto::Revision> base_proto(new proto::Revision);
+  map_api_common::Id id;
+  map_api_common::generateId(&id);
+  id.serialize(base_proto->mutable_id());
+  base_proto->set_update_time(LogicalTime::sample().serialize());
+  proto::TableField* blob_field = base_proto->add_custom_field_values();
+  blob_field->set_type(proto::Type::BLOB);
+  blob_field->set_blob_value(std::string(1000, 'x'));
+  proto::TableField* int_field = base_proto->add_custom_field_values();
+  int_field->set_type(proto::Type::INT32);
+  int_field->set_int_value(42);
+  std::shared_ptr<const Revision> base;
+  Revision::fromProto(base_proto, &base);
+
+  std::shared_ptr<Revision> update;
+  base->copyForWrite(&update);
+  ASSERT_TRUE(update->set(1, 21));
+  std::vector<int> changed;
+  update->getCustomFieldsChangedFrom(*base, &changed);
+  ASSERT_EQ(1u, changed.size());
+  EXPECT_EQ(1, changed[0]);
+  const std::string delta_string = update->serializeFieldDelta(changed);
+  EXPECT_LT(delta_string.size(), 1000u);
+
+  std::shared_ptr<const Revision> delta =
+      Revision::fromProtoString(delta_string);
+  ASSERT_TRUE(base->isFieldDeltaApplicable(*delta, changed));
+  std::shared_ptr<Revision> patched = base->applyFieldDelta(delta, changed);
+  EXPECT_TRUE(*patched == *update);
+  EXPECT_EQ(update->serializeUnderlying(), patched->serializeUnderlying());
+  // Deltas that don't match the base are rejected rather than applied.
+  EXPECT_FALSE(base->isFieldDeltaApplicable(*delta, std::vector<int>({0})));
+  EXPECT_FALSE(base->isFieldDeltaApplicable(*delta, std::vector<int>({2})));
+  EXPECT_FALSE(base->isFieldDeltaApplicable(*delta, std::vector<int>()));
+
+  // Unset fields that diverge from the base are sent as well.
+  std::shared_ptr<Revision> other;
+  update->copyForWrite(&other);
+  other->getCustomFieldsChangedFrom(*base, &changed);
+  ASSERT_EQ(1u, changed.size());
+  EXPECT_EQ(1, changed[0]);
+}
+
+TEST(RevisionLazyParsingTest, DecodesFieldsOnAccess) {
+  std::shared_ptr<proto::Revision> source_proto(new proto::Revision);
+  map_api_common::Id id;
+  map_api_common::generateId(&id);
+  id.serialize(source_proto->mutable_id());
+  source_proto->set_insert_time(LogicalTime::sample().serialize());
+  proto::TableField* blob_field = source_proto->add_custom_field_values();
+  blob_field->set_type(proto::Type::BLOB);
+  blob_field->set_blob_value(std::string(10000, 'x'));
+  proto::TableField* int_field = source_proto->add_custom_field_values();
+  int_field->set_type(proto::Type::INT32);
+  int_field->set_int_value(42);
+  std::shared_ptr<Revision> source;
+  Revision::fromProto(source_proto, &source);
+  const std::string serialized = source->serializeUnderlying();
+  ASSERT_GE(serialized.size(),
+            static_cast<size_t>(FLAGS_map_api_lazy_field_parsing_min_bytes));
+
+  std::shared_ptr<Revision> parsed = Revision::fromProtoString(serialized);
+  EXPECT_EQ(id, parsed->getId<map_api_common::Id>());
+  EXPECT_EQ(proto::Type::BLOB, parsed->getFieldType(0));
+  // Untouched fields are serialized and hashed as received.
+  EXPECT_EQ(serialized, parsed->serializeUnderlying());
+  EXPECT_EQ(static_cast<int>(serialized.size()), parsed->byteSize());
+  EXPECT_EQ(source->customFieldsHash(), parsed->customFieldsHash());
+  EXPECT_EQ(source->customFieldsByteSize(), parsed->customFieldsByteSize());
+  EXPECT_TRUE(*parsed == *source);
+
+  std::shared_ptr<Revision> copy;
+  parsed->copyForWrite(&copy);
+  ASSERT_TRUE(copy->set(1, 21));
+  int32_t value;
+  ASSERT_TRUE(parsed->get(1, &value));
+  EXPECT_EQ(42, value);
+  Revision::Blob blob;
+  ASSERT_TRUE(copy->get(0, &blob));
+  EXPECT_EQ(10000u, blob.size());
+  // Decoded fields are serialized from their value, as their received form is
+  // released.
+  EXPECT_EQ(serialized, parsed->serializeUnderlying());
+  EXPECT_EQ(static_cast<int>(serialized.size()), parsed->byteSize());
+  EXPECT_EQ(source->customFieldsHash(), parsed->customFieldsHash());
+  EXPECT_EQ(source->customFieldsByteSize(), parsed->customFieldsByteSize());
+}
+
+class MmapContainerTest : public ::testing::Test {
+ protected:
+  enum Fields {
+    kTestField
+  };
+  static constexpr char kSegmentFile[] = "/tmp/map_api_mmap_container_test";
+
+  virtual void SetUp() override {
+    Core::initializeInstance();
+    ASSERT_TRUE(Core::instance() != nullptr);
+    std::remove(kSegmentFile);
+    restart();
+  }
+  virtual void TearDown() override {
+    container_.reset();
+    std::remove(kSegmentFile);
+    Core::instance()->kill();
+  }
+
+  void restart() {
+    container_.reset(new LegacyChunkDataMmapContainer(kSegmentFile));
+    std::shared_ptr<TableDescriptor> descriptor(new TableDescriptor);
+    descriptor->setName("mmap_test_table");
+    descriptor->addField<int64_t>(kTestField);
+    ASSERT_TRUE(container_->init(descriptor));
+  }
+
+  map_api_common::Id insert(int64_t value) {
+    std::shared_ptr<Revision> revision = container_->getTemplate();
+    map_api_common::Id id;
+    generateId(&id);
+    revision->setId(id);
+    revision->set(kTestField, value);
+    EXPECT_TRUE(container_->insert(LogicalTime::sample(), revision));
+    return id;
+  }
+
+  void update(const map_api_common::Id& id, int64_t value) {
+    std::shared_ptr<Revision> revision;
+    container_->getById(id, LogicalTime::sample())->copyForWrite(&revision);
+    revision->set(kTestField, value);
+    container_->update(LogicalTime::sample(), revision);
+  }
+
+  int64_t get(const map_api_common::Id& id) {
+    int64_t value;
+    std::shared_ptr<const Revision> revision =
+        container_->getById(id, LogicalTime::sample());
+    CHECK(revision);
+    revision->get(kTestField, &value);
+    return value;
+  }
+
+  std::unique_ptr<LegacyChunkDataMmapContainer> container_;
+};
+
+constexpr char MmapContainerTest::kSegmentFile[];
+
+TEST_F(MmapContainerTest, Restart) {
+  constexpr int64_t kFirst = 42, kSecond = 21, kThird = 84;
+  const map_api_common::Id updated = insert(kFirst);
+  const map_api_common::Id other = insert(kThird);
+  update(updated, kSecond);
+
+  restart();
+  EXPECT_EQ(2, container_->count(-1, 0, LogicalTime::sample()));
+  EXPECT_EQ(kSecond, get(updated));
+  EXPECT_EQ(kThird, get(other));
+  LegacyChunkDataContainerBase::History history;
+  container_->itemHistory(updated, LogicalTime::sample(), &history);
+  EXPECT_EQ(2u, history.size());
+
+  // Data written after a restart must survive the next one.
+  update(other, kFirst);
+  restart();
+  EXPECT_EQ(kFirst, get(other));
+}
+
+TEST_F(MmapContainerTest, CompactAndRestart) {
+  constexpr int64_t kFirst = 42, kSecond = 21;
+  const double min_dead_fraction =
+      FLAGS_map_api_history_compaction_min_dead_fraction;
+  // Any dropped revision makes compaction rewrite the segment.
+  FLAGS_map_api_history_compaction_min_dead_fraction = 0.;
+  const map_api_common::Id id = insert(kFirst);
+  update(id, kSecond);
+  EXPECT_EQ(1u, container_->compact(LogicalTime::sample()));
+  FLAGS_map_api_history_compaction_min_dead_fraction = min_dead_fraction;
+
+  restart();
+  LegacyChunkDataContainerBase::History history;
+  container_->itemHistory(id, LogicalTime::sample(), &history);
+  EXPECT_EQ(1u, history.size());
+  EXPECT_EQ(kSecond, get(id));
+}
+
+TEST_F(MmapContainerTest, CompactRewritesOnlyMostlyDeadSegments) {
+  constexpr int kNumItems = 10;
+  const map_api_common::Id updated = insert(0);
+  for (int i = 1; i < kNumItems; ++i) {
+    insert(i);
+  }
+  update(updated, kNumItems);
+
+  // One of eleven records is dead, which isn't worth a rewrite.
+  EXPECT_EQ(1u, container_->compact(LogicalTime::sample()));
+  LegacyChunkDataContainerBase::History history;
+  container_->itemHistory(updated, LogicalTime::sample(), &history);
+  EXPECT_EQ(1u, history.size());
+  // The dropped revision is still in the segment, so it is restored.
+  restart();
+  container_->itemHistory(updated, LogicalTime::sample(), &history);
+  EXPECT_EQ(2u, history.size());
+  EXPECT_EQ(kNumItems, get(updated));
+}
+
+TEST_F(MmapContainerTest, RestoresLatestModificationTime) {
+  const map_api_common::Id id = insert(42);
+  update(id, 21);
+  const LogicalTime latest = container_->latestModificationTime();
+  EXPECT_EQ(container_->getById(id, LogicalTime::sample())->getUpdateTime(),
+            latest);
+
+  restart();
+  EXPECT_EQ(latest, container_->latestModificationTime());
+}
+
+TEST_F(MmapContainerTest, RemoveSegment) {
+  const map_api_common::Id id = insert(42);
+  container_->removeSegment();
+  EXPECT_FALSE(std::ifstream(kSegmentFile).good());
+  EXPECT_FALSE(container_->getById(id, LogicalTime::sample()));
+
+  restart();
+  EXPECT_EQ(0, container_->count(-1, 0, LogicalTime::sample()));
+}
+
+TEST(MmapContainerSegmentFileNameTest, QualifiedByTable) {
+  map_api_common::Id chunk_id, parsed;
+  generateId(&chunk_id);
+  const std::string path = LegacyChunkDataMmapContainer::segmentFileName(
+      "/tmp", "some_table", chunk_id);
+  EXPECT_EQ(0u, path.find("/tmp/"));
+  const std::string file_name = path.substr(path.rfind('/') + 1u);
+  ASSERT_TRUE(LegacyChunkDataMmapContainer::parseSegmentFileName(
+      file_name, "some_table", &parsed));
+  EXPECT_EQ(chunk_id, parsed);
+  EXPECT_FALSE(LegacyChunkDataMmapContainer::parseSegmentFileName(
+      file_name, "table", &parsed));
+  EXPECT_FALSE(LegacyChunkDataMmapContainer::parseSegmentFileName(
+      file_name, "some", &parsed));
+}
+
 }  // namespace map_api
 
 MAP_API_UNITTEST_ENTRYPOINT
@@ -19,7 +19,12 @@
 // You should have received a copy of the GNU General Public License
 // along with Map API. If not, see <http://www.gnu.org/licenses/>.
 
+#include <chrono>
+#include <memory>
 #include <set>
+#include <thread>
+#include <unordered_set>
+#include <vector>
 
 #include <glog/logging.h>
 #include <gtest/gtest.h>
@@ -33,6 +38,42 @@ namespace map_api {
 
 class ChunkTest : public NetTableFixture {};
 
+namespace {
+
+// Counts the lookups that reach the wrapped view.
+class LookupCountingView : public internal::ViewBase {
+ public:
+  explicit LookupCountingView(std::unique_ptr<internal::ViewBase> wrapped)
+      : wrapped_(std::move(wrapped)), num_lookups_(0u) {}
+
+  virtual bool tryGet(const map_api_common::Id& id,
+                      std::shared_ptr<const Revision>* result) const override {
+    ++num_lookups_;
+    return wrapped_->tryGet(id, result);
+  }
+  virtual void dump(ConstRevisionMap* result) const override {
+    wrapped_->dump(result);
+  }
+  virtual void forEach(const ItemAction& action) const override {
+    wrapped_->forEach(action);
+  }
+  virtual void getAvailableIds(
+      std::unordered_set<map_api_common::Id>* result) const override {
+    wrapped_->getAvailableIds(result);
+  }
+  virtual void discardKnownUpdates(UpdateTimes* update_times) const override {
+    wrapped_->discardKnownUpdates(update_times);
+  }
+
+  size_t numLookups() const { return num_lookups_; }
+
+ private:
+  const std::unique_ptr<internal::ViewBase> wrapped_;
+  mutable size_t num_lookups_;
+};
+
+}  // namespace
+
 TEST_F(ChunkTest, NetInsert) {
   ChunkBase* chunk = table_->newChunk();
   ASSERT_TRUE(chunk);
@@ -560,6 +601,98 @@ TEST_F(ChunkTest, GetCommitTimes) {
   EXPECT_TRUE(commit_times.find(second.getCommitTime()) != commit_times.end());
 }
 
+TEST_F(ChunkTest, ChunkTransactionsVisibleConflicts) {
+  ChunkBase* chunk = table_->newChunk();
+  ASSERT_TRUE(chunk);
+  const map_api_common::Id item_id = insert(1, chunk);
+  ChunkTransaction first(chunk, table_);
+  ChunkTransaction second(chunk, table_);
+  int value = 2;
+  for (ChunkTransaction* transaction : {&first, &second}) {
+    std::shared_ptr<Revision> revision;
+    transaction->getById(item_id)->copyForWrite(&revision);
+    revision->set(kFieldName, value++);
+    transaction->update(revision);
+  }
+  EXPECT_TRUE(first.hasNoVisibleConflicts());
+  EXPECT_TRUE(second.hasNoVisibleConflicts());
+  ASSERT_TRUE(first.commit());
+  // The conflict is detected without having to lock the chunk.
+  EXPECT_FALSE(second.hasNoVisibleConflicts());
+  EXPECT_FALSE(second.commit());
+}
+
+TEST_F(ChunkTest, ChunkTransactionLookupsPerGet) {
+  constexpr size_t kNumItems = 1000u;
+  ChunkBase* chunk = table_->newChunk();
+  ASSERT_TRUE(chunk);
+  std::vector<map_api_common::Id> item_ids;
+  for (size_t i = 0u; i < kNumItems; ++i) {
+    item_ids.emplace_back(insert(1, chunk));
+  }
+
+  ChunkTransaction transaction(chunk, table_);
+  std::shared_ptr<Revision> revision;
+  transaction.getById(item_ids[0])->copyForWrite(&revision);
+  revision->set(kFieldName, 2);
+  transaction.update(revision);
+  transaction.getById(item_ids[1])->copyForWrite(&revision);
+  transaction.remove(revision);
+
+  LookupCountingView* counting_view =
+      new LookupCountingView(std::move(transaction.original_view_));
+  transaction.original_view_.reset(counting_view);
+
+  const std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  size_t num_found = 0u;
+  for (const map_api_common::Id& item_id : item_ids) {
+    if (transaction.getById(item_id)) {
+      ++num_found;
+    }
+  }
+  const double seconds_per_get =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count() /
+      kNumItems;
+
+  EXPECT_EQ(kNumItems - 1u, num_found);
+  // Items changed in the delta are resolved without looking at the chunk, all
+  // others with exactly one lookup.
+  EXPECT_EQ(kNumItems - 2u, counting_view->numLookups());
+  LOG(INFO) << static_cast<double>(counting_view->numLookups()) / kNumItems
+            << " chunk lookups and " << seconds_per_get * 1e6
+            << " us per ChunkTransaction::getById";
+}
+
+TEST_F(ChunkTest, ScopedWriteLockAdoptionHandsLockBack) {
+  ChunkBase* chunk = table_->newChunk();
+  ASSERT_TRUE(chunk);
+  chunk->writeLock();
+  ASSERT_TRUE(chunk->isWriteLocked());
+
+  bool adopted = false;
+  std::thread worker([chunk, &adopted]() {
+    {
+      ChunkBase::ScopedWriteLockAdoption adoption(chunk);
+      adopted = chunk->isWriteLocked();
+    }
+    // The worker must not keep the lock once its task is done.
+    EXPECT_FALSE(chunk->isWriteLocked());
+  });
+  worker.join();
+  EXPECT_TRUE(adopted);
+  EXPECT_TRUE(chunk->isWriteLocked());
+
+  // Locks that are released by the adopting thread are not handed back.
+  std::thread unlocker([chunk]() {
+    ChunkBase::ScopedWriteLockAdoption adoption(chunk);
+    chunk->unlock();
+  });
+  unlocker.join();
+  EXPECT_FALSE(chunk->isWriteLocked());
+}
+
 }  // namespace map_api
 
 MAP_API_UNITTEST_ENTRYPOINT
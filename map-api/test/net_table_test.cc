@@ -19,18 +19,27 @@
 // You should have received a copy of the GNU General Public License
 // along with Map API. If not, see <http://www.gnu.org/licenses/>.
 
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
 #include <string>
+#include <unistd.h>
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 
 #include "map-api/ipc.h"
+#include "map-api/legacy-chunk-data-mmap-container.h"
 #include "map-api/net-table-manager.h"
 #include "map-api/net-table-transaction.h"
+#include "map-api/read-only-transaction.h"
 #include "map-api/test/testing-entrypoint.h"
 #include "map-api/transaction.h"
 #include "./net_table_fixture.h"
 
+DECLARE_string(map_api_chunk_segment_dir);
+
 namespace map_api {
 
 class NetTableTest : public NetTableFixture {};
@@ -292,24 +301,176 @@ TEST_F(NetTableTest, ChunkLookup) {
     IPC::barrier(CHUNK_CREATED, 1);
     table_->dumpActiveChunksAtCurrentTime(&results);
     EXPECT_EQ(0u, results.size());
-    map_api_common::Id chunk_id;
+    map_api_common::Id chunk_id, item_id;
     chunk_id = IPC::pop<map_api_common::Id>();
+    item_id = IPC::pop<map_api_common::Id>();
+    EXPECT_EQ(nullptr, table_->getActiveChunkOfItem(item_id));
     chunk = table_->getChunk(chunk_id);
     EXPECT_TRUE(chunk);
     table_->dumpActiveChunksAtCurrentTime(&results);
     EXPECT_EQ(1u, results.size());
+    // Items of joined chunks are indexed.
+    EXPECT_EQ(chunk, table_->getActiveChunkOfItem(item_id));
   }
   if (getSubprocessId() == SLAVE) {
     IPC::barrier(INIT, 1);
     chunk = table_->newChunk();
     EXPECT_TRUE(chunk);
-    insert(0, chunk);
+    map_api_common::Id item_id = insert(0, chunk);
     IPC::push(chunk->id());
+    IPC::push(item_id);
     IPC::barrier(CHUNK_CREATED, 1);
   }
   IPC::barrier(DIE, 1);
 }
 
+TEST_F(NetTableTest, ItemChunkIndex) {
+  ChunkBase* chunk = table_->newChunk();
+  ASSERT_TRUE(chunk);
+  Transaction earlier;
+  const map_api_common::Id item_id = insert(42, chunk);
+  EXPECT_EQ(chunk, table_->getActiveChunkOfItem(item_id));
+  map_api_common::Id unknown_id;
+  map_api_common::generateId(&unknown_id);
+  EXPECT_EQ(nullptr, table_->getActiveChunkOfItem(unknown_id));
+
+  // Transactions find the item without having to build an id-to-chunk map,
+  // but only if it existed at their begin time.
+  Transaction later;
+  EXPECT_TRUE(static_cast<bool>(later.getById(item_id, table_)));
+  EXPECT_FALSE(static_cast<bool>(earlier.getById(item_id, table_)));
+}
+
+TEST_F(NetTableTest, ItemChunkIndexForgetsLeftChunks) {
+  ChunkBase* left_chunk = table_->newChunk();
+  ChunkBase* kept_chunk = table_->newChunk();
+  ASSERT_TRUE(left_chunk);
+  ASSERT_TRUE(kept_chunk);
+  const map_api_common::Id left_chunk_id = left_chunk->id();
+  const map_api_common::Id left_item_id = insert(42, left_chunk);
+  const map_api_common::Id kept_item_id = insert(21, kept_chunk);
+
+  table_->leaveChunk(left_chunk_id);
+  EXPECT_EQ(nullptr, table_->getActiveChunkOfItem(left_item_id));
+  EXPECT_EQ(kept_chunk, table_->getActiveChunkOfItem(kept_item_id));
+  std::set<map_api_common::Id> chunk_ids;
+  table_->getActiveChunkIds(&chunk_ids);
+  EXPECT_EQ(0u, chunk_ids.count(left_chunk_id));
+}
+
+TEST_F(NetTableTest, CompactHistoryKeepsRevisionsVisibleToPeers) {
+  enum Processes {
+    ROOT,
+    A
+  };
+  enum Barriers {
+    INIT,
+    READER_BEGUN,
+    COMPACTED,
+    DIE
+  };
+  if (getSubprocessId() == ROOT) {
+    chunk_ = table_->newChunk();
+    item_id_ = insert(1, chunk_);
+    launchSubprocess(A);
+    IPC::barrier(INIT, 1);
+    IPC::push(chunk_->id());
+    IPC::push(item_id_);
+    IPC::barrier(READER_BEGUN, 1);
+    {
+      Transaction updater;
+      update(2, item_id_, &updater);
+      ASSERT_TRUE(updater.commit());
+    }
+    // A's reader, which hasn't fetched the chunk yet, still needs the first
+    // revision.
+    EXPECT_EQ(0u, table_->compactHistory());
+    IPC::barrier(COMPACTED, 1);
+    IPC::barrier(DIE, 1);
+    EXPECT_EQ(1u, table_->compactHistory());
+  }
+  if (getSubprocessId() == A) {
+    IPC::barrier(INIT, 1);
+    std::unique_ptr<ReadOnlyTransaction> reader(new ReadOnlyTransaction);
+    IPC::barrier(READER_BEGUN, 1);
+    chunk_id_ = IPC::pop<map_api_common::Id>();
+    item_id_ = IPC::pop<map_api_common::Id>();
+    IPC::barrier(COMPACTED, 1);
+    chunk_ = table_->getChunk(chunk_id_);
+    ASSERT_TRUE(chunk_);
+    std::shared_ptr<const Revision> revision =
+        reader->getById(item_id_, table_, chunk_);
+    ASSERT_TRUE(static_cast<bool>(revision));
+    EXPECT_TRUE(revision->verifyEqual(kFieldName, 1));
+    reader.reset();
+    IPC::barrier(DIE, 1);
+  }
+}
+
+TEST_F(NetTableTest, RestorePersistedChunk) {
+  enum Processes {
+    ROOT,
+    A
+  };
+  enum Barriers {
+    INIT,
+    JOINED,
+    LEFT,
+    UPDATED,
+    DIE
+  };
+  if (getSubprocessId() == ROOT) {
+    chunk_ = table_->newChunk();
+    item_id_ = insert(1, chunk_);
+    launchSubprocess(A);
+    IPC::barrier(INIT, 1);
+    IPC::push(chunk_->id());
+    IPC::push(item_id_);
+    IPC::barrier(JOINED, 1);
+    IPC::barrier(LEFT, 1);
+    {
+      Transaction updater;
+      update(2, item_id_, &updater);
+      ASSERT_TRUE(updater.commit());
+    }
+    IPC::barrier(UPDATED, 1);
+    IPC::barrier(DIE, 1);
+  }
+  if (getSubprocessId() == A) {
+    char segment_dir[] = "/tmp/map_api_net_table_test_XXXXXX";
+    ASSERT_TRUE(mkdtemp(segment_dir) != nullptr);
+    FLAGS_map_api_chunk_segment_dir = segment_dir;
+    IPC::barrier(INIT, 1);
+    chunk_id_ = IPC::pop<map_api_common::Id>();
+    item_id_ = IPC::pop<map_api_common::Id>();
+    ASSERT_TRUE(table_->getChunk(chunk_id_));
+    IPC::barrier(JOINED, 1);
+    table_->leaveChunk(chunk_id_);
+    IPC::barrier(LEFT, 1);
+    IPC::barrier(UPDATED, 1);
+
+    // The segment kept on leaving holds the first revision, the update
+    // committed since is fetched from the root.
+    EXPECT_EQ(1u, table_->restorePersistedChunks());
+    chunk_ = table_->getChunk(chunk_id_);
+    ASSERT_TRUE(chunk_);
+    LegacyChunkDataContainerBase::History history;
+    static_cast<const LegacyChunkDataContainerBase*>(chunk_->constData())
+        ->itemHistory(item_id_, LogicalTime::sample(), &history);
+    ASSERT_EQ(2u, history.size());
+    EXPECT_TRUE(history.front()->verifyEqual(kFieldName, 2));
+    EXPECT_TRUE(history.back()->verifyEqual(kFieldName, 1));
+
+    table_->leaveChunk(chunk_id_);
+    EXPECT_EQ(0, std::remove(LegacyChunkDataMmapContainer::segmentFileName(
+                                 segment_dir, table_->name(), chunk_id_)
+                                 .c_str()));
+    EXPECT_EQ(0, rmdir(segment_dir));
+    FLAGS_map_api_chunk_segment_dir.clear();
+    IPC::barrier(DIE, 1);
+  }
+}
+
 TEST_F(NetTableTest, ListenToChunksFromPeer) {
   enum Processes {
     MASTER,
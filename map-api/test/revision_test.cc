@@ -0,0 +1,64 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+#include <memory>
+
+#include <gtest/gtest.h>
+#include <map-api-common/unique-id.h>
+
+#include "./core.pb.h"
+#include "map-api/revision.h"
+#include "map-api/test/testing-entrypoint.h"
+
+namespace map_api {
+
+TEST(RevisionHash128Test, ReadsLegacyHexForm) {
+  map_api_common::Id id;
+  map_api_common::generateId(&id);
+  std::shared_ptr<proto::Revision> legacy_proto(new proto::Revision);
+  proto::TableField* legacy_field = legacy_proto->add_custom_field_values();
+  legacy_field->set_type(proto::Type::HASH128);
+  legacy_field->set_string_value(id.hexString());
+  std::shared_ptr<Revision> legacy;
+  Revision::fromProto(legacy_proto, &legacy);
+
+  map_api_common::Id read_id;
+  ASSERT_TRUE(legacy->get(0, &read_id));
+  EXPECT_EQ(id, read_id);
+
+  std::shared_ptr<Revision> compact;
+  legacy->copyForWrite(&compact);
+  ASSERT_TRUE(compact->set(0, id));
+  EXPECT_LT(compact->byteSize(), legacy->byteSize());
+  EXPECT_TRUE(compact->fieldMatch(*legacy, 0));
+  EXPECT_TRUE(legacy->fieldMatch(*compact, 0));
+  ASSERT_TRUE(compact->get(0, &read_id));
+  EXPECT_EQ(id, read_id);
+
+  map_api_common::Id other_id;
+  map_api_common::generateId(&other_id);
+  ASSERT_TRUE(compact->set(0, other_id));
+  EXPECT_FALSE(compact->fieldMatch(*legacy, 0));
+}
+
+}  // namespace map_api
+
+MAP_API_UNITTEST_ENTRYPOINT
@@ -0,0 +1,84 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+#include <memory>
+#include <string>
+#include <type_traits>
+
+#include <gtest/gtest.h>
+
+#include "map-api/table-schema.h"
+#include "map-api/test/testing-entrypoint.h"
+
+namespace map_api {
+
+enum TestFields { kName, kImage, kStatus, kParent };
+typedef TableSchema<std::string, Revision::Blob, int32_t, map_api_common::Id>
+    TestSchema;
+static_assert(TestSchema::kNumFields == 4, "Wrong number of fields");
+static_assert(
+    std::is_same<TestSchema::FieldType<kStatus>, int32_t>::value,
+    "Wrong field type");
+
+TEST(TableSchemaTest, TypedAccess) {
+  TableDescriptor descriptor;
+  descriptor.setName("schema_test_table");
+  TestSchema::addFields(&descriptor);
+  std::shared_ptr<Revision> revision = descriptor.getTemplate();
+  ASSERT_TRUE(TestSchema::matches(*revision));
+
+  map_api_common::Id parent;
+  map_api_common::generateId(&parent);
+  EXPECT_TRUE(TestSchema::set<kName>("keyframe", revision.get()));
+  EXPECT_TRUE(TestSchema::set<kImage>(Revision::Blob(100, 'x'),
+                                      revision.get()));
+  EXPECT_TRUE(TestSchema::set<kStatus>(3, revision.get()));
+  EXPECT_TRUE(TestSchema::set<kParent>(parent, revision.get()));
+
+  int32_t status;
+  EXPECT_TRUE(TestSchema::get<kStatus>(*revision, &status));
+  EXPECT_EQ(3, status);
+  map_api_common::Id parent_out;
+  EXPECT_TRUE(TestSchema::get<kParent>(*revision, &parent_out));
+  EXPECT_EQ(parent, parent_out);
+  EXPECT_EQ("keyframe", TestSchema::getBytes<kName>(*revision));
+  EXPECT_EQ(std::string(100, 'x'), TestSchema::getBytes<kImage>(*revision));
+
+  // Typed and untyped accesses are interchangeable.
+  std::string name;
+  EXPECT_TRUE(revision->get(kName, &name));
+  EXPECT_EQ("keyframe", name);
+}
+
+TEST(TableSchemaTest, DetectsMismatch) {
+  TableDescriptor descriptor;
+  descriptor.setName("schema_test_table");
+  descriptor.addField<std::string>(kName);
+  descriptor.addField<int32_t>(kImage);
+  EXPECT_FALSE(TestSchema::matches(*descriptor.getTemplate()));
+  descriptor.addField<int32_t>(kStatus);
+  descriptor.addField<map_api_common::Id>(kParent);
+  EXPECT_FALSE(TestSchema::matches(*descriptor.getTemplate()));
+}
+
+}  // namespace map_api
+
+MAP_API_UNITTEST_ENTRYPOINT
@@ -0,0 +1,471 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <map-api-common/mapped-container-base.h>
+#include <map-api-common/threadsafe-cache.h>
+
+#include "map-api/test/testing-entrypoint.h"
+
+namespace map_api_common {
+
+class IntCache : public ThreadsafeCache<int, int> {
+ public:
+  explicit IntCache(MappedContainerBase<int, int>* raw_container)
+      : ThreadsafeCache<int, int>(raw_container) {}
+
+ private:
+  virtual void rawToCacheImpl(const int& raw, int* cached) const
+      final override {
+    *CHECK_NOTNULL(cached) = raw;
+  }
+  virtual void cacheToRawImpl(const int& cached, int* raw) const
+      final override {
+    *CHECK_NOTNULL(raw) = cached;
+  }
+};
+
+// Counts the accesses to the wrapped container.
+class CountingContainer : public MappedContainerBase<int, int> {
+ public:
+  CountingContainer() : num_accesses_(0u) {}
+
+  virtual bool has(const int& id) const final override {
+    ++num_accesses_;
+    return map_.has(id);
+  }
+  virtual void getAllAvailableIds(std::vector<int>* available_ids) const
+      final override {
+    num_accesses_ += map_.size();
+    map_.getAllAvailableIds(available_ids);
+  }
+  virtual size_t size() const final override { return map_.size(); }
+  virtual bool empty() const final override { return map_.empty(); }
+  virtual int& getMutable(const int& id) final override {
+    ++num_accesses_;
+    return map_.getMutable(id);
+  }
+  virtual const int& get(const int& id) const final override {
+    ++num_accesses_;
+    return map_.get(id);
+  }
+  virtual bool insert(const int& id, const int& value) final override {
+    ++num_accesses_;
+    return map_.insert(id, value);
+  }
+  virtual void erase(const int& id) final override {
+    ++num_accesses_;
+    map_.erase(id);
+  }
+
+  size_t numAccesses() const { return num_accesses_; }
+
+ private:
+  HashMapContainer<int, int> map_;
+  mutable size_t num_accesses_;
+};
+
+class ThreadsafeCacheTest : public ::testing::Test {
+ protected:
+  static constexpr int kNumRawItems = 10000;
+
+  virtual void SetUp() {
+    for (int i = 0; i < kNumRawItems; ++i) {
+      raw_.insert(i, i);
+    }
+    cache_.reset(new IntCache(&raw_));
+  }
+
+  static size_t numThreads() {
+    return std::max(2u, std::thread::hardware_concurrency());
+  }
+
+  HashMapContainer<int, int> raw_;
+  std::unique_ptr<IntCache> cache_;
+};
+
+TEST_F(ThreadsafeCacheTest, ConcurrentAccess) {
+  const size_t num_threads = numThreads();
+  std::vector<std::thread> threads;
+  for (size_t thread = 0u; thread < num_threads; ++thread) {
+    threads.emplace_back([this, thread, num_threads]() {
+      for (int i = static_cast<int>(thread); i < kNumRawItems;
+           i += static_cast<int>(num_threads)) {
+        EXPECT_EQ(i, cache_->get(i));
+        if (i % 3 == 0) {
+          cache_->getMutable(i) = -i;
+        } else if (i % 3 == 1) {
+          cache_->erase(i);
+        }
+        EXPECT_TRUE(cache_->insert(kNumRawItems + i, i));
+        EXPECT_FALSE(cache_->insert(kNumRawItems + i, i));
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(static_cast<size_t>(kNumRawItems * 2 - (kNumRawItems + 1) / 3),
+            cache_->size());
+  cache_->flush();
+  EXPECT_EQ(cache_->size(), raw_.size());
+  for (int i = 0; i < kNumRawItems; ++i) {
+    EXPECT_EQ(i % 3 != 1, raw_.has(i));
+    if (i % 3 == 0) {
+      EXPECT_EQ(-i, raw_.get(i));
+    } else if (i % 3 == 2) {
+      EXPECT_EQ(i, raw_.get(i));
+    }
+    EXPECT_EQ(i, raw_.get(kNumRawItems + i));
+  }
+}
+
+TEST(ThreadsafeCacheFlushTest, FlushVisitsOnlyChanges) {
+  constexpr int kNumItems = 100000;
+  constexpr int kNumChanges = 100;
+  CountingContainer raw;
+  for (int i = 0; i < kNumItems; ++i) {
+    raw.insert(i, i);
+  }
+  IntCache cache(&raw);
+  for (int i = 0; i < kNumItems; ++i) {
+    ASSERT_EQ(i, cache.get(i));
+  }
+
+  for (int i = 0; i < kNumChanges; ++i) {
+    cache.getMutable(i) = -i;
+  }
+  cache.erase(kNumChanges);
+  ASSERT_TRUE(cache.insert(kNumItems, kNumItems));
+
+  const size_t num_accesses_before_flush = raw.numAccesses();
+  cache.flush();
+  // One getMutable(), insert() or erase() per change.
+  EXPECT_EQ(static_cast<size_t>(kNumChanges + 2),
+            raw.numAccesses() - num_accesses_before_flush);
+  EXPECT_EQ(-1, raw.get(1));
+  EXPECT_FALSE(raw.has(kNumChanges));
+  EXPECT_TRUE(raw.has(kNumItems));
+
+  const size_t num_accesses_before_second_flush = raw.numAccesses();
+  cache.flush();
+  EXPECT_EQ(num_accesses_before_second_flush, raw.numAccesses());
+}
+
+// Like the transaction interface of a cache, only knows about the ids that
+// were available when the ids were last listed.
+class StaleIdsContainer : public MappedContainerBase<int, int> {
+ public:
+  virtual bool has(const int& id) const final override {
+    return listed_ids_.count(id) != 0u;
+  }
+  virtual void getAllAvailableIds(std::vector<int>* available_ids) const
+      final override {
+    map_.getAllAvailableIds(available_ids);
+    listed_ids_.clear();
+    listed_ids_.insert(available_ids->begin(), available_ids->end());
+  }
+  virtual size_t size() const final override { return map_.size(); }
+  virtual bool empty() const final override { return map_.empty(); }
+  virtual int& getMutable(const int& id) final override {
+    return map_.getMutable(id);
+  }
+  virtual const int& get(const int& id) const final override {
+    return map_.get(id);
+  }
+  virtual bool insert(const int& id, const int& value) final override {
+    EXPECT_FALSE(map_.has(id)) << "Duplicate insertion of " << id;
+    return map_.insert(id, value);
+  }
+  virtual void erase(const int& id) final override { map_.erase(id); }
+
+ private:
+  HashMapContainer<int, int> map_;
+  mutable std::unordered_set<int> listed_ids_;
+};
+
+TEST(ThreadsafeCacheFlushTest, FlushUpdatesItemsLoadedAfterListing) {
+  StaleIdsContainer raw;
+  raw.insert(0, 0);
+  IntCache cache(&raw);
+  // E.g. an item of a chunk that is fetched after the cache was created.
+  raw.insert(1, 1);
+  ASSERT_FALSE(raw.has(1));
+
+  cache.getMutable(1) = -1;
+  cache.erase(0);
+  ASSERT_TRUE(cache.insert(2, 2));
+  // Items inserted and erased before a flush never reach the raw container.
+  ASSERT_TRUE(cache.insert(3, 3));
+  cache.erase(3);
+  cache.flush();
+  std::vector<int> ids;
+  raw.getAllAvailableIds(&ids);
+  std::sort(ids.begin(), ids.end());
+  EXPECT_EQ(std::vector<int>({1, 2}), ids);
+  EXPECT_EQ(-1, raw.get(1));
+  EXPECT_EQ(2, raw.get(2));
+}
+
+// Remembers the value each item had when it was last loaded or flushed, in
+// the second element, to skip updates of items that are dirty but unchanged.
+class ChangeDetectingIntCache
+    : public ThreadsafeCache<int, int, std::pair<int, int>> {
+ public:
+  explicit ChangeDetectingIntCache(MappedContainerBase<int, int>* raw_container)
+      : ThreadsafeCache<int, int, std::pair<int, int>>(raw_container) {}
+
+ private:
+  virtual void rawToCacheImpl(const int& raw, std::pair<int, int>* cached)
+      const final override {
+    *CHECK_NOTNULL(cached) = std::make_pair(raw, raw);
+  }
+  virtual void cacheToRawImpl(const std::pair<int, int>& cached, int* raw)
+      const final override {
+    *CHECK_NOTNULL(raw) = cached.first;
+  }
+  virtual bool hasChangedImpl(const int& raw, std::pair<int, int>* cached)
+      const final override {
+    if (raw == CHECK_NOTNULL(cached)->second) {
+      return false;
+    }
+    cached->second = raw;
+    return true;
+  }
+};
+
+TEST(ThreadsafeCacheFlushTest, FlushSkipsUnchangedItems) {
+  constexpr int kNumItems = 1000;
+  CountingContainer raw;
+  for (int i = 0; i < kNumItems; ++i) {
+    raw.insert(i, i);
+  }
+  ChangeDetectingIntCache cache(&raw);
+  for (int i = 0; i < kNumItems; ++i) {
+    // Made dirty, but left unchanged, except for the first item.
+    cache.getMutable(i).first = (i == 0) ? -1 : i;
+  }
+
+  const size_t num_accesses_before_flush = raw.numAccesses();
+  cache.flush();
+  // A single getMutable() for the changed item.
+  EXPECT_EQ(1u, raw.numAccesses() - num_accesses_before_flush);
+  EXPECT_EQ(-1, raw.get(0));
+  EXPECT_EQ(1, raw.get(1));
+
+  // Reverting the change is detected as a change again.
+  cache.getMutable(0).first = 0;
+  cache.flush();
+  EXPECT_EQ(0, raw.get(0));
+}
+
+TEST(ThreadsafeCacheEvictionTest, EvictsOnlyCleanEntries) {
+  constexpr int kNumItems = 1000;
+  constexpr int kNumChanges = 300;
+  constexpr size_t kMaxItems = IntCache::kNumShards * 10u;
+  HashMapContainer<int, int> raw;
+  for (int i = 0; i < kNumItems; ++i) {
+    raw.insert(i, i);
+  }
+  IntCache cache(&raw);
+  cache.setMemoryBudget(kMaxItems, [](const int&) { return 1u; });
+
+  // Values obtained by getShared() outlive the eviction of their entries.
+  const std::shared_ptr<const int> shared = cache.getShared(0);
+  for (int i = 0; i < kNumItems; ++i) {
+    ASSERT_EQ(i, *cache.getShared(i));
+  }
+  EXPECT_LE(cache.numCachedItems(), kMaxItems);
+  EXPECT_EQ(cache.numCachedItems(), cache.numCachedBytes());
+  EXPECT_EQ(0, *shared);
+
+  // Changed entries are pinned until flushed.
+  for (int i = 0; i < kNumChanges; ++i) {
+    cache.getMutable(i) = -i;
+  }
+  ASSERT_TRUE(cache.insert(kNumItems, kNumItems));
+  for (int i = kNumChanges; i < kNumItems; ++i) {
+    ASSERT_EQ(i, *cache.getShared(i));
+  }
+  EXPECT_GT(cache.numCachedItems(), static_cast<size_t>(kNumChanges));
+  for (int i = 0; i < kNumChanges; ++i) {
+    ASSERT_EQ(-i, cache.get(i));
+  }
+
+  cache.flush();
+  EXPECT_LE(cache.numCachedItems(), kMaxItems);
+  for (int i = 0; i < kNumChanges; ++i) {
+    EXPECT_EQ(-i, raw.get(i));
+    EXPECT_EQ(-i, cache.get(i));
+  }
+  EXPECT_EQ(kNumItems, raw.get(kNumItems));
+  EXPECT_EQ(kNumItems, cache.get(kNumItems));
+}
+
+TEST(ThreadsafeCacheEvictionTest, ReadOnlySweepThroughGetStaysWithinBudget) {
+  constexpr int kNumItems = 1000;
+  constexpr int kNumSweeps = 3;
+  constexpr size_t kMaxItems = IntCache::kNumShards * 10u;
+  HashMapContainer<int, int> raw;
+  for (int i = 0; i < kNumItems; ++i) {
+    raw.insert(i, i);
+  }
+  IntCache cache(&raw);
+  cache.setMemoryBudget(kMaxItems, [](const int&) { return 1u; });
+
+  // As in a long read-only transaction, nothing is flushed in between.
+  for (int sweep = 0; sweep < kNumSweeps; ++sweep) {
+    for (int i = 0; i < kNumItems; ++i) {
+      ASSERT_EQ(i, cache.get(i));
+      ASSERT_LE(cache.numCachedItems(), kMaxItems);
+    }
+  }
+  EXPECT_EQ(cache.numCachedItems(), cache.numCachedBytes());
+}
+
+TEST(ThreadsafeCachePrefetchTest, PrefetchConvertsInParallel) {
+  constexpr int kNumItems = 10000;
+  CountingContainer raw;
+  for (int i = 0; i < kNumItems; ++i) {
+    raw.insert(i, i);
+  }
+  IntCache cache(&raw);
+  ASSERT_EQ(0, cache.get(0));
+
+  std::atomic<size_t> num_tasks(0u);
+  const IntCache::ParallelFor parallel_for = [&num_tasks](
+      size_t num_items, const std::function<void(size_t)>& function) {
+    constexpr size_t kNumThreads = 4u;
+    std::vector<std::thread> threads;
+    for (size_t thread = 0u; thread < kNumThreads; ++thread) {
+      threads.emplace_back([&, thread]() {
+        for (size_t i = thread; i < num_items; i += kNumThreads) {
+          function(i);
+          ++num_tasks;
+        }
+      });
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+  };
+  cache.prefetchAll(parallel_for);
+  // The item that was cached already is skipped.
+  EXPECT_EQ(static_cast<size_t>(kNumItems - 1), num_tasks);
+
+  const size_t num_accesses_after_prefetch = raw.numAccesses();
+  for (int i = 0; i < kNumItems; ++i) {
+    EXPECT_EQ(i, cache.get(i));
+  }
+  EXPECT_EQ(num_accesses_after_prefetch, raw.numAccesses());
+  cache.prefetchAll(parallel_for);
+  EXPECT_EQ(static_cast<size_t>(kNumItems - 1), num_tasks);
+}
+
+// Concurrent reads of cached items must not return stale or missing values.
+TEST_F(ThreadsafeCacheTest, ParallelReadsAreConsistent) {
+  constexpr size_t kNumThreads = 4u;
+  constexpr int kNumReadsPerThread = 20000;
+  for (int i = 0; i < kNumRawItems; ++i) {
+    ASSERT_EQ(i, cache_->get(i));
+  }
+
+  std::atomic<int> num_reads(0);
+  std::atomic<int> num_mismatches(0);
+  std::vector<std::thread> threads;
+  for (size_t thread = 0u; thread < kNumThreads; ++thread) {
+    threads.emplace_back([this, thread, &num_reads, &num_mismatches]() {
+      for (int i = 0; i < kNumReadsPerThread; ++i) {
+        const int id = static_cast<int>(
+            (static_cast<size_t>(i) * 7919u + thread) % kNumRawItems);
+        if (!cache_->has(id) || cache_->get(id) != id) {
+          ++num_mismatches;
+        }
+        ++num_reads;
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(0, num_mismatches);
+  EXPECT_EQ(static_cast<int>(kNumThreads) * kNumReadsPerThread, num_reads);
+}
+
+// Reads of cached items in different shards don't contend, so the read
+// throughput should grow with the number of threads. Only logged, since the
+// speedup depends on the machine.
+TEST_F(ThreadsafeCacheTest, ParallelReadThroughput) {
+  constexpr size_t kMaxThreads = 8u;
+  constexpr int kNumReadsPerThread = 200000;
+  for (int i = 0; i < kNumRawItems; ++i) {
+    ASSERT_EQ(i, cache_->get(i));
+  }
+
+  auto reads_per_second = [this](size_t num_threads) {
+    std::atomic<int> num_mismatches(0);
+    const std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t thread = 0u; thread < num_threads; ++thread) {
+      threads.emplace_back([this, thread, &num_mismatches]() {
+        for (int i = 0; i < kNumReadsPerThread; ++i) {
+          const int id = static_cast<int>(
+              (static_cast<size_t>(i) * 7919u + thread) % kNumRawItems);
+          if (cache_->get(id) != id) {
+            ++num_mismatches;
+          }
+        }
+      });
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+    const double seconds = std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+    EXPECT_EQ(0, num_mismatches);
+    return num_threads * kNumReadsPerThread / seconds;
+  };
+
+  const double single_thread = reads_per_second(1u);
+  const size_t num_threads = std::min(kMaxThreads, numThreads());
+  const double multi_thread = reads_per_second(num_threads);
+  LOG(INFO) << "Cache reads per second: " << single_thread << " with 1 thread, "
+            << multi_thread << " with " << num_threads << " threads ("
+            << multi_thread / single_thread << "x).";
+}
+
+}  // namespace map_api_common
+
+MAP_API_UNITTEST_ENTRYPOINT
@@ -21,6 +21,7 @@
 
 #include "map-api/conflicts.h"
 #include "map-api/ipc.h"
+#include "map-api/read-only-transaction.h"
 #include "map-api/test/testing-entrypoint.h"
 #include "map-api/transaction.h"
 #include "./net_table_fixture.h"
@@ -133,6 +134,206 @@ TEST_F(TransactionTest, TandemCommit) {
   }
 }
 
+TEST_F(TransactionTest, CommitFutureViewSurvivesCompaction) {
+  Transaction writer;
+  map_api_common::Id updated_id, kept_id;
+  insert(1, &updated_id, &writer);
+  insert(1, &kept_id, &writer);
+  ASSERT_TRUE(writer.commit());
+
+  Transaction::CommitFutureTree commit_futures;
+  {
+    Transaction dependee;
+    update(2, updated_id, &dependee);
+    ASSERT_TRUE(dependee.commitInParallel(&commit_futures));
+    dependee.joinParallelCommitIfRunning();
+  }
+  // Only the commit futures read at the time before the dependee commit now.
+  Transaction updater;
+  update(3, kept_id, &updater);
+  ASSERT_TRUE(updater.commit());
+  table_->compactHistory();
+
+  Transaction depender(commit_futures);
+  std::shared_ptr<const Revision> revision =
+      depender.getById(kept_id, table_);
+  ASSERT_TRUE(static_cast<bool>(revision));
+  EXPECT_TRUE(revision->verifyEqual(kFieldName, 1));
+  revision = depender.getById(updated_id, table_);
+  ASSERT_TRUE(static_cast<bool>(revision));
+  EXPECT_TRUE(revision->verifyEqual(kFieldName, 2));
+}
+
+TEST_F(TransactionTest, ReadOnlyTransaction) {
+  Transaction writer;
+  map_api_common::Id inserted_id;
+  insert(1, &inserted_id, &writer);
+  ASSERT_TRUE(writer.commit());
+
+  ReadOnlyTransaction before_update;
+  Transaction updater;
+  update(2, inserted_id, &updater);
+  ASSERT_TRUE(updater.commit());
+  ReadOnlyTransaction after_update;
+  EXPECT_LE(before_update.getBeginTime(), Transaction::oldestActiveBeginTime());
+
+  std::shared_ptr<const Revision> revision =
+      before_update.getById(inserted_id, table_);
+  ASSERT_TRUE(static_cast<bool>(revision));
+  EXPECT_TRUE(revision->verifyEqual(kFieldName, 1));
+  revision = after_update.getById(inserted_id, table_, chunk_);
+  ASSERT_TRUE(static_cast<bool>(revision));
+  EXPECT_TRUE(revision->verifyEqual(kFieldName, 2));
+
+  std::vector<map_api_common::Id> ids;
+  after_update.getAvailableIds(table_, &ids);
+  EXPECT_EQ(1u, ids.size());
+  ConstRevisionMap dump;
+  after_update.dumpActiveChunks(table_, &dump);
+  EXPECT_EQ(1u, dump.size());
+}
+
+TEST_F(TransactionTest, ForEachItem) {
+  Transaction writer;
+  map_api_common::Id updated_id, removed_id, unchanged_id;
+  insert(1, &updated_id, &writer);
+  insert(1, &removed_id, &writer);
+  insert(1, &unchanged_id, &writer);
+  ASSERT_TRUE(writer.commit());
+
+  Transaction transaction;
+  map_api_common::Id inserted_id;
+  insert(3, &inserted_id, &transaction);
+  update(2, updated_id, &transaction);
+  transaction.remove(removed_id, table_);
+
+  ConstRevisionMap streamed;
+  transaction.forEachItemInActiveChunks(
+      table_, [&streamed](const map_api_common::Id& id,
+                          const std::shared_ptr<const Revision>& item) {
+        EXPECT_TRUE(streamed.emplace(id, item).second);
+      });
+  ConstRevisionMap dumped;
+  transaction.dumpActiveChunks(table_, &dumped);
+  ASSERT_EQ(3u, streamed.size());
+  ASSERT_EQ(dumped.size(), streamed.size());
+  for (const ConstRevisionMap::value_type& item : dumped) {
+    ConstRevisionMap::const_iterator found = streamed.find(item.first);
+    ASSERT_TRUE(found != streamed.end());
+    EXPECT_TRUE(*item.second == *found->second);
+  }
+  EXPECT_EQ(0u, streamed.count(removed_id));
+  EXPECT_TRUE(streamed.at(updated_id)->verifyEqual(kFieldName, 2));
+  EXPECT_TRUE(streamed.at(inserted_id)->verifyEqual(kFieldName, 3));
+
+  ReadOnlyTransaction reader;
+  size_t num_items = 0u;
+  reader.forEachItemInChunk(
+      table_, chunk_, [&num_items](const map_api_common::Id& /*id*/,
+                                   const std::shared_ptr<const Revision>& item) {
+        EXPECT_TRUE(item->verifyEqual(kFieldName, 1));
+        ++num_items;
+      });
+  EXPECT_EQ(3u, num_items);
+}
+
+TEST_F(TransactionTest, AutoMergeManyConflicts) {
+  constexpr size_t kNumItems = 100u;
+  // Merges concurrent increments.
+  table_->addAutoMergePolicy([](const Revision& conflicting,
+                                const Revision& original,
+                                Revision* at_hand) {
+    int conflicting_value, original_value, at_hand_value;
+    conflicting.get(kFieldName, &conflicting_value);
+    original.get(kFieldName, &original_value);
+    CHECK_NOTNULL(at_hand)->get(kFieldName, &at_hand_value);
+    if (conflicting_value <= original_value ||
+        at_hand_value <= original_value) {
+      return false;
+    }
+    at_hand->set(kFieldName,
+                 conflicting_value + at_hand_value - original_value);
+    return true;
+  });
+
+  Transaction writer;
+  std::vector<map_api_common::Id> ids(kNumItems);
+  for (map_api_common::Id& id : ids) {
+    insert(1, &id, &writer);
+  }
+  ASSERT_TRUE(writer.commit());
+
+  Transaction mergeable, perturber;
+  for (const map_api_common::Id& id : ids) {
+    update(2, id, &mergeable);
+    update(2, id, &perturber);
+  }
+  ASSERT_TRUE(perturber.commit());
+  EXPECT_TRUE(mergeable.commit());
+  Transaction merge_reader;
+  for (const map_api_common::Id& id : ids) {
+    std::shared_ptr<const Revision> item =
+        merge_reader.getById(id, table_, chunk_);
+    ASSERT_TRUE(static_cast<bool>(item));
+    EXPECT_TRUE(item->verifyEqual(kFieldName, 3));
+  }
+
+  Transaction unmergeable, second_perturber;
+  for (const map_api_common::Id& id : ids) {
+    update(4, id, &unmergeable);
+    update(4, id, &second_perturber);
+  }
+  update(0, ids.back(), &unmergeable);
+  ASSERT_TRUE(second_perturber.commit());
+  EXPECT_FALSE(unmergeable.commit());
+
+  Transaction reader;
+  for (const map_api_common::Id& id : ids) {
+    std::shared_ptr<const Revision> item =
+        reader.getById(id, table_, chunk_);
+    ASSERT_TRUE(static_cast<bool>(item));
+    EXPECT_TRUE(item->verifyEqual(kFieldName, 4));
+  }
+}
+
+TEST_F(TransactionTest, GetByIds) {
+  constexpr size_t kNumItems = 100u;
+  Transaction writer;
+  std::vector<map_api_common::Id> ids(kNumItems);
+  for (map_api_common::Id& id : ids) {
+    insert(1, &id, &writer);
+  }
+  ASSERT_TRUE(writer.commit());
+
+  Transaction transaction;
+  update(2, ids[0], &transaction);
+  transaction.remove(ids[1], table_);
+  map_api_common::Id inserted_id, unknown_id;
+  insert(3, &inserted_id, &transaction);
+  map_api_common::generateId(&unknown_id);
+  ids.push_back(inserted_id);
+  ids.push_back(unknown_id);
+  // Duplicates are resolved as well.
+  ids.push_back(ids[0]);
+
+  std::vector<std::shared_ptr<const Revision>> results;
+  transaction.getByIds(ids, table_, &results);
+  ASSERT_EQ(ids.size(), results.size());
+  for (size_t i = 0u; i < ids.size(); ++i) {
+    const std::shared_ptr<const Revision> expected =
+        transaction.getById(ids[i], table_);
+    ASSERT_EQ(static_cast<bool>(expected), static_cast<bool>(results[i]));
+    if (expected) {
+      EXPECT_TRUE(*expected == *results[i]);
+    }
+  }
+  EXPECT_TRUE(results[0]->verifyEqual(kFieldName, 2));
+  EXPECT_FALSE(results[1]);
+  EXPECT_TRUE(results[2]->verifyEqual(kFieldName, 1));
+  EXPECT_TRUE(results[kNumItems]->verifyEqual(kFieldName, 3));
+  EXPECT_FALSE(results[kNumItems + 1u]);
+}
+
 }  // namespace map_api
 
 MAP_API_UNITTEST_ENTRYPOINT
@@ -0,0 +1,57 @@
+// Copyright (C) 2014-2017 Titus Cieslewski, ASL, ETH Zurich, Switzerland
+// You can contact the author at <titus at ifi dot uzh dot ch>
+// Copyright (C) 2014-2015 Simon Lynen, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014-2015, Marcin Dymczyk, ASL, ETH Zurich, Switzerland
+// Copyright (c) 2014, Stéphane Magnenat, ASL, ETH Zurich, Switzerland
+//
+// This file is part of Map API.
+//
+// Map API is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// Map API is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with Map API. If not, see <http://www.gnu.org/licenses/>.
+
+#include <atomic>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "map-api/internal/worker-pool.h"
+#include "map-api/test/testing-entrypoint.h"
+
+namespace map_api {
+namespace internal {
+
+TEST(WorkerPoolTest, RunsAllTasks) {
+  constexpr size_t kNumTasks = 1000u;
+  std::vector<int> results(kNumTasks, 0);
+  WorkerPool::instance().parallelFor(
+      kNumTasks, [&results](size_t i) { results[i] = static_cast<int>(i); });
+  for (size_t i = 0u; i < kNumTasks; ++i) {
+    EXPECT_EQ(static_cast<int>(i), results[i]);
+  }
+}
+
+TEST(WorkerPoolTest, NestedCallsComplete) {
+  constexpr size_t kNumOuterTasks = 64u;
+  constexpr size_t kNumInnerTasks = 64u;
+  std::atomic<size_t> count(0u);
+  WorkerPool& pool = WorkerPool::instance();
+  pool.parallelFor(kNumOuterTasks, [&pool, &count](size_t) {
+    pool.parallelFor(kNumInnerTasks, [&count](size_t) { ++count; });
+  });
+  EXPECT_EQ(kNumOuterTasks * kNumInnerTasks, count);
+}
+
+}  // namespace internal
+}  // namespace map_api
+
+MAP_API_UNITTEST_ENTRYPOINT